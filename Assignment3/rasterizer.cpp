@@ -3,6 +3,8 @@
 //
 
 #include <algorithm>
+#include <atomic>
+#include <thread>
 #include "rasterizer.hpp"
 #include <opencv2/opencv.hpp>
 #include <math.h>
@@ -170,74 +172,139 @@ static std::tuple<float, float, float> computeBarycentric2D(float x, float y, co
     return {c1,c2,c3};
 }
 
+// Run f(i) for i in [0, count) on threads workers (all cores when 0), which
+// claim indices through a shared counter
+template <typename F>
+static void parallel_for(int count, int threads, F f)
+{
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++)
+            f(i);
+    };
+    threads = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, count);
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; ++t)
+        workers.emplace_back(worker);
+    worker();
+    for (auto& w : workers)
+        w.join();
+}
+
 void rst::rasterizer::draw(std::vector<Triangle *> &TriangleList) {
 
     float f1 = (50 - 0.1) / 2.0;
     float f2 = (50 + 0.1) / 2.0;
 
     Eigen::Matrix4f mvp = projection * view * model;
-    for (const auto& t:TriangleList)
-    {
-        Triangle newtri = *t;
-
-        std::array<Eigen::Vector4f, 3> mm {
-                (view * model * t->v[0]),
-                (view * model * t->v[1]),
-                (view * model * t->v[2])
-        };
-
-        std::array<Eigen::Vector3f, 3> viewspace_pos;
-
-        std::transform(mm.begin(), mm.end(), viewspace_pos.begin(), [](auto& v) {
-            return v.template head<3>();
-        });
-
-        Eigen::Vector4f v[] = {
-                mvp * t->v[0],
-                mvp * t->v[1],
-                mvp * t->v[2]
-        };
-        //Homogeneous division
-        for (auto& vec : v) {
-            vec.x()/=vec.w();
-            vec.y()/=vec.w();
-            vec.z()/=vec.w();
-        }
+    Eigen::Matrix4f inv_trans = (view * model).inverse().transpose();
+
+    int n = TriangleList.size();
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    int tiles = tiles_x * tiles_y;
+    // a few batches per core, so a batch of large triangles does not hold
+    // up the others
+    int hardware = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    int batches = std::max(1, std::min(n, 4 * hardware));
+    int batch_size = (n + batches - 1) / batches;
+
+    screen_triangles.resize(n);
+    view_positions.resize(n);
+    bins.resize(batches * tiles);
+    for (auto& bin : bins)
+        bin.clear();
+
+    // Geometry stage
+    parallel_for(batches, threads, [&](int batch) {
+        for (int k = batch * batch_size; k < std::min(n, (batch + 1) * batch_size); ++k)
+        {
+            const Triangle* t = TriangleList[k];
+            Triangle& newtri = screen_triangles[k];
+            newtri = *t;
+
+            std::array<Eigen::Vector4f, 3> mm {
+                    (view * model * t->v[0]),
+                    (view * model * t->v[1]),
+                    (view * model * t->v[2])
+            };
+
+            // Also pass view space vertice position
+            std::transform(mm.begin(), mm.end(), view_positions[k].begin(), [](auto& v) {
+                return v.template head<3>();
+            });
+
+            Eigen::Vector4f v[] = {
+                    mvp * t->v[0],
+                    mvp * t->v[1],
+                    mvp * t->v[2]
+            };
+            //Homogeneous division
+            for (auto& vec : v) {
+                vec.x()/=vec.w();
+                vec.y()/=vec.w();
+                vec.z()/=vec.w();
+            }
 
-        Eigen::Matrix4f inv_trans = (view * model).inverse().transpose();
-        Eigen::Vector4f n[] = {
-                inv_trans * to_vec4(t->normal[0], 0.0f),
-                inv_trans * to_vec4(t->normal[1], 0.0f),
-                inv_trans * to_vec4(t->normal[2], 0.0f)
-        };
+            Eigen::Vector4f nn[] = {
+                    inv_trans * to_vec4(t->normal[0], 0.0f),
+                    inv_trans * to_vec4(t->normal[1], 0.0f),
+                    inv_trans * to_vec4(t->normal[2], 0.0f)
+            };
 
-        //Viewport transformation
-        for (auto & vert : v)
-        {
-            vert.x() = 0.5f*width*(vert.x()+1.0);
-            vert.y() = 0.5f*height*(vert.y()+1.0);
-            vert.z() = vert.z() * f1 + f2;
-        }
+            //Viewport transformation
+            for (auto & vert : v)
+            {
+                vert.x() = 0.5f*width*(vert.x()+1.0);
+                vert.y() = 0.5f*height*(vert.y()+1.0);
+                vert.z() = vert.z() * f1 + f2;
+            }
 
-        for (int i = 0; i < 3; ++i)
-        {
-            //screen space coordinates
-            newtri.setVertex(i, v[i]);
+            for (int i = 0; i < 3; ++i)
+            {
+                //screen space coordinates
+                newtri.setVertex(i, v[i]);
+            }
+
+            for (int i = 0; i < 3; ++i)
+            {
+                //view space normal
+                newtri.setNormal(i, nn[i].head<3>());
+            }
+
+            newtri.setColor(0, 148,121.0,92.0);
+            newtri.setColor(1, 148,121.0,92.0);
+            newtri.setColor(2, 148,121.0,92.0);
+
+            // Binning: every tile the pixels of the bounding box fall in
+            float x_min = std::min(v[0].x(), std::min(v[1].x(), v[2].x()));
+            float x_max = std::max(v[0].x(), std::max(v[1].x(), v[2].x()));
+            float y_min = std::min(v[0].y(), std::min(v[1].y(), v[2].y()));
+            float y_max = std::max(v[0].y(), std::max(v[1].y(), v[2].y()));
+            // also rejects NaN bounds
+            if (!(x_max >= 0 && y_max >= 0 && x_min <= width - 1 && y_min <= height - 1))
+                continue;
+            int tx0 = (int)std::floor(std::max(x_min, 0.f)) / tile_size;
+            int tx1 = (int)std::ceil(std::min(x_max, width - 1.f)) / tile_size;
+            int ty0 = (int)std::floor(std::max(y_min, 0.f)) / tile_size;
+            int ty1 = (int)std::ceil(std::min(y_max, height - 1.f)) / tile_size;
+            for (int ty = ty0; ty <= ty1; ++ty)
+                for (int tx = tx0; tx <= tx1; ++tx)
+                    bins[batch * tiles + ty * tiles_x + tx].push_back(k);
         }
+    });
 
-        for (int i = 0; i < 3; ++i)
+    // Raster stage
+    parallel_for(tiles, threads, [&](int tile) {
+        int x0 = tile % tiles_x * tile_size, y0 = tile / tiles_x * tile_size;
+        int x1 = std::min(width, x0 + tile_size) - 1, y1 = std::min(height, y0 + tile_size) - 1;
+        for (int batch = 0; batch < batches; ++batch)
         {
-            //view space normal
-            newtri.setNormal(i, n[i].head<3>());
+            for (int k : bins[batch * tiles + tile])
+                rasterize_triangle(screen_triangles[k], view_positions[k], x0, y0, x1, y1);
         }
-
-        newtri.setColor(0, 148,121.0,92.0);
-        newtri.setColor(1, 148,121.0,92.0);
-        newtri.setColor(2, 148,121.0,92.0);
-
-        // Also pass view space vertice position
-        rasterize_triangle(newtri, viewspace_pos);
-    }
+    });
 }
 
 static Eigen::Vector3f interpolate(float alpha, float beta, float gamma, const Eigen::Vector3f& vert1, const Eigen::Vector3f& vert2, const Eigen::Vector3f& vert3, float weight)
@@ -257,15 +324,16 @@ static Eigen::Vector2f interpolate(float alpha, float beta, float gamma, const E
 }
 
 //Screen space rasterization
-void rst::rasterizer::rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos) 
+void rst::rasterizer::rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos,
+                                         int x0, int y0, int x1, int y1)
 {
     auto v = t.toVector4();
 
     // iterate through the pixel and find if the current pixel is inside the triangle
-    int x_min = std::floor(std::min(v[0].x(), std::min(v[1].x(), v[2].x())));
-    int x_max = std::ceil(std::max(v[0].x(), std::max(v[1].x(), v[2].x())));
-    int y_min = std::floor(std::min(v[0].y(), std::min(v[1].y(), v[2].y())));
-    int y_max = std::ceil(std::max(v[0].y(), std::max(v[1].y(), v[2].y())));
+    int x_min = std::max(x0, (int)std::floor(std::min(v[0].x(), std::min(v[1].x(), v[2].x()))));
+    int x_max = std::min(x1, (int)std::ceil(std::max(v[0].x(), std::max(v[1].x(), v[2].x()))));
+    int y_min = std::max(y0, (int)std::floor(std::min(v[0].y(), std::min(v[1].y(), v[2].y()))));
+    int y_max = std::min(y1, (int)std::ceil(std::max(v[0].y(), std::max(v[1].y(), v[2].y()))));
     for (int i = x_min; i <= x_max; i++)
     {
         for (int j = y_min; j <= y_max; j++)
@@ -338,15 +406,16 @@ rst::rasterizer::rasterizer(int w, int h) : width(w), height(h)
     texture = std::nullopt;
 }
 
+// rows are stored top down, y = height - 1 first
 int rst::rasterizer::get_index(int x, int y)
 {
-    return (height-y)*width + x;
+    return (height-1-y)*width + x;
 }
 
 void rst::rasterizer::set_pixel(const Vector2i &point, const Eigen::Vector3f &color)
 {
     //old index: auto ind = point.y() + point.x() * width;
-    int ind = (height-point.y())*width + point.x();
+    int ind = (height-1-point.y())*width + point.x();
     frame_buf[ind] = color;
 }
 
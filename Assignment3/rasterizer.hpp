@@ -71,6 +71,9 @@ namespace rst
         void set_projection(const Eigen::Matrix4f& p);
 
         void set_texture(Texture tex) { texture = tex; }
+        // Threads that draw() transforms and rasterizes with, 0 uses every
+        // hardware thread
+        void set_threads(int n) { threads = n; }
 
         void set_vertex_shader(std::function<Eigen::Vector3f(vertex_shader_payload)> vert_shader);
         void set_fragment_shader(std::function<Eigen::Vector3f(fragment_shader_payload)> frag_shader);
@@ -87,9 +90,20 @@ namespace rst
     private:
         void draw_line(Eigen::Vector3f begin, Eigen::Vector3f end);
 
-        void rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos);
+        // Rasterize and shade the pixels of t inside [x0, x1] x [y0, y1]
+        void rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos,
+                                int x0, int y0, int x1, int y1);
 
         // VERTEX SHADER -> MVP -> Clipping -> /.W -> VIEWPORT -> DRAWLINE/DRAWTRI -> FRAGSHADER
+        //
+        // draw(TriangleList) runs this sort-middle: a geometry stage
+        // transforms contiguous batches of triangles in parallel and sorts
+        // each into the screen tiles its bounds overlap, then a raster stage
+        // draws the tiles in parallel. A tile owns its pixels of frame_buf
+        // and depth_buf, so no locks are needed, and it draws its triangles
+        // batch by batch, in the order they were given, so the image is the
+        // same as drawing them one after another.
+        static constexpr int tile_size = 64;
 
     private:
         Eigen::Matrix4f model;
@@ -113,6 +127,15 @@ namespace rst
         int get_index(int x, int y);
 
         int width, height;
+        int threads = 0;
+
+        // Output of the geometry stage, kept between draws for its storage:
+        // the screen-space triangles and their view-space positions, and
+        // bins[batch * tile count + tile] listing the triangles of a batch
+        // that overlap a tile
+        std::vector<Triangle> screen_triangles;
+        std::vector<std::array<Eigen::Vector3f, 3>> view_positions;
+        std::vector<std::vector<int>> bins;
 
         int next_id = 0;
         int get_next_id() { return next_id++; }
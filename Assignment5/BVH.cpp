@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include "BVH.hpp"
+#include "Sphere.hpp"
+#include "Triangle.hpp"
+#include "raymath/Packet.hpp"
+
+namespace
+{
+constexpr int kBuckets = 12;
+constexpr uint32_t kMaxPrimsInLeaf = 4;
+static_assert(kMaxPrimsInLeaf <= 4, "leaves must fit in one SIMD packet");
+// Binned SAH may peel off one primitive per level; below kMaxSahDepth nodes
+// are split at the centroid median instead, which halves them, so no path
+// is longer than kMaxDepth and the traversal stack below never overflows
+constexpr int kMaxSahDepth = 32;
+constexpr int kMaxDepth = kMaxSahDepth + 32;
+
+inline float surfaceArea(const Vector3f& pMin, const Vector3f& pMax)
+{
+    Vector3f d = pMax - pMin;
+    return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+}
+
+// Slab test against [tMin, tMax), invDir holds the reciprocal direction
+inline bool hitBox(const BVHNode& node, const Vector3f& orig, const Vector3f& invDir, float tMax)
+{
+    float t0 = (node.pMin.x - orig.x) * invDir.x, t1 = (node.pMax.x - orig.x) * invDir.x;
+    float tEnter = std::min(t0, t1), tExit = std::max(t0, t1);
+    t0 = (node.pMin.y - orig.y) * invDir.y, t1 = (node.pMax.y - orig.y) * invDir.y;
+    tEnter = std::max(tEnter, std::min(t0, t1)), tExit = std::min(tExit, std::max(t0, t1));
+    t0 = (node.pMin.z - orig.z) * invDir.z, t1 = (node.pMax.z - orig.z) * invDir.z;
+    tEnter = std::max(tEnter, std::min(t0, t1)), tExit = std::min(tExit, std::max(t0, t1));
+    return tEnter <= tExit && tExit >= 0 && tEnter < tMax;
+}
+
+// The packet kernels below return a bit mask of the lanes hit closer than
+// tMax and write each lane's distance (and barycentrics) to the out arrays.
+inline int laneMask(uint32_t count)
+{
+    return (1 << count) - 1;
+}
+
+// Same quadratic as solveQuadratic, four spheres at a time
+int intersectSpheres(const SpherePacket& p, const Vector3f& orig, const Vector3f& dir, float tMax, float t[4])
+{
+    Vector3f4 L = Vector3f4(orig) - Vector3f4::load(p.cx, p.cy, p.cz);
+    Float4 zero(0.f);
+    Float4 a = dotProduct(dir, dir);
+    Float4 b = Float4(2) * dotProduct(Vector3f4(dir), L);
+    Float4 c = dotProduct(L, L) - Float4::load(p.radius2);
+    Float4 discr = b * b - Float4(4) * (a * c);
+    Float4 valid = discr >= zero;
+    Float4 root = sqrt(max(discr, zero));
+    root = select(b > zero, root, zero - root);
+    Float4 q = Float4(-0.5f) * (b + root);
+    Float4 x0 = q / a, x1 = c / q;
+    Float4 tLo = min(x0, x1), tHi = max(x0, x1);
+    Float4 tHit = select(tLo < zero, tHi, tLo);
+    valid = valid & (tHit >= zero) & (tHit < Float4(tMax));
+    tHit.store(t);
+    return movemask(valid) & laneMask(p.count);
+}
+
+// Same test as rayTriangleIntersect, four triangles at a time
+int intersectTriangles(const TrianglePacket& p, const Vector3f& orig, const Vector3f& dir, float tMax, float t[4],
+                       float u[4], float v[4])
+{
+    Vector3f4 d(dir);
+    Vector3f4 e1 = Vector3f4::load(p.e1x, p.e1y, p.e1z), e2 = Vector3f4::load(p.e2x, p.e2y, p.e2z);
+    Vector3f4 s1 = crossProduct(d, e2);
+    Float4 zero(0.f);
+    Float4 det = dotProduct(s1, e1);
+    Float4 valid = max(det, zero - det) >= Float4(kDeterminantEpsilon);
+    Float4 inv = rcp(det);
+    Vector3f4 s = Vector3f4(orig) - Vector3f4::load(p.v0x, p.v0y, p.v0z);
+    Vector3f4 s2 = crossProduct(s, e1);
+    Float4 tHit = dotProduct(s2, e2) * inv;
+    Float4 b1 = dotProduct(s1, s) * inv;
+    Float4 b2 = dotProduct(s2, d) * inv;
+    valid = valid & (tHit >= zero) & (tHit < Float4(tMax));
+    valid = valid & (b1 >= zero) & (b2 >= zero) & (b1 + b2 <= Float4(1));
+    tHit.store(t);
+    b1.store(u);
+    b2.store(v);
+    return movemask(valid) & laneMask(p.count);
+}
+
+// Lane of the closest hit among the lanes set in mask
+inline int closestLane(int mask, const float t[4])
+{
+    int best = -1;
+    for (int i = 0; i < 4; ++i)
+        if ((mask & (1 << i)) && (best < 0 || t[i] < t[best]))
+            best = i;
+    return best;
+}
+} // namespace
+
+BVH::BVH(const std::vector<std::unique_ptr<Object>>& objects)
+{
+    std::vector<BVHPrimitive> prims;
+    std::vector<Vector3f> pMin, pMax;
+    for (const auto& object : objects)
+    {
+        for (uint32_t i = 0; i < object->getPrimitiveCount(); ++i)
+        {
+            Vector3f lo, hi;
+            object->getPrimitiveBounds(i, lo, hi);
+            prims.push_back({object.get(), i});
+            pMin.push_back(lo);
+            pMax.push_back(hi);
+        }
+    }
+    if (prims.empty())
+        return;
+    nodes.reserve(2 * prims.size());
+    build(prims, pMin, pMax, 0, prims.size(), 0);
+    buildLeaves(prims);
+}
+
+// Move every leaf's spheres and triangles into SIMD packets
+void BVH::buildLeaves(const std::vector<BVHPrimitive>& prims)
+{
+    for (auto& node : nodes)
+    {
+        if (node.count == 0)
+            continue;
+        BVHLeaf leaf;
+        leaf.genericOffset = primitives.size();
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+        {
+            const BVHPrimitive& prim = prims[i];
+            if (auto sphere = dynamic_cast<const Sphere*>(prim.object))
+            {
+                if (leaf.spheres < 0)
+                {
+                    leaf.spheres = spheres.size();
+                    spheres.emplace_back();
+                }
+                SpherePacket& p = spheres[leaf.spheres];
+                uint32_t k = p.count++;
+                p.cx[k] = sphere->center.x;
+                p.cy[k] = sphere->center.y;
+                p.cz[k] = sphere->center.z;
+                p.radius2[k] = sphere->radius2;
+                p.object[k] = prim.object;
+            }
+            else if (auto mesh = dynamic_cast<const MeshTriangle*>(prim.object))
+            {
+                if (leaf.triangles < 0)
+                {
+                    leaf.triangles = triangles.size();
+                    triangles.emplace_back();
+                }
+                TrianglePacket& p = triangles[leaf.triangles];
+                uint32_t k = p.count++;
+                const Vector3f& v0 = mesh->vertices[mesh->vertexIndex[prim.index * 3]];
+                Vector3f e1 = mesh->vertices[mesh->vertexIndex[prim.index * 3 + 1]] - v0;
+                Vector3f e2 = mesh->vertices[mesh->vertexIndex[prim.index * 3 + 2]] - v0;
+                p.v0x[k] = v0.x, p.v0y[k] = v0.y, p.v0z[k] = v0.z;
+                p.e1x[k] = e1.x, p.e1y[k] = e1.y, p.e1z[k] = e1.z;
+                p.e2x[k] = e2.x, p.e2y[k] = e2.y, p.e2z[k] = e2.z;
+                p.object[k] = prim.object;
+                p.index[k] = prim.index;
+            }
+            else
+            {
+                primitives.push_back(prim);
+                leaf.genericCount++;
+            }
+        }
+        node.offset = leaves.size();
+        leaves.push_back(leaf);
+    }
+}
+
+// Binned SAH split over primitive centroids
+uint32_t BVH::build(std::vector<BVHPrimitive>& prims, std::vector<Vector3f>& pMin, std::vector<Vector3f>& pMax,
+                    uint32_t begin, uint32_t end, int depth)
+{
+    assert(depth <= kMaxDepth);
+    uint32_t index = nodes.size();
+    nodes.emplace_back();
+    Vector3f lo(kInfinity), hi(-kInfinity), cLo(kInfinity), cHi(-kInfinity);
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        lo = Vector3f::Min(lo, pMin[i]);
+        hi = Vector3f::Max(hi, pMax[i]);
+        Vector3f c = (pMin[i] + pMax[i]) * 0.5f;
+        cLo = Vector3f::Min(cLo, c);
+        cHi = Vector3f::Max(cHi, c);
+    }
+    nodes[index].pMin = lo;
+    nodes[index].pMax = hi;
+
+    uint32_t count = end - begin;
+    Vector3f extent = cHi - cLo;
+    int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+    float axisLo = cLo[axis], axisExtent = extent[axis];
+    auto makeLeaf = [&]() {
+        nodes[index].offset = begin;
+        nodes[index].count = count;
+        return index;
+    };
+    if (count <= 1 || (axisExtent <= 0 && count <= kMaxPrimsInLeaf))
+        return makeLeaf();
+
+    if (depth >= kMaxSahDepth)
+    {
+        uint32_t mid = (begin + end) / 2;
+        if (axisExtent > 0)
+        {
+            auto centroid = [&](uint32_t i) { return (pMin[i] + pMax[i])[axis]; };
+            std::vector<uint32_t> order(count);
+            std::iota(order.begin(), order.end(), begin);
+            std::nth_element(order.begin(), order.begin() + (mid - begin), order.end(),
+                             [&](uint32_t a, uint32_t b) { return centroid(a) < centroid(b); });
+            std::vector<BVHPrimitive> sortedPrims(count);
+            std::vector<Vector3f> sortedMin(count), sortedMax(count);
+            for (uint32_t k = 0; k < count; ++k)
+            {
+                sortedPrims[k] = prims[order[k]];
+                sortedMin[k] = pMin[order[k]];
+                sortedMax[k] = pMax[order[k]];
+            }
+            std::copy(sortedPrims.begin(), sortedPrims.end(), prims.begin() + begin);
+            std::copy(sortedMin.begin(), sortedMin.end(), pMin.begin() + begin);
+            std::copy(sortedMax.begin(), sortedMax.end(), pMax.begin() + begin);
+        }
+        nodes[index].axis = axis;
+        nodes[index].count = 0;
+        build(prims, pMin, pMax, begin, mid, depth + 1);
+        nodes[index].offset = build(prims, pMin, pMax, mid, end, depth + 1);
+        return index;
+    }
+
+    auto bucketOf = [&](uint32_t i) {
+        float c = ((pMin[i] + pMax[i]) * 0.5f)[axis];
+        return std::min(kBuckets - 1, int(kBuckets * (c - axisLo) / axisExtent));
+    };
+    // cost of splitting after bucket s, relative to one primitive test
+    float bestCost = kInfinity;
+    int bestSplit = 0;
+    if (axisExtent > 0)
+    {
+        int bucketCount[kBuckets] = {};
+        Vector3f bucketLo[kBuckets], bucketHi[kBuckets];
+        std::fill(bucketLo, bucketLo + kBuckets, Vector3f(kInfinity));
+        std::fill(bucketHi, bucketHi + kBuckets, Vector3f(-kInfinity));
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            int b = bucketOf(i);
+            bucketCount[b]++;
+            bucketLo[b] = Vector3f::Min(bucketLo[b], pMin[i]);
+            bucketHi[b] = Vector3f::Max(bucketHi[b], pMax[i]);
+        }
+        for (int s = 0; s < kBuckets - 1; ++s)
+        {
+            Vector3f l0(kInfinity), l1(-kInfinity), r0(kInfinity), r1(-kInfinity);
+            int nl = 0, nr = 0;
+            for (int b = 0; b <= s; ++b)
+                l0 = Vector3f::Min(l0, bucketLo[b]), l1 = Vector3f::Max(l1, bucketHi[b]), nl += bucketCount[b];
+            for (int b = s + 1; b < kBuckets; ++b)
+                r0 = Vector3f::Min(r0, bucketLo[b]), r1 = Vector3f::Max(r1, bucketHi[b]), nr += bucketCount[b];
+            if (nl == 0 || nr == 0)
+                continue;
+            float cost = 0.125f + (nl * surfaceArea(l0, l1) + nr * surfaceArea(r0, r1)) / surfaceArea(lo, hi);
+            if (cost < bestCost)
+                bestCost = cost, bestSplit = s;
+        }
+    }
+    if (count <= kMaxPrimsInLeaf && bestCost >= count)
+        return makeLeaf();
+
+    uint32_t mid = begin;
+    if (bestCost < kInfinity)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            if (bucketOf(i) <= bestSplit)
+            {
+                std::swap(prims[i], prims[mid]);
+                std::swap(pMin[i], pMin[mid]);
+                std::swap(pMax[i], pMax[mid]);
+                ++mid;
+            }
+        }
+    }
+    else
+    {
+        // all centroids coincide or fell in one bucket, split in the middle
+        mid = (begin + end) / 2;
+    }
+
+    nodes[index].axis = axis;
+    nodes[index].count = 0;
+    build(prims, pMin, pMax, begin, mid, depth + 1);
+    nodes[index].offset = build(prims, pMin, pMax, mid, end, depth + 1);
+    return index;
+}
+
+std::optional<hit_payload> BVH::intersect(const Vector3f& orig, const Vector3f& dir) const
+{
+    std::optional<hit_payload> payload;
+    if (nodes.empty())
+        return payload;
+    Vector3f invDir = rcp(dir);
+    bool dirIsNeg[3] = {dir.x < 0, dir.y < 0, dir.z < 0};
+    float tNear = kInfinity;
+    // one pending sibling per level plus the two children just pushed
+    uint32_t stack[kMaxDepth + 1];
+    int size = 0;
+    stack[size++] = 0;
+    while (size > 0)
+    {
+        uint32_t current = stack[--size];
+        const BVHNode& node = nodes[current];
+        if (!hitBox(node, orig, invDir, tNear))
+            continue;
+        if (node.count > 0)
+        {
+            const BVHLeaf& leaf = leaves[node.offset];
+            float t[4], u[4], v[4];
+            if (leaf.spheres >= 0)
+            {
+                const SpherePacket& p = spheres[leaf.spheres];
+                int lane = closestLane(intersectSpheres(p, orig, dir, tNear, t), t);
+                if (lane >= 0)
+                {
+                    payload.emplace();
+                    payload->hit_obj = p.object[lane];
+                    payload->tNear = tNear = t[lane];
+                    payload->index = 0;
+                    payload->uv = Vector2f(0);
+                }
+            }
+            if (leaf.triangles >= 0)
+            {
+                const TrianglePacket& p = triangles[leaf.triangles];
+                int lane = closestLane(intersectTriangles(p, orig, dir, tNear, t, u, v), t);
+                if (lane >= 0)
+                {
+                    payload.emplace();
+                    payload->hit_obj = p.object[lane];
+                    payload->tNear = tNear = t[lane];
+                    payload->index = p.index[lane];
+                    payload->uv = Vector2f(u[lane], v[lane]);
+                }
+            }
+            for (uint32_t i = leaf.genericOffset; i < leaf.genericOffset + leaf.genericCount; ++i)
+            {
+                float tPrim = kInfinity;
+                Vector2f uv;
+                const BVHPrimitive& prim = primitives[i];
+                if (prim.object->intersectPrimitive(prim.index, orig, dir, tPrim, uv) && tPrim < tNear)
+                {
+                    payload.emplace();
+                    payload->hit_obj = prim.object;
+                    payload->tNear = tNear = tPrim;
+                    payload->index = prim.index;
+                    payload->uv = uv;
+                }
+            }
+            continue;
+        }
+        // visit the near child first so the far one can be culled by tNear
+        if (dirIsNeg[node.axis])
+        {
+            stack[size++] = current + 1;
+            stack[size++] = node.offset;
+        }
+        else
+        {
+            stack[size++] = node.offset;
+            stack[size++] = current + 1;
+        }
+    }
+    return payload;
+}
+
+bool BVH::occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const
+{
+    if (nodes.empty())
+        return false;
+    Vector3f invDir = rcp(dir);
+    // one pending sibling per level plus the two children just pushed
+    uint32_t stack[kMaxDepth + 1];
+    int size = 0;
+    stack[size++] = 0;
+    while (size > 0)
+    {
+        uint32_t current = stack[--size];
+        const BVHNode& node = nodes[current];
+        if (!hitBox(node, orig, invDir, tMax))
+            continue;
+        if (node.count > 0)
+        {
+            const BVHLeaf& leaf = leaves[node.offset];
+            float t[4], u[4], v[4];
+            if (leaf.spheres >= 0 && intersectSpheres(spheres[leaf.spheres], orig, dir, tMax, t))
+                return true;
+            if (leaf.triangles >= 0 && intersectTriangles(triangles[leaf.triangles], orig, dir, tMax, t, u, v))
+                return true;
+            for (uint32_t i = leaf.genericOffset; i < leaf.genericOffset + leaf.genericCount; ++i)
+            {
+                float tPrim = kInfinity;
+                Vector2f uv;
+                const BVHPrimitive& prim = primitives[i];
+                if (prim.object->intersectPrimitive(prim.index, orig, dir, tPrim, uv) && tPrim < tMax)
+                    return true;
+            }
+            continue;
+        }
+        stack[size++] = node.offset;
+        stack[size++] = current + 1;
+    }
+    return false;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <vector>
+#include "Object.hpp"
+
+struct hit_payload
+{
+    float tNear;
+    uint32_t index;
+    Vector2f uv;
+    Object* hit_obj;
+};
+
+// Flattened BVH over every primitive of the scene: spheres as a whole and
+// mesh triangles one by one. Nodes are stored depth first, so the first
+// child of an interior node directly follows it and offset holds the
+// second one; leaves hold count primitives and refer to leaves[offset].
+struct BVHNode
+{
+    Vector3f pMin, pMax;
+    uint32_t offset;
+    uint16_t count;
+    uint16_t axis;
+};
+
+struct BVHPrimitive
+{
+    Object* object;
+    uint32_t index;
+};
+
+// Up to four spheres or triangles of one leaf in structure-of-arrays form so
+// a single SIMD pass tests all of them. Lanes at or past count are unused.
+struct alignas(16) SpherePacket
+{
+    float cx[4], cy[4], cz[4], radius2[4];
+    Object* object[4];
+    uint32_t count = 0;
+};
+
+struct alignas(16) TrianglePacket
+{
+    float v0x[4], v0y[4], v0z[4];
+    float e1x[4], e1y[4], e1z[4];
+    float e2x[4], e2y[4], e2z[4];
+    Object* object[4];
+    uint32_t index[4];
+    uint32_t count = 0;
+};
+
+// Primitives of one leaf segregated by type; objects other than spheres and
+// meshes are kept in primitives and go through the virtual interface
+struct BVHLeaf
+{
+    int32_t spheres = -1, triangles = -1;
+    uint32_t genericOffset = 0, genericCount = 0;
+};
+
+class BVH
+{
+public:
+    explicit BVH(const std::vector<std::unique_ptr<Object>>& objects);
+
+    // Closest hit along the ray
+    std::optional<hit_payload> intersect(const Vector3f& orig, const Vector3f& dir) const;
+
+    // Whether anything is hit closer than tMax, stopping at the first hit
+    bool occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const;
+
+private:
+    uint32_t build(std::vector<BVHPrimitive>& prims, std::vector<Vector3f>& pMin,
+                   std::vector<Vector3f>& pMax, uint32_t begin, uint32_t end, int depth);
+
+    void buildLeaves(const std::vector<BVHPrimitive>& prims);
+
+    std::vector<BVHNode> nodes;
+    std::vector<BVHLeaf> leaves;
+    std::vector<SpherePacket> spheres;
+    std::vector<TrianglePacket> triangles;
+    std::vector<BVHPrimitive> primitives;
+};
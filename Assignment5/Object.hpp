@@ -19,6 +19,22 @@ public:
 
     virtual bool intersect(const Vector3f&, const Vector3f&, float&, uint32_t&, Vector2f&) const = 0;
 
+    // Objects made of several primitives expose them one by one so the scene
+    // BVH can cull them individually; index is reported back in hit_payload
+    virtual uint32_t getPrimitiveCount() const
+    {
+        return 1;
+    }
+
+    virtual void getPrimitiveBounds(uint32_t, Vector3f&, Vector3f&) const = 0;
+
+    virtual bool intersectPrimitive(uint32_t, const Vector3f& orig, const Vector3f& dir, float& tnear,
+                                    Vector2f& uv) const
+    {
+        uint32_t index;
+        return intersect(orig, dir, tnear, index, uv);
+    }
+
     virtual void getSurfaceProperties(const Vector3f&, const Vector3f&, const uint32_t&, const Vector2f&, Vector3f&,
                                       Vector2f&) const = 0;
 
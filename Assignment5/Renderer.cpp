@@ -3,6 +3,8 @@
 #include "Renderer.hpp"
 #include "Scene.hpp"
 #include <optional>
+#include <atomic>
+#include <thread>
 
 inline float deg2rad(const float &deg)
 { return deg * M_PI/180.0; }
@@ -68,43 +70,6 @@ float fresnel(const Vector3f &I, const Vector3f &N, const float &ior)
     // kt = 1 - kr;
 }
 
-// [comment]
-// Returns true if the ray intersects an object, false otherwise.
-//
-// \param orig is the ray origin
-// \param dir is the ray direction
-// \param objects is the list of objects the scene contains
-// \param[out] tNear contains the distance to the cloesest intersected object.
-// \param[out] index stores the index of the intersect triangle if the interesected object is a mesh.
-// \param[out] uv stores the u and v barycentric coordinates of the intersected point
-// \param[out] *hitObject stores the pointer to the intersected object (used to retrieve material information, etc.)
-// \param isShadowRay is it a shadow ray. We can return from the function sooner as soon as we have found a hit.
-// [/comment]
-std::optional<hit_payload> trace(
-        const Vector3f &orig, const Vector3f &dir,
-        const std::vector<std::unique_ptr<Object> > &objects)
-{
-    float tNear = kInfinity;
-    std::optional<hit_payload> payload;
-    for (const auto & object : objects)
-    {
-        float tNearK = kInfinity;
-        uint32_t indexK;
-        Vector2f uvK;
-        if (object->intersect(orig, dir, tNearK, indexK, uvK) && tNearK < tNear)
-        {
-            payload.emplace();
-            payload->hit_obj = object.get();
-            payload->tNear = tNearK;
-            payload->index = indexK;
-            payload->uv = uvK;
-            tNear = tNearK;
-        }
-    }
-
-    return payload;
-}
-
 // [comment]
 // Implementation of the Whitted-style light transport algorithm (E [S*] (D|G) L)
 //
@@ -120,17 +85,22 @@ std::optional<hit_payload> trace(
 //
 // If the surface is diffuse/glossy we use the Phong illumation model to compute the color
 // at the intersection point.
+//
+// \param weight is the factor this ray's color is scaled by before it reaches the pixel.
+// Branches whose weight drops below scene.minContribution are not traced. With
+// scene.stochasticBranching only one of the reflection/refraction rays is traced, picked
+// with probability kr, which keeps the ray tree a single path.
 // [/comment]
 Vector3f castRay(
         const Vector3f &orig, const Vector3f &dir, const Scene& scene,
-        int depth)
+        int depth, float weight = 1)
 {
     if (depth > scene.maxDepth) {
         return Vector3f(0.0,0.0,0.0);
     }
 
     Vector3f hitColor = scene.backgroundColor;
-    if (auto payload = trace(orig, dir, scene.get_objects()); payload)
+    if (auto payload = scene.intersect(orig, dir); payload)
     {
         Vector3f hitPoint = orig + dir * payload->tNear;
         Vector3f N; // normal
@@ -147,9 +117,19 @@ Vector3f castRay(
                 Vector3f refractionRayOrig = (dotProduct(refractionDirection, N) < 0) ?
                                              hitPoint - N * scene.epsilon :
                                              hitPoint + N * scene.epsilon;
-                Vector3f reflectionColor = castRay(reflectionRayOrig, reflectionDirection, scene, depth + 1);
-                Vector3f refractionColor = castRay(refractionRayOrig, refractionDirection, scene, depth + 1);
                 float kr = fresnel(dir, N, payload->hit_obj->ior);
+                if (scene.stochasticBranching) {
+                    // unbiased: the branch taken with probability p is weighted by k / p = 1
+                    hitColor = get_random_float() < kr ?
+                               castRay(reflectionRayOrig, reflectionDirection, scene, depth + 1, weight) :
+                               castRay(refractionRayOrig, refractionDirection, scene, depth + 1, weight);
+                    break;
+                }
+                Vector3f reflectionColor = 0, refractionColor = 0;
+                if (weight * kr >= scene.minContribution)
+                    reflectionColor = castRay(reflectionRayOrig, reflectionDirection, scene, depth + 1, weight * kr);
+                if (weight * (1 - kr) >= scene.minContribution)
+                    refractionColor = castRay(refractionRayOrig, refractionDirection, scene, depth + 1, weight * (1 - kr));
                 hitColor = reflectionColor * kr + refractionColor * (1 - kr);
                 break;
             }
@@ -160,7 +140,9 @@ Vector3f castRay(
                 Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0) ?
                                              hitPoint + N * scene.epsilon :
                                              hitPoint - N * scene.epsilon;
-                hitColor = castRay(reflectionRayOrig, reflectionDirection, scene, depth + 1) * kr;
+                hitColor = 0;
+                if (weight * kr >= scene.minContribution)
+                    hitColor = castRay(reflectionRayOrig, reflectionDirection, scene, depth + 1, weight * kr) * kr;
                 break;
             }
             default:
@@ -184,8 +166,7 @@ Vector3f castRay(
                     lightDir = normalize(lightDir);
                     float LdotN = std::max(0.f, dotProduct(lightDir, N));
                     // is the point in shadow, and is the nearest occluding object closer to the object than the light itself?
-                    auto shadow_res = trace(shadowPointOrig, lightDir, scene.get_objects());
-                    bool inShadow = shadow_res && (shadow_res->tNear * shadow_res->tNear < lightDistance2);
+                    bool inShadow = scene.occluded(shadowPointOrig, lightDir, std::sqrt(lightDistance2));
 
                     lightAmt += inShadow ? 0 : light->intensity * LdotN;
                     Vector3f reflectionDirection = reflect(-lightDir, N);
@@ -207,8 +188,12 @@ Vector3f castRay(
 // The main render function. This where we iterate over all pixels in the image, generate
 // primary rays and cast these rays into the scene. The content of the framebuffer is
 // saved to a file.
+//
+// Rows are handed out to scene.threads workers (all cores when 0) through a shared
+// counter. Every pixel is split into samplesPerAxis x samplesPerAxis strata with one
+// jittered ray each; a single sample goes through the pixel centre.
 // [/comment]
-void Renderer::Render(const Scene& scene)
+bool Renderer::Render(const Scene& scene)
 {
     std::vector<Vector3f> framebuffer(scene.width * scene.height);
 
@@ -217,49 +202,64 @@ void Renderer::Render(const Scene& scene)
 
     // Use this variable as the eye position to start your rays.
     Vector3f eye_pos(0);
-    int m = 0;
-    for (int j = 0; j < scene.height; ++j)
-    {
-        for (int i = 0; i < scene.width; ++i)
-        {
-            // generate primary ray direction
-            float x = 0;
-            float y = 0;
-            // Find the x and y positions of the current pixel to get the direction
-            // vector that passes through it.
-            // Also, don't forget to multiply both of them with the variable *scale*, and
-            // x (horizontal) variable with the *imageAspectRatio*
+    const int n = std::max(1, scene.samplesPerAxis);
 
-            // switch screen space to ndc
-            // 公式可以参考3d数学基础345页
-            // 中文注释导致行尾的换行符丢掉？？？ 还能这么搞？原因是windows需要识别crlf换行符，而原代码是lf换行符
-            float ndc_x = 2 * ((float)i + 0.5f) / (float)scene.width - 1;
-            float ndc_y = 1 - 2 * ((float)j + 0.5f) / (float)scene.height;
+    std::atomic<int> nextRow(0), rowsDone(0);
+    auto worker = [&](bool reportProgress) {
+        for (int j = nextRow++; j < scene.height; j = nextRow++)
+        {
+            for (int i = 0; i < scene.width; ++i)
+            {
+                Vector3f color = 0;
+                for (int sy = 0; sy < n; ++sy)
+                {
+                    for (int sx = 0; sx < n; ++sx)
+                    {
+                        float jx = n == 1 ? 0.5f : (sx + get_random_float()) / n;
+                        float jy = n == 1 ? 0.5f : (sy + get_random_float()) / n;
 
-            // ndc to world space
-            // 参考投影矩阵
-            // https://github.com/Quanwei1992/GAMES101/blob/master/05/Renderer.cpp
-            // x = ndc_x * r;
-            // y = ndc_y * t;
-            x = ndc_x * scale * imageAspectRatio;
-            y = ndc_y * scale;
+                        // switch screen space to ndc, then scale to the image plane at z = -1
+                        float ndc_x = 2 * ((float)i + jx) / (float)scene.width - 1;
+                        float ndc_y = 1 - 2 * ((float)j + jy) / (float)scene.height;
+                        float x = ndc_x * scale * imageAspectRatio;
+                        float y = ndc_y * scale;
 
-            Vector3f dir = Vector3f(x, y, -1); // Don't forget to normalize this direction!
-            Vector3f dir_normal = normalize(dir);
-            framebuffer[m++] = castRay(eye_pos, dir_normal, scene, 0);
+                        Vector3f dir = normalize(Vector3f(x, y, -1));
+                        color += castRay(eye_pos, dir, scene, 0);
+                    }
+                }
+                framebuffer[j * scene.width + i] = color / (float)(n * n);
+            }
+            int done = ++rowsDone;
+            if (reportProgress)
+                UpdateProgress(done / (float)scene.height);
         }
-        UpdateProgress(j / (float)scene.height);
-    }
+    };
 
-    // save framebuffer to file
-    FILE* fp = fopen("../../binary.ppm", "wb");
-    (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
-    for (auto i = 0; i < scene.height * scene.width; ++i) {
-        static unsigned char color[3];
-        color[0] = (char)(255 * clamp(0, 1, framebuffer[i].x));
-        color[1] = (char)(255 * clamp(0, 1, framebuffer[i].y));
-        color[2] = (char)(255 * clamp(0, 1, framebuffer[i].z));
-        fwrite(color, 1, 3, fp);
+    int threads = scene.threads > 0 ? scene.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; ++t)
+        workers.emplace_back(worker, false);
+    worker(true);
+    for (auto& w : workers)
+        w.join();
+    UpdateProgress(1.f);
+
+    // save framebuffer to file in a single write
+    char header[64];
+    int headerSize = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", scene.width, scene.height);
+    std::vector<unsigned char> image(headerSize + 3 * framebuffer.size());
+    std::copy(header, header + headerSize, image.begin());
+    unsigned char* pixel = image.data() + headerSize;
+    for (const auto& c : framebuffer) {
+        *pixel++ = (unsigned char)(255 * clamp(0, 1, c.x));
+        *pixel++ = (unsigned char)(255 * clamp(0, 1, c.y));
+        *pixel++ = (unsigned char)(255 * clamp(0, 1, c.z));
     }
-    fclose(fp);    
+    FILE* fp = fopen("../../binary.ppm", "wb");
+    if (!fp)
+        return false;
+    fwrite(image.data(), 1, image.size(), fp);
+    fclose(fp);
+    return true;
 }
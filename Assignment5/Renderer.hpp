@@ -1,18 +1,11 @@
 #pragma once
 #include "Scene.hpp"
 
-struct hit_payload
-{
-    float tNear;
-    uint32_t index;
-    Vector2f uv;
-    Object* hit_obj;
-};
-
 class Renderer
 {
 public:
-    void Render(const Scene& scene);
+    // false if the image cannot be written
+    bool Render(const Scene& scene);
 
 private:
 };
\ No newline at end of file
@@ -2,4 +2,22 @@
 // Created by Göksu Güvendiren on 2019-05-14.
 //
 
+#include <cassert>
 #include "Scene.hpp"
+
+void Scene::buildBVH()
+{
+    bvh = std::make_unique<BVH>(objects);
+}
+
+std::optional<hit_payload> Scene::intersect(const Vector3f& orig, const Vector3f& dir) const
+{
+    assert(bvh && "Scene::buildBVH() must run before tracing");
+    return bvh->intersect(orig, dir);
+}
+
+bool Scene::occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const
+{
+    assert(bvh && "Scene::buildBVH() must run before tracing");
+    return bvh->occluded(orig, dir, tMax);
+}
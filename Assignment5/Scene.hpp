@@ -5,6 +5,7 @@
 #include "Vector.hpp"
 #include "Object.hpp"
 #include "Light.hpp"
+#include "BVH.hpp"
 
 class Scene
 {
@@ -16,6 +17,15 @@ public:
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
     int maxDepth = 5;
     float epsilon = 0.00001;
+    // Reflection/refraction branches contributing less than this to the pixel are cut;
+    // below half of one 8-bit step they cannot change the output
+    float minContribution = 0.5f / 255;
+    // Trace a single Fresnel-weighted branch at refractive surfaces instead of both
+    bool stochasticBranching = false;
+    // Stratified supersampling: samplesPerAxis^2 jittered rays per pixel
+    int samplesPerAxis = 1;
+    // Render threads, 0 uses every hardware thread
+    int threads = 0;
 
     Scene(int w, int h) : width(w), height(h)
     {}
@@ -26,8 +36,14 @@ public:
     [[nodiscard]] const std::vector<std::unique_ptr<Object> >& get_objects() const { return objects; }
     [[nodiscard]] const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
 
+    // Build the acceleration structure once all objects have been added
+    void buildBVH();
+    [[nodiscard]] std::optional<hit_payload> intersect(const Vector3f& orig, const Vector3f& dir) const;
+    [[nodiscard]] bool occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const;
+
 private:
     // creating the scene (adding objects and lights)
     std::vector<std::unique_ptr<Object> > objects;
     std::vector<std::unique_ptr<Light> > lights;
+    std::unique_ptr<BVH> bvh;
 };
\ No newline at end of file
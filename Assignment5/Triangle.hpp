@@ -2,9 +2,10 @@
 
 #include "Object.hpp"
 
+#include <algorithm>
 #include <cstring>
 
-bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2, const Vector3f& orig,
+inline bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2, const Vector3f& orig,
                           const Vector3f& dir, float& tnear, float& u, float& v)
 {
     // Implement this function that tests whether the triangle
@@ -14,10 +15,14 @@ bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1, const Vector3f
     // 参考Lecture13课件第29页
     auto e1 = v1 - v0;
     auto e2 = v2 - v0;
-    auto s = orig - v0;
     auto s1 = crossProduct(dir, e2);
+    float det = dotProduct(s1, e1);
+    // ray parallel to the triangle plane or degenerate triangle
+    if (std::fabs(det) < kDeterminantEpsilon)
+        return false;
+    auto s = orig - v0;
     auto s2 = crossProduct(s, e1);
-    float inv = 1.0f / dotProduct(s1, e1);
+    float inv = 1.0f / det;
 
     tnear = dotProduct(s2, e2) * inv;
     u = dotProduct(s1, s) * inv;
@@ -68,6 +73,33 @@ public:
         return intersect;
     }
 
+    uint32_t getPrimitiveCount() const override
+    {
+        return numTriangles;
+    }
+
+    void getPrimitiveBounds(uint32_t index, Vector3f& pMin, Vector3f& pMax) const override
+    {
+        const Vector3f& v0 = vertices[vertexIndex[index * 3]];
+        const Vector3f& v1 = vertices[vertexIndex[index * 3 + 1]];
+        const Vector3f& v2 = vertices[vertexIndex[index * 3 + 2]];
+        pMin = Vector3f(std::min({v0.x, v1.x, v2.x}), std::min({v0.y, v1.y, v2.y}), std::min({v0.z, v1.z, v2.z}));
+        pMax = Vector3f(std::max({v0.x, v1.x, v2.x}), std::max({v0.y, v1.y, v2.y}), std::max({v0.z, v1.z, v2.z}));
+    }
+
+    bool intersectPrimitive(uint32_t index, const Vector3f& orig, const Vector3f& dir, float& tnear,
+                            Vector2f& uv) const override
+    {
+        float t, u, v;
+        if (!rayTriangleIntersect(vertices[vertexIndex[index * 3]], vertices[vertexIndex[index * 3 + 1]],
+                                  vertices[vertexIndex[index * 3 + 2]], orig, dir, t, u, v))
+            return false;
+        tnear = t;
+        uv.x = u;
+        uv.y = v;
+        return true;
+    }
+
     void getSurfaceProperties(const Vector3f&, const Vector3f&, const uint32_t& index, const Vector2f& uv, Vector3f& N,
                               Vector2f& st) const override
     {
@@ -7,6 +7,8 @@
 #define M_PI 3.14159265358979323846
 
 constexpr float kInfinity = std::numeric_limits<float>::max();
+// Ray/triangle determinants below this are treated as parallel
+constexpr float kDeterminantEpsilon = 1e-8f;
 
 inline float clamp(const float& lo, const float& hi, const float& v)
 {
@@ -40,9 +42,9 @@ enum MaterialType
 
 inline float get_random_float()
 {
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_real_distribution<float> dist(0.f, 1.f); // distribution in range [1, 6]
+    // seeded once per thread; reseeding from random_device on every call is very slow
+    thread_local std::mt19937 rng(std::random_device{}());
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
 
     return dist(rng);
 }
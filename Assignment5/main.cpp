@@ -3,14 +3,24 @@
 #include "Triangle.hpp"
 #include "Light.hpp"
 #include "Renderer.hpp"
+#include <cstdio>
+#include <iostream>
 
 // In the main function of the program, we create the scene (create objects and lights)
 // as well as set the options for the render (image width and height, maximum recursion
 // depth, field-of-view, etc.). We then call the render function().
-int main()
+int main(int argc, char** argv)
 {
     Scene scene(1280, 960);
 
+    // the only argument is the number of stratified samples per pixel axis
+    char rest;
+    if (argc > 2 ||
+        (argc == 2 && (sscanf(argv[1], "%d%c", &scene.samplesPerAxis, &rest) != 1 || scene.samplesPerAxis < 1))) {
+        std::cerr << "usage: " << argv[0] << " [samples per axis]\n";
+        return 1;
+    }
+
     auto sph1 = std::make_unique<Sphere>(Vector3f(-1, 0, -12), 2);
     sph1->materialType = DIFFUSE_AND_GLOSSY;
     sph1->diffuseColor = Vector3f(0.6, 0.7, 0.8);
@@ -31,9 +41,13 @@ int main()
     scene.Add(std::move(mesh));
     scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
     scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));    
+    scene.buildBVH();
 
     Renderer r;
-    r.Render(scene);
+    if (!r.Render(scene)) {
+        std::cerr << "cannot write ../../binary.ppm\n";
+        return 1;
+    }
 
     return 0;
 }
\ No newline at end of file
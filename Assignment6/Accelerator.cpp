@@ -0,0 +1,43 @@
+#include "Accelerator.hpp"
+#include "BVH.hpp"
+#include "KdTree.hpp"
+#include "Grid.hpp"
+
+std::unique_ptr<Accelerator> CreateAccelerator(AcceleratorType type, std::vector<Object*> p)
+{
+    switch (type) {
+    case AcceleratorType::KdTree:
+        return std::make_unique<KdTreeAccel>(std::move(p));
+    case AcceleratorType::Grid:
+        return std::make_unique<GridAccel>(std::move(p));
+    case AcceleratorType::BVH:
+    default:
+        return std::make_unique<BVHAccel>(std::move(p), 1, BVHAccel::SplitMethod::NAIVE);
+    }
+}
+
+bool ParseAcceleratorType(const std::string& name, AcceleratorType& type)
+{
+    if (name == "bvh")
+        type = AcceleratorType::BVH;
+    else if (name == "kdtree")
+        type = AcceleratorType::KdTree;
+    else if (name == "grid")
+        type = AcceleratorType::Grid;
+    else
+        return false;
+    return true;
+}
+
+const char* AcceleratorName(AcceleratorType type)
+{
+    switch (type) {
+    case AcceleratorType::KdTree:
+        return "kdtree";
+    case AcceleratorType::Grid:
+        return "grid";
+    case AcceleratorType::BVH:
+    default:
+        return "bvh";
+    }
+}
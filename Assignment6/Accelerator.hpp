@@ -0,0 +1,61 @@
+//
+// Common interface of the ray intersection acceleration structures.
+//
+
+#ifndef RAYTRACING_ACCELERATOR_H
+#define RAYTRACING_ACCELERATOR_H
+
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include "Object.hpp"
+#include "Ray.hpp"
+#include "Bounds3.hpp"
+#include "Intersection.hpp"
+
+class Accelerator {
+public:
+    virtual ~Accelerator() {}
+
+    // Replace the primitives and rebuild the structure over them
+    virtual void Build(std::vector<Object*> p) = 0;
+    virtual Bounds3 WorldBound() const = 0;
+
+    // Closest hit closer than ray.t_max
+    virtual Intersection Intersect(const Ray& ray) const = 0;
+    // Whether anything is hit closer than ray.t_max; stops at the first hit
+    virtual bool IntersectP(const Ray& ray) const = 0;
+};
+
+// Parametric range [tMin, tMax] of the ray inside the box
+inline bool rayBoxRange(const Bounds3& b, const Ray& ray, float& tMin, float& tMax)
+{
+    float t0 = ray.t_min, t1 = std::min<double>(ray.t_max, kInfinity);
+    for (int axis = 0; axis < 3; ++axis) {
+        float invDir = ray.direction_inv[axis];
+        float o = ray.origin[axis];
+        float tNear = (b.pMin[axis] - o) * invDir;
+        float tFar = (b.pMax[axis] - o) * invDir;
+        if (tNear > tFar)
+            std::swap(tNear, tFar);
+        // NaN (zero direction on the box face) leaves the range untouched
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar < t1 ? tFar : t1;
+        if (t0 > t1)
+            return false;
+    }
+    tMin = t0;
+    tMax = t1;
+    return true;
+}
+
+enum class AcceleratorType { BVH, KdTree, Grid };
+
+std::unique_ptr<Accelerator> CreateAccelerator(AcceleratorType type, std::vector<Object*> p);
+
+// "bvh", "kdtree" or "grid"; returns false for anything else
+bool ParseAcceleratorType(const std::string& name, AcceleratorType& type);
+const char* AcceleratorName(AcceleratorType type);
+
+#endif //RAYTRACING_ACCELERATOR_H
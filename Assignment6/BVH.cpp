@@ -4,9 +4,33 @@
 
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
                    SplitMethod splitMethod)
-    : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
-      primitives(std::move(p))
+    : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod)
 {
+    Build(std::move(p));
+}
+
+static void deleteNodes(BVHBuildNode* node)
+{
+    if (!node)
+        return;
+    deleteNodes(node->left);
+    deleteNodes(node->right);
+    delete node;
+}
+
+BVHAccel::~BVHAccel() { deleteNodes(root); }
+
+Bounds3 BVHAccel::WorldBound() const
+{
+    return root ? root->bounds : Bounds3();
+}
+
+void BVHAccel::Build(std::vector<Object*> p)
+{
+    deleteNodes(root);
+    root = nullptr;
+    primitives = std::move(p);
+
     time_t start, stop;
     time(&start);
     if (primitives.empty())
@@ -105,15 +129,17 @@ Intersection BVHAccel::Intersect(const Ray& ray) const
 Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
 {
     // Traverse the BVH to find intersection
-    std::array<int, 3> dirIsPos = {ray.direction.x > 0, ray.direction.y > 0, ray.direction.z > 0};
+    std::array<int, 3> dirIsPos = {ray.direction_inv.x > 0, ray.direction_inv.y > 0, ray.direction_inv.z > 0};
 
     // miss box
     if (!node->bounds.IntersectP(ray, ray.direction_inv, dirIsPos))
         return {};
 
     // leaf node
-    if (node->left == nullptr && node->right == nullptr)
-        return node->object->getIntersection(ray);
+    if (node->left == nullptr && node->right == nullptr) {
+        Intersection isect = node->object->getIntersection(ray);
+        return isect.distance < ray.t_max ? isect : Intersection();
+    }
 
     // tree recursive
     Intersection left = getIntersection(node->left, ray);
@@ -126,4 +152,24 @@ Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
         return right;
 
     return {};
-}
\ No newline at end of file
+}
+
+bool BVHAccel::IntersectP(const Ray& ray) const
+{
+    return root && getIntersectionP(root, ray);
+}
+
+bool BVHAccel::getIntersectionP(BVHBuildNode* node, const Ray& ray) const
+{
+    std::array<int, 3> dirIsPos = {ray.direction_inv.x > 0, ray.direction_inv.y > 0, ray.direction_inv.z > 0};
+
+    if (!node->bounds.IntersectP(ray, ray.direction_inv, dirIsPos))
+        return false;
+
+    if (node->left == nullptr && node->right == nullptr) {
+        Intersection isect = node->object->getIntersection(ray);
+        return isect.happened && isect.distance < ray.t_max;
+    }
+
+    return getIntersectionP(node->left, ray) || getIntersectionP(node->right, ray);
+}
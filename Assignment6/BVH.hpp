@@ -14,6 +14,7 @@
 #include "Bounds3.hpp"
 #include "Intersection.hpp"
 #include "Vector.hpp"
+#include "Accelerator.hpp"
 
 struct BVHBuildNode;
 // BVHAccel Forward Declarations
@@ -21,7 +22,7 @@ struct BVHPrimitiveInfo;
 
 // BVHAccel Declarations
 inline int leafNodes, totalLeafNodes, totalPrimitives, interiorNodes;
-class BVHAccel {
+class BVHAccel : public Accelerator {
 
 public:
     // BVHAccel Public Types
@@ -29,13 +30,15 @@ public:
 
     // BVHAccel Public Methods
     BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE);
-    Bounds3 WorldBound() const;
+    void Build(std::vector<Object*> p) override;
+    Bounds3 WorldBound() const override;
     ~BVHAccel();
 
-    Intersection Intersect(const Ray &ray) const;
+    Intersection Intersect(const Ray &ray) const override;
     Intersection getIntersection(BVHBuildNode* node, const Ray& ray)const;
-    bool IntersectP(const Ray &ray) const;
-    BVHBuildNode* root;
+    bool IntersectP(const Ray &ray) const override;
+    bool getIntersectionP(BVHBuildNode* node, const Ray& ray) const;
+    BVHBuildNode* root = nullptr;
 
     // BVHAccel Private Methods
     BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "Grid.hpp"
+
+GridAccel::GridAccel(std::vector<Object*> p, float voxelsPerPrim, int maxVoxelsPerAxis)
+    : voxelsPerPrim(voxelsPerPrim), maxVoxelsPerAxis(maxVoxelsPerAxis)
+{
+    Build(std::move(p));
+}
+
+int GridAccel::posToVoxel(float p, int axis) const
+{
+    int v = (int)((p - bounds.pMin[axis]) * invWidth[axis]);
+    return std::clamp(v, 0, nVoxels[axis] - 1);
+}
+
+float GridAccel::voxelToPos(int v, int axis) const
+{
+    return bounds.pMin[axis] + v * width[axis];
+}
+
+void GridAccel::Build(std::vector<Object*> p)
+{
+    primitives = std::move(p);
+    bounds = Bounds3();
+    voxelStart.clear();
+    voxelPrims.clear();
+    nVoxels[0] = nVoxels[1] = nVoxels[2] = 0;
+    if (primitives.empty())
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<Bounds3> primBounds;
+    primBounds.reserve(primitives.size());
+    for (Object* prim : primitives) {
+        Bounds3 b = prim->getBounds();
+        bounds = Union(bounds, b);
+        primBounds.push_back(b);
+    }
+
+    // Pad the bounds so flat scenes still get voxels of non-zero width
+    Vector3f delta = bounds.Diagonal();
+    float pad = 1e-4f * std::max({delta.x, delta.y, delta.z, 1e-3f});
+    bounds.pMin = bounds.pMin - Vector3f(pad);
+    bounds.pMax = bounds.pMax + Vector3f(pad);
+    delta = bounds.Diagonal();
+
+    // Roughly cubical voxels, sized so the grid has voxelsPerPrim voxels
+    // per primitive
+    int maxAxis = bounds.maxExtent();
+    float maxWidth = delta[maxAxis];
+    float voxelsPerUnitDist = std::cbrt(voxelsPerPrim * primitives.size()) / maxWidth;
+    for (int axis = 0; axis < 3; ++axis) {
+        int n = (int)std::round(delta[axis] * voxelsPerUnitDist);
+        nVoxels[axis] = std::clamp(n, 1, maxVoxelsPerAxis);
+        width[axis] = delta[axis] / nVoxels[axis];
+        invWidth[axis] = 1 / width[axis];
+    }
+
+    // Two passes: count the primitives per voxel, then fill the
+    // prefix-summed lists
+    int totalVoxels = nVoxels[0] * nVoxels[1] * nVoxels[2];
+    voxelStart.assign(totalVoxels + 1, 0);
+    for (int pass = 0; pass < 2; ++pass) {
+        std::vector<uint32_t> cursor;
+        if (pass == 1) {
+            for (int i = 0; i < totalVoxels; ++i)
+                voxelStart[i + 1] += voxelStart[i];
+            voxelPrims.resize(voxelStart[totalVoxels]);
+            cursor.assign(voxelStart.begin(), voxelStart.end() - 1);
+        }
+        for (uint32_t i = 0; i < primitives.size(); ++i) {
+            const Bounds3& b = primBounds[i];
+            int vMin[3], vMax[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                vMin[axis] = posToVoxel(b.pMin[axis], axis);
+                vMax[axis] = posToVoxel(b.pMax[axis], axis);
+            }
+            for (int z = vMin[2]; z <= vMax[2]; ++z)
+                for (int y = vMin[1]; y <= vMax[1]; ++y)
+                    for (int x = vMin[0]; x <= vMax[0]; ++x) {
+                        int o = offset(x, y, z);
+                        if (pass == 0)
+                            voxelStart[o + 1]++;
+                        else
+                            voxelPrims[cursor[o]++] = i;
+                    }
+        }
+    }
+
+    auto stop = std::chrono::steady_clock::now();
+    printf("Grid generation complete: %i x %i x %i voxels, %zu references, %lld ms\n\n",
+           nVoxels[0], nVoxels[1], nVoxels[2], voxelPrims.size(),
+           (long long)std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count());
+}
+
+// Walk the voxels pierced by the ray in front-to-back order. voxel is
+// called with each non-empty voxel's primitive list and the distance at
+// which the ray leaves that voxel, and returns true to stop.
+template <typename VoxelFunc>
+void GridAccel::traverse(const Ray& ray, VoxelFunc voxel) const
+{
+    float tMin, tMax;
+    if (voxelStart.empty() || !rayBoxRange(bounds, ray, tMin, tMax))
+        return;
+
+    Vector3f gridIntersect = ray(tMin);
+    float nextCrossingT[3], deltaT[3];
+    int step[3], out[3], pos[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        float o = gridIntersect[axis];
+        float dir = ray.direction[axis];
+        pos[axis] = posToVoxel(o, axis);
+        if (dir == 0) {
+            nextCrossingT[axis] = kInfinity;
+            deltaT[axis] = kInfinity;
+            step[axis] = 0;
+            out[axis] = -1;
+        }
+        else if (dir > 0) {
+            nextCrossingT[axis] = tMin + (voxelToPos(pos[axis] + 1, axis) - o) / dir;
+            deltaT[axis] = width[axis] / dir;
+            step[axis] = 1;
+            out[axis] = nVoxels[axis];
+        }
+        else {
+            nextCrossingT[axis] = tMin + (voxelToPos(pos[axis], axis) - o) / dir;
+            deltaT[axis] = -width[axis] / dir;
+            step[axis] = -1;
+            out[axis] = -1;
+        }
+    }
+
+    while (true) {
+        int stepAxis = nextCrossingT[0] < nextCrossingT[1]
+                           ? (nextCrossingT[0] < nextCrossingT[2] ? 0 : 2)
+                           : (nextCrossingT[1] < nextCrossingT[2] ? 1 : 2);
+        float tExit = std::min(nextCrossingT[stepAxis], tMax);
+
+        int o = offset(pos[0], pos[1], pos[2]);
+        uint32_t begin = voxelStart[o], end = voxelStart[o + 1];
+        if (begin != end && voxel(&voxelPrims[begin], &voxelPrims[end], tExit))
+            return;
+
+        if (tMax < nextCrossingT[stepAxis])
+            return;
+        pos[stepAxis] += step[stepAxis];
+        if (pos[stepAxis] == out[stepAxis])
+            return;
+        nextCrossingT[stepAxis] += deltaT[stepAxis];
+    }
+}
+
+Intersection GridAccel::Intersect(const Ray& ray) const
+{
+    Intersection isect;
+    traverse(ray, [&](const uint32_t* begin, const uint32_t* end, float tExit) {
+        for (const uint32_t* i = begin; i != end; ++i) {
+            Intersection hit = primitives[*i]->getIntersection(ray);
+            if (hit.happened && hit.distance < isect.distance && hit.distance < ray.t_max)
+                isect = hit;
+        }
+        // A hit beyond this voxel may still be beaten by one in a later voxel
+        return isect.happened && isect.distance <= tExit;
+    });
+    return isect;
+}
+
+bool GridAccel::IntersectP(const Ray& ray) const
+{
+    bool hit = false;
+    traverse(ray, [&](const uint32_t* begin, const uint32_t* end, float) {
+        for (const uint32_t* i = begin; i != end && !hit; ++i) {
+            Intersection isect = primitives[*i]->getIntersection(ray);
+            hit = isect.happened && isect.distance < ray.t_max;
+        }
+        return hit;
+    });
+    return hit;
+}
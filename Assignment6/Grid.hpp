@@ -0,0 +1,41 @@
+//
+// Uniform grid over scene objects, traversed with a 3D DDA.
+//
+
+#ifndef RAYTRACING_GRID_H
+#define RAYTRACING_GRID_H
+
+#include <vector>
+#include "Accelerator.hpp"
+
+class GridAccel : public Accelerator {
+public:
+    // The grid has about voxelsPerPrim voxels per primitive, at most
+    // maxVoxelsPerAxis along any axis
+    GridAccel(std::vector<Object*> p, float voxelsPerPrim = 27, int maxVoxelsPerAxis = 128);
+
+    void Build(std::vector<Object*> p) override;
+    Bounds3 WorldBound() const override { return bounds; }
+
+    Intersection Intersect(const Ray& ray) const override;
+    bool IntersectP(const Ray& ray) const override;
+
+private:
+    int posToVoxel(float p, int axis) const;
+    float voxelToPos(int v, int axis) const;
+    int offset(int x, int y, int z) const { return (z * nVoxels[1] + y) * nVoxels[0] + x; }
+    template <typename VoxelFunc>
+    void traverse(const Ray& ray, VoxelFunc voxel) const;
+
+    const float voxelsPerPrim;
+    const int maxVoxelsPerAxis;
+    std::vector<Object*> primitives;
+    Bounds3 bounds;
+    int nVoxels[3] = {0, 0, 0};
+    float width[3], invWidth[3];
+    // Primitives overlapping voxel i are voxelPrims[voxelStart[i]..voxelStart[i + 1])
+    std::vector<uint32_t> voxelStart;
+    std::vector<uint32_t> voxelPrims;
+};
+
+#endif //RAYTRACING_GRID_H
@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "KdTree.hpp"
+
+enum class EdgeType { Start, End };
+
+struct BoundEdge {
+    BoundEdge() {}
+    BoundEdge(float t, int primNum, bool starting) : t(t), primNum(primNum)
+    {
+        type = starting ? EdgeType::Start : EdgeType::End;
+    }
+    float t;
+    int primNum;
+    EdgeType type;
+};
+
+void KdAccelNode::InitLeaf(const int* primNums, int np, std::vector<int>& primitiveIndices)
+{
+    flags = 3;
+    nPrims |= (np << 2);
+    if (np == 0)
+        onePrimitive = 0;
+    else if (np == 1)
+        onePrimitive = primNums[0];
+    else {
+        primitiveIndicesOffset = primitiveIndices.size();
+        primitiveIndices.insert(primitiveIndices.end(), primNums, primNums + np);
+    }
+}
+
+void KdAccelNode::InitInterior(int axis, int ac, float s)
+{
+    split = s;
+    flags = axis;
+    aboveChild |= (ac << 2);
+}
+
+KdTreeAccel::KdTreeAccel(std::vector<Object*> p, int isectCost, int traversalCost,
+                         float emptyBonus, int maxPrims, int maxDepth)
+    : isectCost(isectCost), traversalCost(traversalCost), maxPrims(maxPrims),
+      userMaxDepth(maxDepth), emptyBonus(emptyBonus)
+{
+    Build(std::move(p));
+}
+
+void KdTreeAccel::Build(std::vector<Object*> p)
+{
+    primitives = std::move(p);
+    primitiveIndices.clear();
+    nodes.clear();
+    bounds = Bounds3();
+    if (primitives.empty())
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    int nPrims = primitives.size();
+    int maxDepth = userMaxDepth > 0 ? userMaxDepth
+                                    : (int)std::round(8 + 1.3f * std::log2((float)nPrims));
+    maxDepth = std::min(maxDepth, kMaxTodo - 1);
+
+    std::vector<Bounds3> primBounds;
+    primBounds.reserve(nPrims);
+    for (Object* prim : primitives) {
+        Bounds3 b = prim->getBounds();
+        bounds = Union(bounds, b);
+        primBounds.push_back(b);
+    }
+
+    std::unique_ptr<BoundEdge[]> edges[3];
+    for (int i = 0; i < 3; ++i)
+        edges[i].reset(new BoundEdge[2 * nPrims]);
+    std::unique_ptr<int[]> prims0(new int[nPrims]);
+    std::unique_ptr<int[]> prims1(new int[(maxDepth + 1) * nPrims]);
+
+    // Every primitive overlaps the root
+    std::unique_ptr<int[]> primNums(new int[nPrims]);
+    for (int i = 0; i < nPrims; ++i)
+        primNums[i] = i;
+
+    buildTree(0, bounds, primBounds, primNums.get(), nPrims, maxDepth, edges,
+              prims0.get(), prims1.get());
+
+    auto stop = std::chrono::steady_clock::now();
+    printf("kd-tree generation complete: %zu nodes, %i prims, %lld ms\n\n",
+           nodes.size(), nPrims,
+           (long long)std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count());
+}
+
+void KdTreeAccel::buildTree(int nodeNum, const Bounds3& nodeBounds,
+                            const std::vector<Bounds3>& allPrimBounds,
+                            int* primNums, int nPrimitives, int depth,
+                            const std::unique_ptr<BoundEdge[]> edges[3],
+                            int* prims0, int* prims1, int badRefines)
+{
+    nodes.emplace_back();
+
+    if (nPrimitives <= maxPrims || depth == 0) {
+        nodes[nodeNum].InitLeaf(primNums, nPrimitives, primitiveIndices);
+        return;
+    }
+
+    // Choose the split with the lowest SAH cost, trying the longest axis
+    // first and the others only if it has no usable split
+    int bestAxis = -1, bestOffset = -1;
+    float bestCost = kInfinity;
+    float oldCost = isectCost * float(nPrimitives);
+    float totalSA = nodeBounds.SurfaceArea();
+    float invTotalSA = 1 / totalSA;
+    Vector3f d = nodeBounds.Diagonal();
+
+    int axis = nodeBounds.maxExtent();
+    for (int retries = 0; retries < 3 && bestAxis == -1; ++retries, axis = (axis + 1) % 3) {
+        for (int i = 0; i < nPrimitives; ++i) {
+            int pn = primNums[i];
+            const Bounds3& b = allPrimBounds[pn];
+            edges[axis][2 * i] = BoundEdge(b.pMin[axis], pn, true);
+            edges[axis][2 * i + 1] = BoundEdge(b.pMax[axis], pn, false);
+        }
+        std::sort(&edges[axis][0], &edges[axis][2 * nPrimitives],
+                  [](const BoundEdge& e0, const BoundEdge& e1) {
+                      if (e0.t == e1.t)
+                          return (int)e0.type < (int)e1.type;
+                      return e0.t < e1.t;
+                  });
+
+        int nBelow = 0, nAbove = nPrimitives;
+        float lo = nodeBounds.pMin[axis], hi = nodeBounds.pMax[axis];
+        int otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
+        float d0 = d[otherAxis0], d1 = d[otherAxis1];
+        for (int i = 0; i < 2 * nPrimitives; ++i) {
+            if (edges[axis][i].type == EdgeType::End)
+                --nAbove;
+            float edgeT = edges[axis][i].t;
+            if (edgeT > lo && edgeT < hi) {
+                float belowSA = 2 * (d0 * d1 + (edgeT - lo) * (d0 + d1));
+                float aboveSA = 2 * (d0 * d1 + (hi - edgeT) * (d0 + d1));
+                float pBelow = belowSA * invTotalSA;
+                float pAbove = aboveSA * invTotalSA;
+                float eb = (nAbove == 0 || nBelow == 0) ? emptyBonus : 0;
+                float cost = traversalCost +
+                             isectCost * (1 - eb) * (pBelow * nBelow + pAbove * nAbove);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestOffset = i;
+                }
+            }
+            if (edges[axis][i].type == EdgeType::Start)
+                ++nBelow;
+        }
+    }
+
+    if (bestCost > oldCost)
+        ++badRefines;
+    if ((bestCost > 4 * oldCost && nPrimitives < 16) || bestAxis == -1 || badRefines == 3) {
+        nodes[nodeNum].InitLeaf(primNums, nPrimitives, primitiveIndices);
+        return;
+    }
+
+    // Primitives straddling the plane go to both sides
+    int n0 = 0, n1 = 0;
+    for (int i = 0; i < bestOffset; ++i)
+        if (edges[bestAxis][i].type == EdgeType::Start)
+            prims0[n0++] = edges[bestAxis][i].primNum;
+    for (int i = bestOffset + 1; i < 2 * nPrimitives; ++i)
+        if (edges[bestAxis][i].type == EdgeType::End)
+            prims1[n1++] = edges[bestAxis][i].primNum;
+
+    float tSplit = edges[bestAxis][bestOffset].t;
+    Bounds3 bounds0 = nodeBounds, bounds1 = nodeBounds;
+    bounds0.pMax[bestAxis] = tSplit;
+    bounds1.pMin[bestAxis] = tSplit;
+
+    // prims0 is consumed before the below child recurses, so it can be
+    // reused; prims1 must survive until the above child is built
+    buildTree(nodeNum + 1, bounds0, allPrimBounds, prims0, n0, depth - 1, edges,
+              prims0, prims1 + nPrimitives, badRefines);
+    int aboveChild = nodes.size();
+    nodes[nodeNum].InitInterior(bestAxis, aboveChild, tSplit);
+    buildTree(aboveChild, bounds1, allPrimBounds, prims1, n1, depth - 1, edges,
+              prims0, prims1 + nPrimitives, badRefines);
+}
+
+// Front-to-back traversal with a fixed-size stack of deferred far children.
+// leaf is called for every leaf the ray reaches and returns true to stop;
+// traversal also stops once tClosest lies before the next node.
+template <typename LeafFunc>
+void KdTreeAccel::traverse(const Ray& ray, const float& tClosest, LeafFunc leaf) const
+{
+    float tMin, tMax;
+    if (nodes.empty() || !rayBoxRange(bounds, ray, tMin, tMax))
+        return;
+
+    struct KdToDo {
+        const KdAccelNode* node;
+        float tMin, tMax;
+    };
+    KdToDo todo[kMaxTodo];
+    int todoPos = 0;
+
+    const KdAccelNode* node = &nodes[0];
+    while (node != nullptr) {
+        if (tClosest < tMin)
+            break;
+        if (!node->IsLeaf()) {
+            int axis = node->SplitAxis();
+            float o = ray.origin[axis];
+            float tPlane = (node->SplitPos() - o) * ray.direction_inv[axis];
+
+            const KdAccelNode *firstChild, *secondChild;
+            bool belowFirst = (o < node->SplitPos()) ||
+                              (o == node->SplitPos() && ray.direction[axis] <= 0);
+            if (belowFirst) {
+                firstChild = node + 1;
+                secondChild = &nodes[node->AboveChild()];
+            }
+            else {
+                firstChild = &nodes[node->AboveChild()];
+                secondChild = node + 1;
+            }
+
+            if (tPlane > tMax || tPlane <= 0)
+                node = firstChild;
+            else if (tPlane < tMin)
+                node = secondChild;
+            else {
+                todo[todoPos].node = secondChild;
+                todo[todoPos].tMin = tPlane;
+                todo[todoPos].tMax = tMax;
+                ++todoPos;
+                node = firstChild;
+                tMax = tPlane;
+            }
+        }
+        else {
+            if (leaf(*node))
+                return;
+            if (todoPos == 0)
+                break;
+            --todoPos;
+            node = todo[todoPos].node;
+            tMin = todo[todoPos].tMin;
+            tMax = todo[todoPos].tMax;
+        }
+    }
+}
+
+Intersection KdTreeAccel::Intersect(const Ray& ray) const
+{
+    Intersection isect;
+    float tClosest = kInfinity;
+    auto test = [&](Object* prim) {
+        Intersection hit = prim->getIntersection(ray);
+        if (hit.happened && hit.distance < isect.distance && hit.distance < ray.t_max) {
+            isect = hit;
+            tClosest = hit.distance;
+        }
+    };
+    traverse(ray, tClosest, [&](const KdAccelNode& node) {
+        int n = node.nPrimitives();
+        if (n == 1)
+            test(primitives[node.onePrimitive]);
+        else
+            for (int i = 0; i < n; ++i)
+                test(primitives[primitiveIndices[node.primitiveIndicesOffset + i]]);
+        return false;
+    });
+    return isect;
+}
+
+bool KdTreeAccel::IntersectP(const Ray& ray) const
+{
+    bool hit = false;
+    auto test = [&](Object* prim) {
+        Intersection isect = prim->getIntersection(ray);
+        return isect.happened && isect.distance < ray.t_max;
+    };
+    const float tClosest = kInfinity;
+    traverse(ray, tClosest, [&](const KdAccelNode& node) {
+        int n = node.nPrimitives();
+        if (n == 1)
+            hit = test(primitives[node.onePrimitive]);
+        else
+            for (int i = 0; i < n && !hit; ++i)
+                hit = test(primitives[primitiveIndices[node.primitiveIndicesOffset + i]]);
+        return hit;
+    });
+    return hit;
+}
@@ -0,0 +1,73 @@
+//
+// SAH kd-tree over scene objects.
+//
+
+#ifndef RAYTRACING_KDTREE_H
+#define RAYTRACING_KDTREE_H
+
+#include <vector>
+#include <memory>
+#include "Accelerator.hpp"
+
+// Eight byte node: interior nodes keep their below child right after
+// themselves and store the split position, the split axis (low two bits of
+// flags) and the index of the above child. Leaves have flags == 3 and store
+// their primitive count in the upper bits, plus either the single primitive
+// or an offset into primitiveIndices.
+struct KdAccelNode {
+    void InitLeaf(const int* primNums, int np, std::vector<int>& primitiveIndices);
+    void InitInterior(int axis, int ac, float s);
+
+    float SplitPos() const { return split; }
+    int nPrimitives() const { return nPrims >> 2; }
+    int SplitAxis() const { return flags & 3; }
+    bool IsLeaf() const { return (flags & 3) == 3; }
+    int AboveChild() const { return aboveChild >> 2; }
+
+    union {
+        float split;
+        int onePrimitive;
+        int primitiveIndicesOffset;
+    };
+    union {
+        int flags;
+        int nPrims;
+        int aboveChild;
+    };
+};
+
+struct BoundEdge;
+
+class KdTreeAccel : public Accelerator {
+public:
+    // maxDepth <= 0 picks 8 + 1.3 log2(N)
+    KdTreeAccel(std::vector<Object*> p, int isectCost = 80, int traversalCost = 1,
+                float emptyBonus = 0.5f, int maxPrims = 1, int maxDepth = -1);
+
+    void Build(std::vector<Object*> p) override;
+    Bounds3 WorldBound() const override { return bounds; }
+
+    Intersection Intersect(const Ray& ray) const override;
+    bool IntersectP(const Ray& ray) const override;
+
+private:
+    // Depth of the traversal stack; the tree is never built deeper
+    static constexpr int kMaxTodo = 64;
+
+    void buildTree(int nodeNum, const Bounds3& nodeBounds,
+                   const std::vector<Bounds3>& allPrimBounds, int* primNums,
+                   int nPrimitives, int depth,
+                   const std::unique_ptr<BoundEdge[]> edges[3], int* prims0,
+                   int* prims1, int badRefines = 0);
+    template <typename LeafFunc>
+    void traverse(const Ray& ray, const float& tClosest, LeafFunc leaf) const;
+
+    const int isectCost, traversalCost, maxPrims, userMaxDepth;
+    const float emptyBonus;
+    std::vector<Object*> primitives;
+    std::vector<int> primitiveIndices;
+    std::vector<KdAccelNode> nodes;
+    Bounds3 bounds;
+};
+
+#endif //RAYTRACING_KDTREE_H
@@ -5,14 +5,14 @@
 #include "Scene.hpp"
 
 
-void Scene::buildBVH() {
-    printf(" - Generating BVH...\n\n");
-    this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::NAIVE);
+void Scene::buildAccelerator() {
+    printf(" - Generating %s...\n\n", AcceleratorName(acceleratorType));
+    this->accel = CreateAccelerator(acceleratorType, objects);
 }
 
 Intersection Scene::intersect(const Ray &ray) const
 {
-    return this->bvh->Intersect(ray);
+    return this->accel->Intersect(ray);
 }
 
 bool Scene::trace(
@@ -129,7 +129,7 @@ Vector3f Scene::castRay(const Ray &ray, int depth) const
                         Object *shadowHitObject = nullptr;
                         float tNearShadow = kInfinity;
                         // is the point in shadow, and is the nearest occluding object closer to the object than the light itself?
-                        bool inShadow = bvh->Intersect(Ray(shadowPointOrig, lightDir)).happened;
+                        bool inShadow = accel->IntersectP(Ray(shadowPointOrig, lightDir));
                         lightAmt += (1 - inShadow) * get_lights()[i]->intensity * LdotN;
                         Vector3f reflectionDirection = reflect(-lightDir, N);
                         specularColor += powf(std::max(0.f, -dotProduct(reflectionDirection, ray.direction)),
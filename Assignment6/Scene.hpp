@@ -9,7 +9,7 @@
 #include "Object.hpp"
 #include "Light.hpp"
 #include "AreaLight.hpp"
-#include "BVH.hpp"
+#include "Accelerator.hpp"
 #include "Ray.hpp"
 
 
@@ -22,6 +22,7 @@ public:
     double fov = 90;
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
     int maxDepth = 5;
+    AcceleratorType acceleratorType = AcceleratorType::BVH;
 
     Scene(int w, int h) : width(w), height(h)
     {}
@@ -32,8 +33,8 @@ public:
     const std::vector<Object*>& get_objects() const { return objects; }
     const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
     Intersection intersect(const Ray& ray) const;
-    BVHAccel *bvh;
-    void buildBVH();
+    std::unique_ptr<Accelerator> accel;
+    void buildAccelerator();
     Vector3f castRay(const Ray &ray, int depth) const;
     bool trace(const Ray &ray, const std::vector<Object*> &objects, float &tNear, uint32_t &index, Object **hitObject);
     std::tuple<Vector3f, Vector3f> HandleAreaLight(const AreaLight &light, const Vector3f &hitPoint, const Vector3f &N,
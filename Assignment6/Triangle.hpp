@@ -1,6 +1,6 @@
 #pragma once
 
-#include "BVH.hpp"
+#include "Accelerator.hpp"
 #include "Intersection.hpp"
 #include "Material.hpp"
 #include "OBJ_Loader.hpp"
@@ -75,7 +75,8 @@ public:
 class MeshTriangle : public Object
 {
 public:
-    MeshTriangle(const std::string& filename)
+    MeshTriangle(const std::string& filename,
+                 AcceleratorType accelType = AcceleratorType::BVH)
     {
         objl::Loader loader;
         loader.LoadFile(filename);
@@ -119,11 +120,17 @@ public:
 
         bounding_box = Bounds3(min_vert, max_vert);
 
+        buildAccelerator(accelType);
+    }
+
+    // (Re)build the structure over this mesh's triangles
+    void buildAccelerator(AcceleratorType type)
+    {
         std::vector<Object*> ptrs;
         for (auto& tri : triangles)
             ptrs.push_back(&tri);
 
-        bvh = new BVHAccel(ptrs);
+        accel = CreateAccelerator(type, ptrs);
     }
 
     bool intersect(const Ray& ray) { return true; }
@@ -179,8 +186,8 @@ public:
     {
         Intersection intersec;
 
-        if (bvh) {
-            intersec = bvh->Intersect(ray);
+        if (accel) {
+            intersec = accel->Intersect(ray);
         }
 
         return intersec;
@@ -194,7 +201,7 @@ public:
 
     std::vector<Triangle> triangles;
 
-    BVHAccel* bvh;
+    std::unique_ptr<Accelerator> accel;
 
     Material* m;
 };
@@ -9,16 +9,54 @@
 // lights) as well as set the options for the render (image width and height,
 // maximum recursion depth, field-of-view, etc.). We then call the render
 // function().
+//
+// The acceleration structure is picked on the command line: "bvh" (default),
+// "kdtree" or "grid". "bench" builds and renders with each of them in turn
+// and prints the timings, so the fastest one can be chosen per scene.
 int main(int argc, char** argv)
 {
+    std::vector<AcceleratorType> types = {AcceleratorType::BVH};
+    if (argc > 1) {
+        std::string arg = argv[1];
+        if (arg == "bench")
+            types = {AcceleratorType::BVH, AcceleratorType::KdTree, AcceleratorType::Grid};
+        else if (!ParseAcceleratorType(arg, types[0])) {
+            std::cerr << "usage: " << argv[0] << " [bvh|kdtree|grid|bench]\n";
+            return 1;
+        }
+    }
+
     Scene scene(1280, 960);
 
-    MeshTriangle bunny("../../models/bunny/bunny.obj");
+    MeshTriangle bunny("../../models/bunny/bunny.obj", types[0]);
 
     scene.Add(&bunny);
     scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 1));
     scene.Add(std::make_unique<Light>(Vector3f(20, 70, 20), 1));
-    scene.buildBVH();
+
+    if (types.size() > 1) {
+        for (AcceleratorType type : types) {
+            auto buildStart = std::chrono::steady_clock::now();
+            bunny.buildAccelerator(type);
+            scene.acceleratorType = type;
+            scene.buildAccelerator();
+            auto buildStop = std::chrono::steady_clock::now();
+
+            Renderer r;
+            r.Render(scene);
+            auto renderStop = std::chrono::steady_clock::now();
+
+            auto ms = [](auto d) {
+                return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+            };
+            printf("\n%-8s build %6lld ms  render %8lld ms\n", AcceleratorName(type),
+                   ms(buildStop - buildStart), ms(renderStop - buildStop));
+        }
+        return 0;
+    }
+
+    scene.acceleratorType = types[0];
+    scene.buildAccelerator();
 
     Renderer r;
 
@@ -1,28 +1,140 @@
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include "BVH.hpp"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
-                   SplitMethod splitMethod)
+                   SplitMethod splitMethod, float spatialSplitBudget)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
-      primitives(std::move(p))
+      spatialSplitBudget(spatialSplitBudget), primitives(std::move(p))
 {
-    time_t start, stop;
-    time(&start);
     if (primitives.empty())
         return;
 
-    root = recursiveBuild(primitives);
+    build();
 
-    time(&stop);
-    double diff = difftime(stop, start);
-    int hrs = (int)diff / 3600;
-    int mins = ((int)diff / 60) - (hrs * 60);
-    int secs = (int)diff - (hrs * 3600) - (mins * 60);
+    fprintf(stderr, "\rBVH Generation complete: \nTime Taken: %.3f ms\n\n", buildMilliseconds);
+}
+
+static void deleteNodes(BVHBuildNode* node)
+{
+    if (!node)
+        return;
+    deleteNodes(node->left);
+    deleteNodes(node->right);
+    delete node;
+}
+
+// Relative costs of a traversal step and a primitive test in the SAH
+static const float kTraversalCost = 1.f, kIntersectionCost = 1.f;
+
+// Unnormalised SAH cost of a subtree, i.e. the sum over its nodes of surface
+// area times the cost of visiting that node
+static float nodeCost(BVHBuildNode* node)
+{
+    if (node->left == nullptr && node->right == nullptr)
+        return node->bounds.SurfaceArea() * kIntersectionCost;
+    return node->bounds.SurfaceArea() * kTraversalCost + nodeCost(node->left) +
+           nodeCost(node->right);
+}
+
+BVHAccel::~BVHAccel()
+{
+    // LBVH nodes live in linearNodes and are released with it
+    if (!linearNodes)
+        deleteNodes(root);
+}
+
+Bounds3 BVHAccel::WorldBound() const
+{
+    return root ? root->bounds : Bounds3();
+}
+
+void BVHAccel::build()
+{
+    auto start = std::chrono::steady_clock::now();
+    if (splitMethod == SplitMethod::LBVH)
+        root = linearBuild();
+    else if (splitMethod == SplitMethod::SBVH)
+        root = spatialBuild();
+    else
+        root = recursiveBuild(primitives);
+    buildCost = sahCost = nodeCost(root) / root->bounds.SurfaceArea();
+    buildMilliseconds = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+}
+
+bool ParseSplitMethod(const std::string& name, BVHAccel::SplitMethod& method)
+{
+    if (name == "naive")
+        method = BVHAccel::SplitMethod::NAIVE;
+    else if (name == "lbvh")
+        method = BVHAccel::SplitMethod::LBVH;
+    else if (name == "sbvh")
+        method = BVHAccel::SplitMethod::SBVH;
+    else
+        return false;
+    return true;
+}
+
+static double volume(const Bounds3& b)
+{
+    Vector3f d = b.Diagonal();
+    return d.x > 0 && d.y > 0 && d.z > 0 ? (double)d.x * d.y * d.z : 0;
+}
+
+static void collectStats(BVHBuildNode* node, int depth, BVHStats& stats)
+{
+    stats.nodes++;
+    stats.maxDepth = std::max(stats.maxDepth, depth);
+    if (node->left == nullptr && node->right == nullptr) {
+        int size = node->object ? 1 : 0;
+        stats.leaves++;
+        stats.primitiveReferences += size;
+        if ((int)stats.leafSizeHistogram.size() <= size)
+            stats.leafSizeHistogram.resize(size + 1);
+        stats.leafSizeHistogram[size]++;
+        if ((int)stats.depthHistogram.size() <= depth)
+            stats.depthHistogram.resize(depth + 1);
+        stats.depthHistogram[depth]++;
+        return;
+    }
+    stats.interiorNodes++;
+    Bounds3 overlap;
+    overlap.pMin = Vector3f::Max(node->left->bounds.pMin, node->right->bounds.pMin);
+    overlap.pMax = Vector3f::Min(node->left->bounds.pMax, node->right->bounds.pMax);
+    stats.overlapVolume += volume(overlap);
+    collectStats(node->left, depth + 1, stats);
+    collectStats(node->right, depth + 1, stats);
+}
+
+BVHStats BVHAccel::getStats() const
+{
+    BVHStats stats;
+    if (!root)
+        return stats;
+    collectStats(root, 0, stats);
+    stats.sahCost = nodeCost(root) / root->bounds.SurfaceArea();
+    double rootVolume = volume(root->bounds);
+    stats.relativeOverlap = rootVolume > 0 ? stats.overlapVolume / rootVolume : 0;
+    stats.memoryBytes = stats.nodes * sizeof(BVHBuildNode) + primitives.size() * sizeof(Object*);
+    return stats;
+}
 
-    printf(
-        "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n\n",
-        hrs, mins, secs);
+void BVHAccel::rebuild()
+{
+    if (!linearNodes)
+        deleteNodes(root);
+    linearNodes.reset();
+    root = nullptr;
+    wideNodes.clear();
+    widePrims.clear();
+    wideAreaCdf.clear();
+    if (!primitives.empty())
+        build();
 }
 
 BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
@@ -96,9 +208,846 @@ BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
     return node;
 }
 
+// Spread the low 21 bits of v so that there are two zero bits between each
+static inline uint64_t expandBits(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+// 63-bit Morton code of a point given in [0, 1]^3
+uint64_t mortonCode(const Vector3f& p)
+{
+    const float scale = (1 << 21) - 1;
+    uint64_t x = (uint64_t)clamp(0, scale, p.x * scale);
+    uint64_t y = (uint64_t)clamp(0, scale, p.y * scale);
+    uint64_t z = (uint64_t)clamp(0, scale, p.z * scale);
+    return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+}
+
+struct MortonPrimitive {
+    uint64_t code;
+    int index;
+};
+
+// Stable LSD radix sort on the morton codes, 8 bits per pass. Every pass
+// histograms one block per thread, then scatters each block to its own
+// precomputed offsets so no synchronisation is needed inside a pass.
+static void radixSort(std::vector<MortonPrimitive>& v)
+{
+    const int bitsPerPass = 8, nBuckets = 1 << bitsPerPass;
+    const int n = v.size();
+    const int nBlocks = std::max(1, std::min<int>(std::thread::hardware_concurrency(), n / 4096));
+    const int blockSize = (n + nBlocks - 1) / nBlocks;
+    std::vector<MortonPrimitive> temp(n);
+    std::vector<int> counts(nBlocks * nBuckets);
+
+    for (int pass = 0; pass < 64 / bitsPerPass; ++pass) {
+        const int lowBit = pass * bitsPerPass;
+        std::fill(counts.begin(), counts.end(), 0);
+        parallelFor(0, nBlocks, [&](int b) {
+            int* c = &counts[b * nBuckets];
+            for (int i = b * blockSize; i < std::min(n, (b + 1) * blockSize); ++i)
+                c[(v[i].code >> lowBit) & (nBuckets - 1)]++;
+        }, 1);
+
+        // exclusive scan in bucket-major, block-minor order keeps the sort stable
+        int sum = 0;
+        bool skip = false;
+        for (int bucket = 0; bucket < nBuckets && !skip; ++bucket) {
+            int bucketCount = 0;
+            for (int b = 0; b < nBlocks; ++b) {
+                int c = counts[b * nBuckets + bucket];
+                counts[b * nBuckets + bucket] = sum;
+                sum += c;
+                bucketCount += c;
+            }
+            // every key has the same digit: this pass would be a copy
+            skip = bucketCount == n;
+        }
+        if (skip)
+            continue;
+
+        parallelFor(0, nBlocks, [&](int b) {
+            int* offset = &counts[b * nBuckets];
+            for (int i = b * blockSize; i < std::min(n, (b + 1) * blockSize); ++i)
+                temp[offset[(v[i].code >> lowBit) & (nBuckets - 1)]++] = v[i];
+        }, 1);
+        std::swap(v, temp);
+    }
+}
+
+// Leading zero bits of x, which is not 0
+static inline int clz32(uint32_t x)
+{
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanReverse(&bit, x);
+    return 31 - (int)bit;
+#else
+    return __builtin_clz(x);
+#endif
+}
+
+static inline int clz64(uint64_t x)
+{
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanReverse64(&bit, x);
+    return 63 - (int)bit;
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+// Length of the common prefix of the keys at i and j (Karras 2012). Equal
+// codes are disambiguated by their position so every key is unique.
+static inline int commonPrefix(const std::vector<MortonPrimitive>& m, int i, int j)
+{
+    if (j < 0 || j >= (int)m.size())
+        return -1;
+    uint64_t a = m[i].code, b = m[j].code;
+    if (a == b)
+        return 64 + clz32((uint32_t)(i ^ j));
+    return clz64(a ^ b);
+}
+
+// Linear BVH: sort primitive centroids along a Morton curve and emit the
+// binary radix tree over the sorted keys. Every interior node is found
+// independently, so hierarchy emission and the bottom-up bounds pass are both
+// fully parallel. Nodes are laid out as [n leaves | n - 1 interior nodes].
+BVHBuildNode* BVHAccel::linearBuild()
+{
+    const int n = primitives.size();
+    std::vector<Bounds3> primBounds(n);
+    parallelFor(0, n, [&](int i) { primBounds[i] = primitives[i]->getBounds(); });
+
+    Bounds3 centroidBounds;
+    for (int i = 0; i < n; ++i)
+        centroidBounds = Union(centroidBounds, primBounds[i].Centroid());
+
+    std::vector<MortonPrimitive> morton(n);
+    parallelFor(0, n, [&](int i) {
+        morton[i].code = mortonCode(centroidBounds.Offset(primBounds[i].Centroid()));
+        morton[i].index = i;
+    });
+    radixSort(morton);
+
+    linearNodes.reset(new BVHBuildNode[2 * n - 1]);
+    BVHBuildNode* leaves = &linearNodes[0];
+    BVHBuildNode* interior = &linearNodes[n];
+    std::vector<int> parent(2 * n - 1, -1);
+
+    parallelFor(0, n, [&](int i) {
+        int prim = morton[i].index;
+        leaves[i].bounds = primBounds[prim];
+        leaves[i].object = primitives[prim];
+        leaves[i].area = primitives[prim]->getArea();
+    });
+
+    parallelFor(0, n - 1, [&](int i) {
+        // direction of the range covered by node i
+        int d = commonPrefix(morton, i, i + 1) - commonPrefix(morton, i, i - 1) > 0 ? 1 : -1;
+        int deltaMin = commonPrefix(morton, i, i - d);
+        int lMax = 2;
+        while (commonPrefix(morton, i, i + lMax * d) > deltaMin)
+            lMax *= 2;
+        int l = 0;
+        for (int t = lMax / 2; t >= 1; t /= 2)
+            if (commonPrefix(morton, i, i + (l + t) * d) > deltaMin)
+                l += t;
+        int j = i + l * d;
+
+        // binary search the position where the highest differing bit flips
+        int deltaNode = commonPrefix(morton, i, j);
+        int s = 0;
+        for (int div = 2, t = l; t > 1; div *= 2) {
+            t = (l + div - 1) / div;
+            if (commonPrefix(morton, i, i + (s + t) * d) > deltaNode)
+                s += t;
+        }
+        int split = i + s * d + std::min(d, 0);
+
+        int left = std::min(i, j) == split ? split : n + split;
+        int right = std::max(i, j) == split + 1 ? split + 1 : n + split + 1;
+        interior[i].left = &linearNodes[left];
+        interior[i].right = &linearNodes[right];
+        parent[left] = n + i;
+        parent[right] = n + i;
+    });
+
+    // Walk up from every leaf; the second child to arrive at a node owns its
+    // bounds, so each interior node is finished exactly once.
+    std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[n]);
+    for (int i = 0; i < n; ++i)
+        visits[i].store(0, std::memory_order_relaxed);
+    parallelFor(0, n, [&](int i) {
+        int node = parent[i];
+        while (node != -1) {
+            if (visits[node - n].fetch_add(1, std::memory_order_acq_rel) == 0)
+                break;
+            BVHBuildNode& b = linearNodes[node];
+            b.bounds = Union(b.left->bounds, b.right->bounds);
+            b.area = b.left->area + b.right->area;
+            node = parent[node];
+        }
+    });
+
+    return n == 1 ? &leaves[0] : &interior[0];
+}
+
+static inline bool isEmpty(const Bounds3& b)
+{
+    return b.pMin.x > b.pMax.x || b.pMin.y > b.pMax.y || b.pMin.z > b.pMax.z;
+}
+
+static inline float safeArea(const Bounds3& b)
+{
+    return isEmpty(b) ? 0 : b.SurfaceArea();
+}
+
+// Spatial-split BVH (Stich et al. 2009). Nodes partition primitive
+// references instead of primitives; a reference is an object plus the part
+// of its bounds inside the node. Every node considers the best binned SAH
+// object split and, when its children would overlap noticeably, the best
+// binned spatial split, which clips the references straddling the plane
+// into both children.
+namespace {
+struct Reference {
+    Bounds3 bounds;
+    Object* object;
+};
+
+// Either the references whose centroid bin on axis is below bin go left,
+// or, with bin 0, the first index references in centroid order
+struct ObjectSplit {
+    float cost = std::numeric_limits<float>::infinity();
+    int axis = -1, index = 0;
+    int bin = 0;
+    float lo = 0, scale = 0;
+    Bounds3 left, right;
+};
+
+struct SpatialSplit {
+    float cost = std::numeric_limits<float>::infinity();
+    int axis = -1;
+    float plane = 0;
+    Bounds3 left, right;
+    int nLeft = 0, nRight = 0;
+};
+
+class SpatialBuilder {
+public:
+    SpatialBuilder(const std::vector<Object*>& primitives, float budget)
+        : duplicatesLeft((long long)(budget * primitives.size()))
+    {
+        for (Object* object : primitives)
+            refs.push_back({object->getBounds(), object});
+    }
+
+    BVHBuildNode* build()
+    {
+        Bounds3 bounds;
+        for (const Reference& r : refs)
+            bounds = Union(bounds, r.bounds);
+        rootArea = bounds.SurfaceArea();
+        return buildNode(refs, 0);
+    }
+
+    size_t references = 0;
+
+private:
+    static const int kSpatialBins = 32;
+    // Nodes with more references than this bin them by centroid for the
+    // object split; smaller ones sweep every split position
+    static const int kObjectBins = 32;
+    static const int kMaxDepth = 64;
+    // Spatial splits are only tried when the children of the best object
+    // split overlap by more than this fraction of the root surface area
+    static constexpr float kOverlapThreshold = 1e-5f;
+
+    BVHBuildNode* buildNode(std::vector<Reference>& nodeRefs, int depth);
+    ObjectSplit findObjectSplit(std::vector<Reference>& nodeRefs, const Bounds3& bounds);
+    ObjectSplit sweepObjectSplit(std::vector<Reference>& nodeRefs, const Bounds3& bounds);
+    SpatialSplit findSpatialSplit(const std::vector<Reference>& nodeRefs, const Bounds3& bounds);
+    void performObjectSplit(std::vector<Reference>& nodeRefs, const ObjectSplit& split,
+                            std::vector<Reference>& left, std::vector<Reference>& right);
+    void performSpatialSplit(std::vector<Reference>& nodeRefs, const SpatialSplit& split,
+                             std::vector<Reference>& left, std::vector<Reference>& right);
+    void splitReference(const Reference& ref, int axis, float plane, Reference& left,
+                        Reference& right);
+
+    std::vector<Reference> refs;
+    float rootArea = 0;
+    long long duplicatesLeft;
+    // objects whose area has been assigned to a leaf, so duplicates get none
+    std::unordered_map<Object*, bool> sampled;
+};
+
+void SpatialBuilder::splitReference(const Reference& ref, int axis, float plane,
+                                    Reference& left, Reference& right)
+{
+    Bounds3 leftBox = ref.bounds, rightBox = ref.bounds;
+    leftBox.pMax[axis] = plane;
+    rightBox.pMin[axis] = plane;
+    left = {ref.object->getClippedBounds(leftBox), ref.object};
+    right = {ref.object->getClippedBounds(rightBox), ref.object};
+    // Both halves must reach the plane exactly; clipping may round the
+    // intersection points inwards and leave a seam rays could slip through
+    if (!isEmpty(left.bounds))
+        left.bounds.pMax[axis] = plane;
+    if (!isEmpty(right.bounds))
+        right.bounds.pMin[axis] = plane;
+}
+
+// Centroids are kept doubled, pMin + pMax, which orders them the same
+static inline float centroid2(const Reference& ref, int axis)
+{
+    return ref.bounds.pMin[axis] + ref.bounds.pMax[axis];
+}
+
+static inline bool centroidLess(const Reference& a, const Reference& b, int axis)
+{
+    float ca = centroid2(a, axis), cb = centroid2(b, axis);
+    return ca < cb || (ca == cb && a.object < b.object);
+}
+
+static inline int objectBin(const Reference& ref, int axis, float lo, float scale, int bins)
+{
+    return std::max(0, std::min(bins - 1, (int)((centroid2(ref, axis) - lo) * scale)));
+}
+
+ObjectSplit SpatialBuilder::findObjectSplit(std::vector<Reference>& nodeRefs,
+                                            const Bounds3& bounds)
+{
+    const int n = nodeRefs.size();
+    if (n <= kObjectBins)
+        return sweepObjectSplit(nodeRefs, bounds);
+
+    // SAH over the boundaries of kObjectBins centroid bins on each axis
+    ObjectSplit best;
+    const float invArea = 1 / bounds.SurfaceArea();
+    Bounds3 centroids;
+    for (const Reference& ref : nodeRefs)
+        centroids = Union(centroids, ref.bounds.pMin + ref.bounds.pMax);
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo = centroids.pMin[axis], extent = centroids.pMax[axis] - lo;
+        if (extent <= 0)
+            continue;
+        float scale = kObjectBins / extent;
+
+        Bounds3 binBounds[kObjectBins];
+        int counts[kObjectBins] = {};
+        for (const Reference& ref : nodeRefs) {
+            int b = objectBin(ref, axis, lo, scale, kObjectBins);
+            counts[b]++;
+            binBounds[b] = Union(binBounds[b], ref.bounds);
+        }
+
+        Bounds3 rightBounds[kObjectBins];
+        Bounds3 right;
+        for (int b = kObjectBins - 1; b > 0; --b)
+            rightBounds[b] = right = Union(right, binBounds[b]);
+        Bounds3 left;
+        int nLeft = 0;
+        for (int b = 1; b < kObjectBins; ++b) {
+            left = Union(left, binBounds[b - 1]);
+            nLeft += counts[b - 1];
+            if (nLeft == 0 || nLeft == n)
+                continue;
+            float cost = kTraversalCost + kIntersectionCost * invArea *
+                         (safeArea(left) * nLeft + safeArea(rightBounds[b]) * (n - nLeft));
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.index = nLeft;
+                best.bin = b;
+                best.lo = lo;
+                best.scale = scale;
+                best.left = left;
+                best.right = rightBounds[b];
+            }
+        }
+    }
+    // every centroid is the same point: any split is as good as another
+    if (best.axis == -1) {
+        best.axis = 0;
+        best.index = n / 2;
+    }
+    return best;
+}
+
+ObjectSplit SpatialBuilder::sweepObjectSplit(std::vector<Reference>& nodeRefs,
+                                             const Bounds3& bounds)
+{
+    // full SAH sweep over the references sorted by centroid on each axis
+    ObjectSplit best;
+    const int n = nodeRefs.size();
+    const float invArea = 1 / bounds.SurfaceArea();
+    std::vector<Bounds3> rightBounds(n);
+    for (int axis = 0; axis < 3; ++axis) {
+        std::sort(nodeRefs.begin(), nodeRefs.end(), [axis](const Reference& a, const Reference& b) {
+            return centroidLess(a, b, axis);
+        });
+        Bounds3 right;
+        for (int i = n - 1; i > 0; --i)
+            rightBounds[i] = right = Union(right, nodeRefs[i].bounds);
+        Bounds3 left;
+        for (int i = 1; i < n; ++i) {
+            left = Union(left, nodeRefs[i - 1].bounds);
+            float cost = kTraversalCost + kIntersectionCost * invArea *
+                         (left.SurfaceArea() * i + rightBounds[i].SurfaceArea() * (n - i));
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.index = i;
+                best.left = left;
+                best.right = rightBounds[i];
+            }
+        }
+    }
+    // every reference is a point: any split is as good as another
+    if (best.axis == -1) {
+        best.axis = 0;
+        best.index = n / 2;
+    }
+    return best;
+}
+
+SpatialSplit SpatialBuilder::findSpatialSplit(const std::vector<Reference>& nodeRefs,
+                                              const Bounds3& bounds)
+{
+    SpatialSplit best;
+    const int n = nodeRefs.size();
+    const float invArea = 1 / bounds.SurfaceArea();
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo = bounds.pMin[axis], extent = bounds.pMax[axis] - lo;
+        if (extent <= 0)
+            continue;
+        float binWidth = extent / kSpatialBins;
+        auto binOf = [&](float x) {
+            return std::max(0, std::min(kSpatialBins - 1, (int)((x - lo) / binWidth)));
+        };
+
+        // chop every reference into the bins it spans
+        Bounds3 binBounds[kSpatialBins];
+        int entries[kSpatialBins] = {}, exits[kSpatialBins] = {};
+        for (const Reference& ref : nodeRefs) {
+            int first = binOf(ref.bounds.pMin[axis]), last = binOf(ref.bounds.pMax[axis]);
+            entries[first]++;
+            exits[last]++;
+            if (first == last) {
+                binBounds[first] = Union(binBounds[first], ref.bounds);
+                continue;
+            }
+            // one clip per bin the reference spans
+            for (int b = first; b <= last; ++b) {
+                Bounds3 slab = ref.bounds;
+                if (b > first)
+                    slab.pMin[axis] = lo + b * binWidth;
+                if (b < last)
+                    slab.pMax[axis] = lo + (b + 1) * binWidth;
+                Bounds3 part = ref.object->getClippedBounds(slab);
+                if (!isEmpty(part))
+                    binBounds[b] = Union(binBounds[b], part);
+            }
+        }
+
+        Bounds3 rightBounds[kSpatialBins];
+        Bounds3 right;
+        for (int b = kSpatialBins - 1; b > 0; --b)
+            rightBounds[b] = right = Union(right, binBounds[b]);
+        Bounds3 left;
+        int nLeft = 0, nRight = n;
+        for (int b = 1; b < kSpatialBins; ++b) {
+            left = Union(left, binBounds[b - 1]);
+            nLeft += entries[b - 1];
+            nRight -= exits[b - 1];
+            // a split that does not reduce both sides would never terminate
+            if (nLeft == 0 || nRight == 0 || nLeft == n || nRight == n)
+                continue;
+            float cost = kTraversalCost + kIntersectionCost * invArea *
+                         (safeArea(left) * nLeft + safeArea(rightBounds[b]) * nRight);
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.plane = lo + b * binWidth;
+                best.left = left;
+                best.right = rightBounds[b];
+                best.nLeft = nLeft;
+                best.nRight = nRight;
+            }
+        }
+    }
+    return best;
+}
+
+void SpatialBuilder::performObjectSplit(std::vector<Reference>& nodeRefs, const ObjectSplit& split,
+                                        std::vector<Reference>& left, std::vector<Reference>& right)
+{
+    const int axis = split.axis;
+    auto middle = nodeRefs.begin() + split.index;
+    if (split.bin > 0)
+        middle = std::partition(nodeRefs.begin(), nodeRefs.end(), [&](const Reference& ref) {
+            return objectBin(ref, axis, split.lo, split.scale, kObjectBins) < split.bin;
+        });
+    else
+        std::nth_element(nodeRefs.begin(), middle, nodeRefs.end(), [axis](const Reference& a, const Reference& b) {
+            return centroidLess(a, b, axis);
+        });
+    left.assign(nodeRefs.begin(), middle);
+    right.assign(middle, nodeRefs.end());
+}
+
+void SpatialBuilder::performSpatialSplit(std::vector<Reference>& nodeRefs, const SpatialSplit& split,
+                                         std::vector<Reference>& left, std::vector<Reference>& right)
+{
+    const int axis = split.axis;
+    std::vector<const Reference*> straddling;
+    Bounds3 leftBounds, rightBounds;
+    for (const Reference& ref : nodeRefs) {
+        if (ref.bounds.pMax[axis] <= split.plane) {
+            left.push_back(ref);
+            leftBounds = Union(leftBounds, ref.bounds);
+        }
+        else if (ref.bounds.pMin[axis] >= split.plane) {
+            right.push_back(ref);
+            rightBounds = Union(rightBounds, ref.bounds);
+        }
+        else
+            straddling.push_back(&ref);
+    }
+
+    // Reference unsplitting: keep a straddling reference whole on one side
+    // when that is cheaper than duplicating it, or when the budget is spent
+    int nLeft = split.nLeft, nRight = split.nRight;
+    for (const Reference* ref : straddling) {
+        Reference l, r;
+        splitReference(*ref, axis, split.plane, l, r);
+        float splitCost = safeArea(split.left) * nLeft + safeArea(split.right) * nRight;
+        float leftCost = Union(split.left, ref->bounds).SurfaceArea() * nLeft +
+                         safeArea(split.right) * (nRight - 1);
+        float rightCost = safeArea(split.left) * (nLeft - 1) +
+                          Union(split.right, ref->bounds).SurfaceArea() * nRight;
+        bool canSplit = duplicatesLeft > 0 && !isEmpty(l.bounds) && !isEmpty(r.bounds);
+        if (canSplit && splitCost <= leftCost && splitCost <= rightCost) {
+            left.push_back(l);
+            right.push_back(r);
+            --duplicatesLeft;
+        }
+        else if (leftCost <= rightCost) {
+            left.push_back(*ref);
+            --nRight;
+        }
+        else {
+            right.push_back(*ref);
+            --nLeft;
+        }
+    }
+}
+
+BVHBuildNode* SpatialBuilder::buildNode(std::vector<Reference>& nodeRefs, int depth)
+{
+    BVHBuildNode* node = new BVHBuildNode();
+    if (nodeRefs.size() == 1) {
+        const Reference& ref = nodeRefs[0];
+        node->bounds = ref.bounds;
+        node->object = ref.object;
+        // duplicates carry no area so area sampling picks each object once
+        bool& seen = sampled[ref.object];
+        node->area = seen ? 0 : ref.object->getArea();
+        seen = true;
+        ++references;
+        return node;
+    }
+
+    Bounds3 bounds;
+    for (const Reference& r : nodeRefs)
+        bounds = Union(bounds, r.bounds);
+
+    std::vector<Reference> left, right;
+    ObjectSplit objectSplit = findObjectSplit(nodeRefs, bounds);
+    bool spatial = false;
+    if (duplicatesLeft > 0 && depth < kMaxDepth) {
+        Bounds3 overlap;
+        overlap.pMin = Vector3f::Max(objectSplit.left.pMin, objectSplit.right.pMin);
+        overlap.pMax = Vector3f::Min(objectSplit.left.pMax, objectSplit.right.pMax);
+        if (safeArea(overlap) > kOverlapThreshold * rootArea) {
+            SpatialSplit spatialSplit = findSpatialSplit(nodeRefs, bounds);
+            if (spatialSplit.cost < objectSplit.cost) {
+                long long budget = duplicatesLeft;
+                performSpatialSplit(nodeRefs, spatialSplit, left, right);
+                spatial = !left.empty() && !right.empty() && left.size() < nodeRefs.size() &&
+                          right.size() < nodeRefs.size();
+                if (!spatial) {
+                    duplicatesLeft = budget;
+                    left.clear();
+                    right.clear();
+                }
+            }
+        }
+    }
+    if (!spatial)
+        performObjectSplit(nodeRefs, objectSplit, left, right);
+
+    std::vector<Reference>().swap(nodeRefs);
+    node->left = buildNode(left, depth + 1);
+    node->right = buildNode(right, depth + 1);
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->area = node->left->area + node->right->area;
+    return node;
+}
+} // namespace
+
+BVHBuildNode* BVHAccel::spatialBuild()
+{
+    SpatialBuilder builder(primitives, spatialSplitBudget);
+    BVHBuildNode* node = builder.build();
+    fprintf(stderr, "SBVH: %zu references for %zu primitives\n", builder.references, primitives.size());
+    return node;
+}
+
+// Subtrees above this depth are refitted on their own thread
+static const int kRefitParallelDepth = 4;
+
+float BVHAccel::refitNode(BVHBuildNode* node, int depth)
+{
+    if (node->left == nullptr && node->right == nullptr) {
+        node->bounds = node->object->getBounds();
+        node->area = node->object->getArea();
+        return node->bounds.SurfaceArea() * kIntersectionCost;
+    }
+
+    float cost;
+    if (depth < kRefitParallelDepth) {
+        auto left = std::async(std::launch::async,
+                               [&]() { return refitNode(node->left, depth + 1); });
+        cost = refitNode(node->right, depth + 1) + left.get();
+    }
+    else
+        cost = refitNode(node->left, depth + 1) + refitNode(node->right, depth + 1);
+
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->area = node->left->area + node->right->area;
+    return cost + node->bounds.SurfaceArea() * kTraversalCost;
+}
+
+bool BVHAccel::refit()
+{
+    if (!wideNodes.empty() || splitMethod == SplitMethod::SBVH) {
+        rebuild();
+        return true;
+    }
+    if (!root)
+        return false;
+    sahCost = refitNode(root, 0) / root->bounds.SurfaceArea();
+    if (sahCost <= buildCost * rebuildThreshold)
+        return false;
+    rebuild();
+    return true;
+}
+
+static const int kWidth = 4;
+
+static size_t countNodes(BVHBuildNode* node)
+{
+    if (node->left == nullptr && node->right == nullptr)
+        return 1;
+    return 1 + countNodes(node->left) + countNodes(node->right);
+}
+
+// Pick the binary nodes that become the children of one wide node by
+// repeatedly opening the interior child with the largest surface area
+static int collapseChildren(BVHBuildNode* node, BVHBuildNode* children[kWidth])
+{
+    if (node->left == nullptr && node->right == nullptr) {
+        children[0] = node;
+        return 1;
+    }
+    children[0] = node->left;
+    children[1] = node->right;
+    int count = 2;
+    while (count < kWidth) {
+        int best = -1;
+        double bestArea = -1;
+        for (int i = 0; i < count; ++i) {
+            BVHBuildNode* c = children[i];
+            if (c->left != nullptr && c->bounds.SurfaceArea() > bestArea) {
+                best = i;
+                bestArea = c->bounds.SurfaceArea();
+            }
+        }
+        if (best == -1)
+            break;
+        BVHBuildNode* open = children[best];
+        children[best] = open->left;
+        children[count++] = open->right;
+    }
+    return count;
+}
+
+void BVHAccel::compressNode(uint32_t index, BVHBuildNode* node,
+                            const std::unordered_map<Object*, uint32_t>& primIndex, int depth)
+{
+    wideDepth = std::max(wideDepth, depth);
+    BVHBuildNode* children[kWidth];
+    int count = collapseChildren(node, children);
+
+    QuantizedBVHNode q{};
+    Bounds3 box;
+    for (int i = 0; i < count; ++i)
+        box = Union(box, children[i]->bounds);
+    const Vector3f &boxMin = box.pMin, &boxMax = box.pMax;
+    for (int a = 0; a < 3; ++a) {
+        // smallest power of two that spans the node extent in 255 steps
+        float extent = boxMax[a] - boxMin[a];
+        int e = 0;
+        if (extent > 0)
+            std::frexp(extent / 255.f, &e);
+        e = std::max(-127, std::min(127, e));
+        float scale = std::ldexp(1.f, e);
+        q.origin[a] = boxMin[a];
+        q.exponent[a] = e;
+        for (int i = 0; i < count; ++i) {
+            const Bounds3& child = children[i]->bounds;
+            float lo = child.pMin[a], hi = child.pMax[a];
+            int l = std::max(0, (int)std::floor((lo - q.origin[a]) / scale));
+            int h = std::min(255, (int)std::ceil((hi - q.origin[a]) / scale));
+            // the divisions above may round inwards; step out until exact
+            while (l > 0 && q.origin[a] + l * scale > lo)
+                --l;
+            while (h < 255 && q.origin[a] + h * scale < hi)
+                ++h;
+            q.qlo[a][i] = l;
+            q.qhi[a][i] = h;
+        }
+    }
+
+    int leafMask = 0, nInterior = 0;
+    for (int i = 0; i < count; ++i) {
+        if (children[i]->left == nullptr)
+            leafMask |= 1 << i;
+        else
+            ++nInterior;
+    }
+    q.meta = (count << 4) | leafMask;
+    q.childBase = wideNodes.size();
+    q.primBase = widePrims.size();
+    for (int i = 0; i < count; ++i)
+        if (leafMask & (1 << i))
+            widePrims.push_back(primIndex.at(children[i]->object));
+    wideNodes.resize(wideNodes.size() + nInterior);
+    wideNodes[index] = q;
+
+    uint32_t next = q.childBase;
+    for (int i = 0; i < count; ++i)
+        if (!(leafMask & (1 << i)))
+            compressNode(next++, children[i], primIndex, depth + 1);
+}
+
+void BVHAccel::compress()
+{
+    if (!root || !wideNodes.empty())
+        return;
+    size_t before = sizeof(BVHBuildNode) * countNodes(root);
+
+    std::unordered_map<Object*, uint32_t> primIndex;
+    for (uint32_t i = 0; i < primitives.size(); ++i)
+        primIndex[primitives[i]] = i;
+    wideNodes.resize(1);
+    wideDepth = 0;
+    compressNode(0, root, primIndex, 1);
+    wideNodes.shrink_to_fit();
+    // spatial splits may reference a primitive more than once; only its
+    // first reference carries its area
+    wideAreaCdf.resize(widePrims.size());
+    std::vector<bool> counted(primitives.size());
+    float sum = 0;
+    for (size_t i = 0; i < widePrims.size(); ++i) {
+        if (!counted[widePrims[i]])
+            sum += primitives[widePrims[i]]->getArea();
+        counted[widePrims[i]] = true;
+        wideAreaCdf[i] = sum;
+    }
+
+    if (!linearNodes)
+        deleteNodes(root);
+    linearNodes.reset();
+    root = nullptr;
+
+    fprintf(stderr, "Compressed BVH: %zu nodes, %zu -> %zu bytes\n", wideNodes.size(), before, wideMemoryBytes());
+}
+
+size_t BVHAccel::wideMemoryBytes() const
+{
+    return sizeof(QuantizedBVHNode) * wideNodes.size() + (sizeof(uint32_t) + sizeof(float)) * widePrims.size();
+}
+
+Intersection BVHAccel::getWideIntersection(const Ray& ray) const
+{
+    Intersection isect;
+    // every node on the way down leaves at most kWidth - 1 siblings behind;
+    // trees deeper than the fixed stack allows get one on the heap
+    uint32_t fixedStack[256];
+    std::vector<uint32_t> heapStack;
+    uint32_t* stack = fixedStack;
+    size_t stackSize = (kWidth - 1) * (size_t)wideDepth + 1;
+    if (stackSize > sizeof(fixedStack) / sizeof(fixedStack[0])) {
+        heapStack.resize(stackSize);
+        stack = heapStack.data();
+    }
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const QuantizedBVHNode& node = wideNodes[stack[--top]];
+        int count = node.meta >> 4, leafMask = node.meta & 0xf;
+
+        // child slab distances are t = a + q * b on every axis
+        float a[3], b[3];
+        for (int k = 0; k < 3; ++k) {
+            a[k] = (node.origin[k] - ray.origin[k]) * ray.direction_inv[k];
+            b[k] = std::ldexp(1.f, node.exponent[k]) * ray.direction_inv[k];
+        }
+        uint32_t interior = node.childBase, leaf = node.primBase;
+        for (int i = 0; i < count; ++i) {
+            float tEnter = 0, tExit = isect.distance;
+            for (int k = 0; k < 3; ++k) {
+                float t0 = a[k] + node.qlo[k][i] * b[k];
+                float t1 = a[k] + node.qhi[k][i] * b[k];
+                tEnter = std::max(tEnter, std::min(t0, t1));
+                tExit = std::min(tExit, std::max(t0, t1));
+            }
+            bool hit = tEnter <= tExit;
+            if (leafMask & (1 << i)) {
+                if (hit) {
+                    Intersection h = primitives[widePrims[leaf]]->getIntersection(ray);
+                    if (h.happened && h.distance < isect.distance)
+                        isect = h;
+                }
+                ++leaf;
+            }
+            else {
+                if (hit) {
+                    assert(top < (int)stackSize);
+                    stack[top++] = interior;
+                }
+                ++interior;
+            }
+        }
+    }
+    return isect;
+}
+
 Intersection BVHAccel::Intersect(const Ray& ray) const
 {
     Intersection isect;
+    if (!wideNodes.empty())
+        return getWideIntersection(ray);
     if (!root)
         return isect;
     isect = BVHAccel::getIntersection(root, ray);
@@ -133,18 +1082,30 @@ Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
 }
 
 
-void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf){
+void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf, const Vector2f &u){
     if(node->left == nullptr || node->right == nullptr){
-        node->object->Sample(pos, pdf);
+        float uSelect = node->area > 0 ? std::min(p / node->area, 1.f) : 0.f;
+        node->object->Sample(pos, pdf, uSelect, u);
         pdf *= node->area;
         return;
     }
-    if(p < node->left->area) getSample(node->left, p, pos, pdf);
-    else getSample(node->right, p - node->left->area, pos, pdf);
+    if(p < node->left->area) getSample(node->left, p, pos, pdf, u);
+    else getSample(node->right, p - node->left->area, pos, pdf, u);
 }
 
-void BVHAccel::Sample(Intersection &pos, float &pdf){
-    float p = std::sqrt(get_random_float()) * root->area;
-    getSample(root, p, pos, pdf);
+void BVHAccel::Sample(Intersection &pos, float &pdf, float uSelect, const Vector2f &u){
+    if (!wideNodes.empty()) {
+        float total = wideAreaCdf.back();
+        float p = uSelect * total;
+        size_t i = std::min<size_t>(std::lower_bound(wideAreaCdf.begin(), wideAreaCdf.end(), p) -
+                                    wideAreaCdf.begin(), widePrims.size() - 1);
+        Object* object = primitives[widePrims[i]];
+        float start = i > 0 ? wideAreaCdf[i - 1] : 0.f, width = wideAreaCdf[i] - start;
+        object->Sample(pos, pdf, width > 0 ? std::min((p - start) / width, 1.f) : 0.f, u);
+        pdf *= object->getArea() / total;
+        return;
+    }
+    float p = uSelect * root->area;
+    getSample(root, p, pos, pdf, u);
     pdf /= root->area;
 }
\ No newline at end of file
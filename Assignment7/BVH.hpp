@@ -8,7 +8,10 @@
 #include <atomic>
 #include <vector>
 #include <memory>
-#include <ctime>
+#include <string>
+#include <chrono>
+#include <future>
+#include <unordered_map>
 #include "Object.hpp"
 #include "Ray.hpp"
 #include "Bounds3.hpp"
@@ -19,36 +22,104 @@ struct BVHBuildNode;
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 
+// 4-wide node with child boxes stored as 8-bit offsets on a power-of-two grid
+// anchored at the node's lower corner, rounded outwards so the decoded boxes
+// always enclose the children. Interior children are stored contiguously from
+// childBase, leaf children reference primitives contiguously from primBase.
+struct QuantizedBVHNode {
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t meta;       // child count in the high nibble, leaf mask in the low
+    uint8_t qlo[3][4], qhi[3][4];
+    uint32_t childBase, primBase;
+};
+
+// 63-bit Morton code of a point given in [0, 1]^3
+uint64_t mortonCode(const Vector3f& p);
+
+// Shape of a pointer tree, see BVHAccel::getStats
+struct BVHStats {
+    int nodes = 0, leaves = 0, interiorNodes = 0, maxDepth = 0;
+    size_t primitiveReferences = 0;
+    float sahCost = 0;
+    // summed volume shared by sibling boxes, and that sum over the root volume
+    double overlapVolume = 0, relativeOverlap = 0;
+    size_t memoryBytes = 0;
+    // leaves by primitive count and by depth
+    std::vector<int> leafSizeHistogram, depthHistogram;
+};
+
 // BVHAccel Declarations
-inline int leafNodes, totalLeafNodes, totalPrimitives, interiorNodes;
 class BVHAccel {
 
 public:
     // BVHAccel Public Types
-    enum class SplitMethod { NAIVE, SAH };
+    enum class SplitMethod { NAIVE, SAH, LBVH, SBVH };
 
     // BVHAccel Public Methods
-    BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE);
+    // spatialSplitBudget bounds the extra primitive references the SBVH
+    // builder may create, as a fraction of the primitive count
+    BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE,
+             float spatialSplitBudget = 0.3f);
     Bounds3 WorldBound() const;
     ~BVHAccel();
 
     Intersection Intersect(const Ray &ray) const;
     Intersection getIntersection(BVHBuildNode* node, const Ray& ray)const;
     bool IntersectP(const Ray &ray) const;
-    BVHBuildNode* root;
+    BVHBuildNode* root = nullptr;
+
+    // Recompute node bounds and areas from the current primitive bounds,
+    // keeping the topology. Falls back to a full rebuild once the SAH cost
+    // has grown past rebuildThreshold times the cost right after the last
+    // build; returns true in that case. Spatial-split trees are always
+    // rebuilt since their leaves hold clipped bounds.
+    bool refit();
+    void rebuild();
+    // SAH cost of the tree after the last build and after the last refit
+    float buildCost = 0, sahCost = 0;
+    double buildMilliseconds = 0;
+    // Statistics of the current pointer tree; empty once compressed
+    BVHStats getStats() const;
+    float rebuildThreshold = 1.5f;
 
     // BVHAccel Private Methods
+    void build();
     BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
+    BVHBuildNode* linearBuild();
+    BVHBuildNode* spatialBuild();
+    float refitNode(BVHBuildNode* node, int depth);
+
+    // Convert the tree into QuantizedBVHNodes and release the pointer
+    // tree. Meant for large static meshes; refit() and rebuild() go back to
+    // an uncompressed tree.
+    void compress();
+    void compressNode(uint32_t index, BVHBuildNode* node,
+                      const std::unordered_map<Object*, uint32_t>& primIndex, int depth);
+    Intersection getWideIntersection(const Ray& ray) const;
+    // Bytes of the compressed nodes and their primitive references
+    size_t wideMemoryBytes() const;
+    std::vector<QuantizedBVHNode> wideNodes;
+    std::vector<uint32_t> widePrims;
+    std::vector<float> wideAreaCdf;
+    // levels of wideNodes, which bounds the traversal stack
+    int wideDepth = 0;
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
+    const float spatialSplitBudget;
     std::vector<Object*> primitives;
+    // node storage of the LBVH builder, leaves first then interior nodes
+    std::unique_ptr<BVHBuildNode[]> linearNodes;
 
-    void getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf);
-    void Sample(Intersection &pos, float &pdf);
+    void getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf, const Vector2f &u);
+    void Sample(Intersection &pos, float &pdf, float uSelect, const Vector2f &u);
 };
 
+// naive, lbvh or sbvh
+bool ParseSplitMethod(const std::string& name, BVHAccel::SplitMethod& method);
+
 struct BVHBuildNode {
     Bounds3 bounds;
     BVHBuildNode *left;
@@ -0,0 +1,189 @@
+// Build a scene's BVH with every split method and report the quality of
+// each tree as JSON, so builders can be compared and tracked over time.
+//
+// usage: Assignment7_BVHStats [-o out.json] [-r rays]
+//                             [-s chunks.gsm [-t tris per chunk] [-c cache MiB]]
+//                             [mesh.obj ...]
+//
+// Without meshes the Cornell box of the main program is used. All triangles
+// go into one flat BVH; rays/sec is measured on a fixed, seeded ray set.
+// Each tree is then refitted to its unchanged primitives, which times
+// refit() against the build, or reports the rebuild it fell back to.
+// Every tree is then compressed into 4-wide quantized nodes and measured
+// again, as the "compressed" entry of its build.
+// With -s the one mesh given is also converted into a StreamingMesh chunk
+// file and the same rays are traced through it out of core, one at a time
+// and as a batch, with at most the given MiB of chunks mapped.
+// The JSON goes to stdout as one line, or to the file given with -o; the
+// builders log to stderr.
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "BVH.hpp"
+#include "StreamingMesh.hpp"
+#include "Triangle.hpp"
+
+static std::string histogram(const std::vector<int>& h)
+{
+    std::ostringstream os;
+    os << "[";
+    for (size_t i = 0; i < h.size(); ++i)
+        os << (i ? "," : "") << h[i];
+    os << "]";
+    return os.str();
+}
+
+int main(int argc, char** argv)
+{
+    std::string outFile, chunkFile;
+    int rayCount = 1 << 20, trisPerChunk = 1 << 16, cacheMiB = 4096;
+    std::vector<std::string> meshes;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            outFile = argv[++i];
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            rayCount = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            chunkFile = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            trisPerChunk = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+            cacheMiB = std::max(1, atoi(argv[++i]));
+        else if (argv[i][0] == '-')
+            usage = true;
+        else
+            meshes.push_back(argv[i]);
+    }
+    if (usage || (!chunkFile.empty() && meshes.size() != 1)) {
+        fprintf(stderr, "usage: %s [-o out.json] [-r rays] [-s chunks.gsm [-t tris per chunk] [-c cache MiB]] "
+                        "[mesh.obj ...]\n-s takes exactly one mesh\n", argv[0]);
+        return 1;
+    }
+    if (meshes.empty())
+        for (const char* name : {"floor", "shortbox", "tallbox", "left", "right", "light"})
+            meshes.push_back(std::string("../../models/cornellbox/") + name + ".obj");
+
+    std::vector<std::unique_ptr<MeshTriangle>> loaded;
+    std::vector<Object*> primitives;
+    Bounds3 bounds;
+    for (const std::string& file : meshes) {
+        loaded.emplace_back(new MeshTriangle(file));
+        for (Triangle& tri : loaded.back()->triangles)
+            primitives.push_back(&tri);
+        bounds = Union(bounds, loaded.back()->getBounds());
+    }
+
+    // Fixed ray set: origins uniform in the scene bounds, uniform directions
+    std::mt19937 rng(2020);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    Vector3f extent = bounds.Diagonal();
+    for (int i = 0; i < rayCount; ++i) {
+        Vector3f o = bounds.pMin + extent * Vector3f(uniform(rng), uniform(rng), uniform(rng));
+        float z = 1 - 2 * uniform(rng), r = std::sqrt(std::max(0.f, 1 - z * z));
+        float phi = 2 * M_PI * uniform(rng);
+        rays.emplace_back(o, Vector3f(r * std::cos(phi), r * std::sin(phi), z));
+    }
+
+    std::ostringstream json;
+    json << "{\"primitives\":" << primitives.size() << ",\"rays\":" << rayCount << ",\"builds\":[";
+    const std::pair<const char*, BVHAccel::SplitMethod> methods[] = {
+        {"NAIVE", BVHAccel::SplitMethod::NAIVE},
+        {"LBVH", BVHAccel::SplitMethod::LBVH},
+        {"SBVH", BVHAccel::SplitMethod::SBVH},
+    };
+    bool first = true;
+    for (const auto& method : methods) {
+        BVHAccel bvh(primitives, 1, method.second);
+        BVHStats stats = bvh.getStats();
+
+        size_t hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const Ray& ray : rays)
+            hits += bvh.Intersect(ray).happened;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        json << (first ? "" : ",") << "{\"method\":\"" << method.first << "\""
+             << ",\"buildMs\":" << bvh.buildMilliseconds
+             << ",\"sahCost\":" << stats.sahCost
+             << ",\"nodes\":" << stats.nodes
+             << ",\"leaves\":" << stats.leaves
+             << ",\"interiorNodes\":" << stats.interiorNodes
+             << ",\"maxDepth\":" << stats.maxDepth
+             << ",\"primitiveReferences\":" << stats.primitiveReferences
+             << ",\"overlapVolume\":" << stats.overlapVolume
+             << ",\"relativeOverlap\":" << stats.relativeOverlap
+             << ",\"memoryBytes\":" << stats.memoryBytes
+             << ",\"leafSizeHistogram\":" << histogram(stats.leafSizeHistogram)
+             << ",\"depthHistogram\":" << histogram(stats.depthHistogram)
+             << ",\"hits\":" << hits
+             << ",\"raysPerSecond\":" << (seconds > 0 ? rayCount / seconds : 0);
+
+        start = std::chrono::steady_clock::now();
+        bool rebuilt = bvh.refit();
+        double refitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        json << ",\"refitMs\":" << refitMs << ",\"refitRebuilt\":" << (rebuilt ? "true" : "false");
+
+        bvh.compress();
+        size_t wideHits = 0;
+        start = std::chrono::steady_clock::now();
+        for (const Ray& ray : rays)
+            wideHits += bvh.getWideIntersection(ray).happened;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        json << ",\"compressed\":{\"nodes\":" << bvh.wideNodes.size()
+             << ",\"maxDepth\":" << bvh.wideDepth
+             << ",\"memoryBytes\":" << bvh.wideMemoryBytes()
+             << ",\"hits\":" << wideHits
+             << ",\"raysPerSecond\":" << (seconds > 0 ? rayCount / seconds : 0) << "}}";
+        first = false;
+    }
+    json << "]";
+
+    if (!chunkFile.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<StreamingMesh> mesh;
+        try {
+            StreamingMesh::build(meshes[0], chunkFile, trisPerChunk);
+            mesh = std::make_unique<StreamingMesh>(chunkFile, new Material(), size_t(cacheMiB) << 20);
+        }
+        catch (const std::runtime_error& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        size_t hits = 0;
+        start = std::chrono::steady_clock::now();
+        for (const Ray& ray : rays)
+            hits += mesh->getIntersection(ray).happened;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<Intersection> batch;
+        start = std::chrono::steady_clock::now();
+        mesh->intersectBatch(rays, batch);
+        double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t batchHits = 0;
+        for (const Intersection& hit : batch)
+            batchHits += hit.happened;
+
+        json << ",\"streaming\":{\"chunks\":" << mesh->chunkCount()
+             << ",\"trisPerChunk\":" << trisPerChunk
+             << ",\"cacheMiB\":" << cacheMiB
+             << ",\"buildMs\":" << buildMs
+             << ",\"hits\":" << hits
+             << ",\"raysPerSecond\":" << (seconds > 0 ? rayCount / seconds : 0)
+             << ",\"batchHits\":" << batchHits
+             << ",\"batchRaysPerSecond\":" << (batchSeconds > 0 ? rayCount / batchSeconds : 0) << "}";
+    }
+    json << "}\n";
+
+    if (outFile.empty())
+        std::cout << json.str();
+    else
+        std::ofstream(outFile) << json.str();
+    return 0;
+}
@@ -0,0 +1,55 @@
+//
+// Pinhole camera shared by the renderer and temporal reuse.
+//
+
+#ifndef RAYTRACING_CAMERA_H
+#define RAYTRACING_CAMERA_H
+
+#include <cmath>
+#include "Vector.hpp"
+#include "global.hpp"
+
+// A camera at eye looking at a point, with +y up, for a width x height
+// image with vertical field of view fov (degrees). Image x runs against the
+// camera's right, as the renderer has always had it.
+struct Camera
+{
+    Camera() = default;
+    Camera(const Vector3f& eye, const Vector3f& lookAt, double fov, int width, int height)
+        : eye(eye), width(width), height(height)
+    {
+        float halfFov = fov * 0.5;
+        scale = std::tan(halfFov * M_PI / 180.0);
+        aspect = width / (float)height;
+        forward = normalize(lookAt - eye);
+        left = normalize(crossProduct(forward, Vector3f(0, 1, 0)));
+        up = crossProduct(left, forward);
+    }
+
+    // Direction of the ray through the image position (px, py), in pixels
+    Vector3f direction(float px, float py) const
+    {
+        float x = (2 * px / (float)width - 1) * aspect * scale;
+        float y = (1 - 2 * py / (float)height) * scale;
+        return normalize(left * x + up * y + forward);
+    }
+
+    // Image position whose ray passes through p; false if p is behind
+    bool project(const Vector3f& p, float& px, float& py) const
+    {
+        Vector3f d = p - eye;
+        float z = dotProduct(d, forward);
+        if (z <= 0)
+            return false;
+        float x = dotProduct(d, left) / z, y = dotProduct(d, up) / z;
+        px = (x / (aspect * scale) + 1) * 0.5f * width;
+        py = (1 - y / scale) * 0.5f * height;
+        return true;
+    }
+
+    Vector3f eye, forward, left, up;
+    float scale = 1, aspect = 1;
+    int width = 0, height = 0;
+};
+
+#endif //RAYTRACING_CAMERA_H
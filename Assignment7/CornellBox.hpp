@@ -0,0 +1,67 @@
+//
+// The Cornell box scene, shared by the renderer and the render server.
+//
+
+#ifndef RAYTRACING_CORNELLBOX_H
+#define RAYTRACING_CORNELLBOX_H
+
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Scene.hpp"
+#include "Triangle.hpp"
+
+// Loads the box's meshes from modelDir, throwing std::runtime_error if one
+// is missing, and owns them and their materials, so it has to outlive any
+// scene they are added to. Each mesh's BVH is built with splitMethod.
+class CornellBox
+{
+public:
+    explicit CornellBox(const std::string& modelDir = "../../models/cornellbox/",
+                        BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::NAIVE)
+        : splitMethod(splitMethod)
+    {
+        Material* red = material(Vector3f(0.0f));
+        red->Kd = Vector3f(0.63f, 0.065f, 0.05f);
+        Material* green = material(Vector3f(0.0f));
+        green->Kd = Vector3f(0.14f, 0.45f, 0.091f);
+        Material* white = material(Vector3f(0.0f));
+        white->Kd = Vector3f(0.725f, 0.71f, 0.68f);
+        Material* light = material((8.0f * Vector3f(0.747f+0.058f, 0.747f+0.258f, 0.747f) + 15.6f * Vector3f(0.740f+0.287f,0.740f+0.160f,0.740f) + 18.4f *Vector3f(0.737f+0.642f,0.737f+0.159f,0.737f)));
+        light->Kd = Vector3f(0.65f);
+
+        mesh(modelDir + "floor.obj", white);
+        mesh(modelDir + "shortbox.obj", white);
+        mesh(modelDir + "tallbox.obj", white);
+        mesh(modelDir + "left.obj", red);
+        mesh(modelDir + "right.obj", green);
+        mesh(modelDir + "light.obj", light);
+    }
+
+    void addTo(Scene& scene) const
+    {
+        for (auto& m : meshes)
+            scene.Add(m.get());
+    }
+
+private:
+    Material* material(const Vector3f& emission)
+    {
+        materials.push_back(std::make_unique<Material>(DIFFUSE, emission));
+        return materials.back().get();
+    }
+    void mesh(const std::string& filename, Material* m)
+    {
+        if (!std::ifstream(filename))
+            throw std::runtime_error("cannot open " + filename);
+        meshes.push_back(std::make_unique<MeshTriangle>(filename, m, splitMethod));
+    }
+
+    BVHAccel::SplitMethod splitMethod;
+    std::vector<std::unique_ptr<Material>> materials;
+    std::vector<std::unique_ptr<MeshTriangle>> meshes;
+};
+
+#endif //RAYTRACING_CORNELLBOX_H
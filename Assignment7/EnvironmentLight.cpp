@@ -0,0 +1,249 @@
+//
+// Image-based lighting from a latitude-longitude HDR environment map.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "global.hpp"
+#include "Reservoir.hpp"
+#include "EnvironmentLight.hpp"
+
+Distribution1D::Distribution1D(const float* f, int n) : func(f, f + n), cdf(n + 1)
+{
+    cdf[0] = 0;
+    for (int i = 0; i < n; ++i)
+        cdf[i + 1] = cdf[i] + func[i] / n;
+    funcInt = cdf[n];
+    // nothing to follow: fall back to a uniform density
+    if (funcInt <= 0) {
+        std::fill(func.begin(), func.end(), 1.f);
+        for (int i = 0; i <= n; ++i)
+            cdf[i] = (float)i / n;
+        funcInt = 1;
+    }
+    else {
+        for (int i = 1; i <= n; ++i)
+            cdf[i] /= funcInt;
+    }
+}
+
+float Distribution1D::sample(float u, float& pdf, int& offset) const
+{
+    int n = func.size();
+    // last bin whose cdf start is <= u, skipping empty bins
+    offset = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin() - 1;
+    offset = std::min(std::max(offset, 0), n - 1);
+    float width = cdf[offset + 1] - cdf[offset];
+    float du = width > 0 ? (u - cdf[offset]) / width : 0.5f;
+    pdf = func[offset] / funcInt;
+    return std::min((offset + du) / n, 0x1.fffffep-1f);
+}
+
+Distribution2D::Distribution2D(const float* f, int nu, int nv)
+{
+    std::vector<float> rows(nv);
+    conditional.reserve(nv);
+    for (int v = 0; v < nv; ++v) {
+        conditional.emplace_back(f + v * nu, nu);
+        rows[v] = conditional.back().funcInt;
+    }
+    marginal = Distribution1D(rows.data(), nv);
+}
+
+Vector2f Distribution2D::sample(const Vector2f& u, float& pdf) const
+{
+    float pdfV, pdfU;
+    int v, iu;
+    float y = marginal.sample(u.y, pdfV, v);
+    float x = conditional[v].sample(u.x, pdfU, iu);
+    pdf = pdfU * pdfV;
+    return Vector2f(x, y);
+}
+
+float Distribution2D::pdf(const Vector2f& p) const
+{
+    int nu = conditional[0].count(), nv = marginal.count();
+    int iu = std::min(std::max(int(p.x * nu), 0), nu - 1);
+    int iv = std::min(std::max(int(p.y * nv), 0), nv - 1);
+    // rows without energy keep a uniform conditional that is never sampled
+    if (marginal.func[iv] <= 0)
+        return 0;
+    return conditional[iv].func[iu] / conditional[iv].funcInt * marginal.func[iv] / marginal.funcInt;
+}
+
+EnvironmentLight::EnvironmentLight(const std::string& filename, float scale)
+{
+    std::string ext = filename.substr(filename.find_last_of('.') + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    bool loaded = ext == "pfm" ? LoadPFM(filename, w, h, image)
+                : ext == "hdr" ? LoadHDR(filename, w, h, image)
+                : false;
+    if (!loaded)
+        throw std::runtime_error("cannot load environment map " + filename);
+    for (Vector3f& c : image)
+        c = Vector3f::Max(c * scale, Vector3f(0));
+
+    // Luminance times each row's share of the sphere, sin(theta) at the
+    // row's middle, so that directions come out proportional to radiance
+    std::vector<float> weights(w * h);
+    for (int y = 0; y < h; ++y) {
+        float sinTheta = std::sin(M_PI * (y + 0.5f) / h);
+        for (int x = 0; x < w; ++x)
+            weights[y * w + x] = luminance(image[y * w + x]) * sinTheta;
+    }
+    distribution = std::make_unique<Distribution2D>(weights.data(), w, h);
+}
+
+Vector3f EnvironmentLight::pixel(const Vector2f& uv) const
+{
+    int x = std::min(std::max(int(uv.x * w), 0), w - 1);
+    int y = std::min(std::max(int(uv.y * h), 0), h - 1);
+    return image[y * w + x];
+}
+
+namespace
+{
+Vector2f directionToLatLong(const Vector3f& dir)
+{
+    float theta = std::acos(std::min(std::max(dir.y, -1.f), 1.f));
+    float phi = std::atan2(dir.z, dir.x);
+    if (phi < 0)
+        phi += 2 * M_PI;
+    return Vector2f(phi / (2 * M_PI), theta / M_PI);
+}
+}
+
+Vector3f EnvironmentLight::Le(const Vector3f& dir) const
+{
+    return pixel(directionToLatLong(dir));
+}
+
+Vector3f EnvironmentLight::sample(const Vector2f& u, float& pdf) const
+{
+    float pdfUV;
+    Vector2f uv = distribution->sample(u, pdfUV);
+    float theta = M_PI * uv.y, phi = 2 * M_PI * uv.x;
+    float sinTheta = std::sin(theta);
+    // the map spans 2 pi by pi radians, and a unit of solid angle covers
+    // 1 / sin(theta) of the map's area
+    pdf = sinTheta > 0 ? pdfUV / (2 * M_PI * M_PI * sinTheta) : 0;
+    return Vector3f(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+}
+
+float EnvironmentLight::pdf(const Vector3f& dir) const
+{
+    Vector2f uv = directionToLatLong(dir);
+    float sinTheta = std::sin(M_PI * uv.y);
+    return sinTheta > 0 ? distribution->pdf(uv) / (2 * M_PI * M_PI * sinTheta) : 0;
+}
+
+// Portable float map: "PF" (RGB) or "Pf" (grey), the size, then a scale
+// whose sign gives the byte order, then rows from the bottom up
+bool LoadPFM(const std::string& filename, int& width, int& height, std::vector<Vector3f>& pixels)
+{
+    std::ifstream in(filename, std::ios::binary);
+    std::string magic;
+    float scale;
+    if (!(in >> magic >> width >> height >> scale) || (magic != "PF" && magic != "Pf") || width <= 0 || height <= 0)
+        return false;
+    in.get(); // the single whitespace before the data
+    int channels = magic == "PF" ? 3 : 1;
+    std::vector<float> data((size_t)width * height * channels);
+    if (!in.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float)))
+        return false;
+
+    const uint16_t probe = 1;
+    bool hostLittle = *reinterpret_cast<const uint8_t*>(&probe) == 1;
+    if ((scale < 0) != hostLittle) {
+        for (float& f : data) {
+            uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) | (bits << 24);
+            std::memcpy(&f, &bits, sizeof(bits));
+        }
+    }
+
+    pixels.resize((size_t)width * height);
+    for (int y = 0; y < height; ++y) {
+        const float* row = &data[(size_t)(height - 1 - y) * width * channels];
+        for (int x = 0; x < width; ++x) {
+            const float* c = row + x * channels;
+            pixels[y * width + x] = channels == 3 ? Vector3f(c[0], c[1], c[2]) : Vector3f(c[0]);
+        }
+    }
+    return true;
+}
+
+// Radiance RGBE: header lines up to a blank line, a "-Y height +X width"
+// resolution line, then scanlines either flat or run-length encoded per
+// channel
+bool LoadHDR(const std::string& filename, int& width, int& height, std::vector<Vector3f>& pixels)
+{
+    std::ifstream in(filename, std::ios::binary);
+    std::string line;
+    if (!std::getline(in, line) || line.compare(0, 2, "#?") != 0)
+        return false;
+    while (std::getline(in, line) && !line.empty()) {
+        if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe")
+            return false;
+    }
+    char ySign, yAxis, xSign, xAxis;
+    if (!std::getline(in, line) ||
+        sscanf(line.c_str(), "%c%c %d %c%c %d", &ySign, &yAxis, &height, &xSign, &xAxis, &width) != 6 ||
+        ySign != '-' || yAxis != 'Y' || xSign != '+' || xAxis != 'X' || width <= 0 || height <= 0)
+        return false;
+
+    pixels.resize((size_t)width * height);
+    std::vector<uint8_t> scanline(width * 4);
+    for (int y = 0; y < height; ++y) {
+        uint8_t head[4];
+        if (!in.read(reinterpret_cast<char*>(head), 4))
+            return false;
+        if (width >= 8 && width < 0x8000 && head[0] == 2 && head[1] == 2 && ((head[2] << 8) | head[3]) == width) {
+            // each channel in turn as runs (count > 128) or literal spans
+            for (int c = 0; c < 4; ++c) {
+                for (int x = 0; x < width;) {
+                    int count = in.get();
+                    if (count == EOF)
+                        return false;
+                    if (count > 128) {
+                        count -= 128;
+                        int value = in.get();
+                        if (value == EOF || x + count > width)
+                            return false;
+                        for (int k = 0; k < count; ++k)
+                            scanline[(x++) * 4 + c] = value;
+                    }
+                    else {
+                        if (count == 0 || x + count > width)
+                            return false;
+                        for (int k = 0; k < count; ++k) {
+                            int value = in.get();
+                            if (value == EOF)
+                                return false;
+                            scanline[(x++) * 4 + c] = value;
+                        }
+                    }
+                }
+            }
+        }
+        else {
+            std::memcpy(scanline.data(), head, 4);
+            if (!in.read(reinterpret_cast<char*>(scanline.data() + 4), (width - 1) * 4))
+                return false;
+        }
+        for (int x = 0; x < width; ++x) {
+            const uint8_t* rgbe = &scanline[x * 4];
+            if (rgbe[3] == 0)
+                continue;
+            float f = std::ldexp(1.f, rgbe[3] - (128 + 8));
+            pixels[y * width + x] = Vector3f((rgbe[0] + 0.5f) * f, (rgbe[1] + 0.5f) * f, (rgbe[2] + 0.5f) * f);
+        }
+    }
+    return true;
+}
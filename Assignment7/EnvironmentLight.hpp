@@ -0,0 +1,77 @@
+//
+// Image-based lighting from a latitude-longitude HDR environment map.
+//
+
+#ifndef RAYTRACING_ENVIRONMENTLIGHT_H
+#define RAYTRACING_ENVIRONMENTLIGHT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "Vector.hpp"
+
+// Piecewise-constant density over [0, 1) proportional to func
+class Distribution1D
+{
+public:
+    Distribution1D() = default;
+    Distribution1D(const float* f, int n);
+
+    // Continuous sample for u; pdf receives the density there and
+    // offset the bin it fell into
+    float sample(float u, float& pdf, int& offset) const;
+    int count() const { return func.size(); }
+
+    std::vector<float> func, cdf;
+    float funcInt = 0;
+};
+
+// Density over [0, 1)^2 proportional to a 2D function: a marginal density
+// of rows, and for each row a conditional density of columns
+class Distribution2D
+{
+public:
+    Distribution2D(const float* f, int nu, int nv);
+
+    Vector2f sample(const Vector2f& u, float& pdf) const;
+    float pdf(const Vector2f& p) const;
+
+private:
+    std::vector<Distribution1D> conditional;
+    Distribution1D marginal;
+};
+
+// Radiance arriving from infinitely far away, stored as a lat-long image
+// with +y up: column u holds phi = 2 pi u around y measured from +x
+// towards +z, row v holds theta = pi v from +y. Directions are sampled
+// proportionally to the luminance of each pixel times its solid angle.
+class EnvironmentLight
+{
+public:
+    // Loads a .pfm or Radiance .hdr file; throws std::runtime_error on
+    // anything it cannot read
+    explicit EnvironmentLight(const std::string& filename, float scale = 1.f);
+
+    // Radiance from direction dir
+    Vector3f Le(const Vector3f& dir) const;
+    // Direction towards the environment for the uniform sample u, with its
+    // solid angle density
+    Vector3f sample(const Vector2f& u, float& pdf) const;
+    float pdf(const Vector3f& dir) const;
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+private:
+    Vector3f pixel(const Vector2f& uv) const;
+
+    int w = 0, h = 0;
+    std::vector<Vector3f> image;
+    std::unique_ptr<Distribution2D> distribution;
+};
+
+// Lat-long images are stored top row first in memory after loading
+bool LoadPFM(const std::string& filename, int& width, int& height, std::vector<Vector3f>& pixels);
+bool LoadHDR(const std::string& filename, int& width, int& height, std::vector<Vector3f>& pixels);
+
+#endif //RAYTRACING_ENVIRONMENTLIGHT_H
@@ -0,0 +1,98 @@
+//
+// Pixel reconstruction filters.
+//
+
+#ifndef RAYTRACING_FILTER_H
+#define RAYTRACING_FILTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "Vector.hpp"
+
+enum class FilterType { Box, Tent, Gaussian };
+
+// Filters are applied by importance sampling: a sample's offset from the
+// pixel centre is drawn with density proportional to the (separable)
+// filter, so every sample of a pixel carries the same weight and the pixel
+// value is their plain average. All filters here are non-negative, which
+// is what makes the weights constant.
+class PixelFilter
+{
+public:
+    PixelFilter(FilterType type = FilterType::Gaussian) : type(type)
+    {
+        switch (type) {
+        case FilterType::Box:
+            radius = 0.5f;
+            break;
+        case FilterType::Tent:
+            radius = 1.f;
+            break;
+        case FilterType::Gaussian:
+        default:
+            // sigma = 0.5, shifted down to reach zero at the radius
+            radius = 1.5f;
+            buildGaussianCdf(0.5f);
+            break;
+        }
+    }
+
+    // Offset from the pixel centre, in pixels, for a uniform sample u
+    Vector2f sample(const Vector2f& u) const { return Vector2f(sample1D(u.x), sample1D(u.y)); }
+
+    FilterType type;
+    float radius;
+
+private:
+    float sample1D(float u) const
+    {
+        switch (type) {
+        case FilterType::Box:
+            return (u - 0.5f) * 2 * radius;
+        case FilterType::Tent:
+            return u < 0.5f ? radius * (std::sqrt(2 * u) - 1) : radius * (1 - std::sqrt(2 - 2 * u));
+        case FilterType::Gaussian:
+        default: {
+            // invert the tabulated CDF, linear inside each bin
+            int bin = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin() - 1;
+            bin = std::min(std::max(bin, 0), (int)cdf.size() - 2);
+            float width = cdf[bin + 1] - cdf[bin];
+            float t = width > 0 ? (u - cdf[bin]) / width : 0.f;
+            return ((bin + t) / (cdf.size() - 1) * 2 - 1) * radius;
+        }
+        }
+    }
+
+    void buildGaussianCdf(float sigma)
+    {
+        const int kBins = 256;
+        auto gaussian = [&](float x) { return std::exp(-x * x / (2 * sigma * sigma)); };
+        float floor = gaussian(radius);
+        cdf.assign(kBins + 1, 0.f);
+        for (int i = 0; i < kBins; ++i) {
+            float x = ((i + 0.5f) / kBins * 2 - 1) * radius;
+            cdf[i + 1] = cdf[i] + std::max(0.f, gaussian(x) - floor);
+        }
+        for (float& c : cdf)
+            c /= cdf[kBins];
+    }
+
+    std::vector<float> cdf;
+};
+
+inline bool ParseFilterType(const std::string& name, FilterType& type)
+{
+    if (name == "box")
+        type = FilterType::Box;
+    else if (name == "tent")
+        type = FilterType::Tent;
+    else if (name == "gaussian")
+        type = FilterType::Gaussian;
+    else
+        return false;
+    return true;
+}
+
+#endif //RAYTRACING_FILTER_H
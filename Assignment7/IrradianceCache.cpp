@@ -0,0 +1,247 @@
+//
+// Irradiance caching with irradiance gradients.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include "global.hpp"
+#include "Scene.hpp"
+#include "IrradianceCache.hpp"
+
+namespace
+{
+const int kMaxDepth = 20;
+
+uint32_t floatBits(float f)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+bool cacheable(const Scene& scene, const Intersection& hit)
+{
+    if (!hit.happened)
+        return false;
+    const PackedMaterial& m = scene.materials.of(hit);
+    return !m.emissive && m.type == DIFFUSE;
+}
+}
+
+IrradianceCache::IrradianceCache(const Scene& scene, const Bounds3& sceneBounds) : scene(scene)
+{
+    Vector3f d = sceneBounds.Diagonal();
+    sceneSize = std::max(d.x, std::max(d.y, d.z));
+    centre = sceneBounds.Centroid();
+    halfSize = 0.5f * sceneSize * 1.01f + 1e-3f;
+}
+
+size_t IrradianceCache::size() const
+{
+    std::shared_lock<std::shared_mutex> guard(lock);
+    return count;
+}
+
+IrradianceCache::Record IrradianceCache::compute(const Vector3f& p, const Vector3f& n) const
+{
+    const int M = thetaSamples, N = phiSamples;
+    Record rec;
+    rec.position = p;
+    rec.normal = n;
+    ShadingFrame frame(n);
+    const Vector3f &s = frame.s, &t = frame.t;
+
+    // the record's random numbers depend only on where it is
+    uint32_t seed = floatBits(p.x) * 0x9e3779b9u ^ floatBits(p.y) * 0x85ebca6bu ^ floatBits(p.z) * 0xc2b2ae35u;
+    RNG rng(seed);
+    auto sampler = CreateSampler(SamplerType::Independent, M * N, seed);
+
+    // cosine-weighted rays, stratified in (sin^2 theta, phi)
+    std::vector<Vector3f> L(M * N);
+    std::vector<float> r(M * N);
+    float invDistanceSum = 0;
+    for (int j = 0; j < M; ++j) {
+        for (int k = 0; k < N; ++k) {
+            float u = (j + rng.uniform()) / M;
+            float phi = 2 * M_PI * (k + rng.uniform()) / N;
+            float sinTheta = std::sqrt(u), cosTheta = std::sqrt(1 - u);
+            Vector3f dir = s * (sinTheta * std::cos(phi)) + t * (sinTheta * std::sin(phi)) + n * cosTheta;
+
+            int i = j * N + k;
+            Intersection hit = scene.intersect(Ray(p, dir));
+            r[i] = hit.happened ? (float)hit.distance : std::numeric_limits<float>::infinity();
+            if (hit.happened)
+                invDistanceSum += 1 / std::max(r[i], 1e-4f);
+            // emitters are left to direct lighting
+            if (hit.happened && !scene.materials.of(hit).emissive) {
+                sampler->startPixelSample(0, 0, i);
+                L[i] = scene.shade(hit, -dir, 1, *sampler);
+            }
+            rec.E += L[i];
+
+            // turning n towards this ray gains tan(theta) L per radian
+            Vector3f v = s * -std::sin(phi) + t * std::cos(phi);
+            float tanTheta = sinTheta / std::max(cosTheta, 1e-4f);
+            for (int c = 0; c < 3; ++c)
+                rec.rotGrad[c] += v * (tanTheta * L[i][c]);
+        }
+    }
+    float norm = M_PI / (M * N);
+    rec.E = rec.E * norm;
+    for (int c = 0; c < 3; ++c)
+        rec.rotGrad[c] = rec.rotGrad[c] * norm;
+
+    // Translational gradient: how the cells' solid angles and the light
+    // through their boundaries change as p moves, with the distance to
+    // the nearer of the two cells sharing a boundary
+    auto inverseMin = [](float a, float b) { return 1 / std::max(std::min(a, b), 1e-4f); };
+    for (int k = 0; k < N; ++k) {
+        float phi = 2 * M_PI * (k + 0.5f) / N;
+        float phiMinus = 2 * M_PI * k / N;
+        Vector3f u = s * std::cos(phi) + t * std::sin(phi);
+        Vector3f vMinus = s * -std::sin(phiMinus) + t * std::cos(phiMinus);
+        int kPrev = (k + N - 1) % N;
+        for (int j = 0; j < M; ++j) {
+            int i = j * N + k;
+            float sin2Minus = (float)j / M;
+            if (j > 0) {
+                float coef = 2 * M_PI / N * std::sqrt(sin2Minus) * (1 - sin2Minus) *
+                             inverseMin(r[i], r[i - N]);
+                for (int c = 0; c < 3; ++c)
+                    rec.transGrad[c] += u * (coef * (L[i][c] - L[i - N][c]));
+            }
+            float coef = (std::sqrt((j + 1.f) / M) - std::sqrt(sin2Minus)) * inverseMin(r[i], r[j * N + kPrev]);
+            for (int c = 0; c < 3; ++c)
+                rec.transGrad[c] += vMinus * (coef * (L[i][c] - L[j * N + kPrev][c]));
+        }
+    }
+
+    // Validity radius: the harmonic mean distance, no more than the
+    // distance over which the gradient would change E by itself, within the
+    // spacing limits. A record held apart by the lower limit gets its
+    // gradient scaled down to match.
+    float R = invDistanceSum > 0 ? M * N / invDistanceSum : maxSpacing * sceneSize;
+    Vector3f lumGrad = rec.transGrad[0] * 0.2126f + rec.transGrad[1] * 0.7152f + rec.transGrad[2] * 0.0722f;
+    float gradNorm = lumGrad.norm();
+    if (gradNorm > 0)
+        R = std::min(R, luminance(rec.E) / gradNorm);
+    float minR = minSpacing * sceneSize;
+    if (R < minR) {
+        for (int c = 0; c < 3; ++c)
+            rec.transGrad[c] = rec.transGrad[c] * (R / minR);
+        R = minR;
+    }
+    rec.R = std::min(R, maxSpacing * sceneSize);
+    return rec;
+}
+
+bool IrradianceCache::interpolate(const Vector3f& p, const Vector3f& n, Vector3f& E) const
+{
+    std::shared_lock<std::shared_mutex> guard(lock);
+    Vector3f sum;
+    float weightSum = 0;
+
+    struct Item
+    {
+        const Node* node;
+        Vector3f centre;
+        float half;
+    };
+    std::vector<Item> stack{{&root, centre, halfSize}};
+    while (!stack.empty()) {
+        Item item = stack.back();
+        stack.pop_back();
+        for (const Record& rec : item.node->records) {
+            Vector3f d = p - rec.position;
+            float error = d.norm() / rec.R + std::sqrt(std::max(0.f, 1 - dotProduct(n, rec.normal)));
+            if (error >= errorBound)
+                continue;
+            // skip records in front of p, which see light p does not
+            if (dotProduct(d, n + rec.normal) < -0.1f * rec.R)
+                continue;
+            // fades to zero at the bound, so coverage changes continuously
+            float w = 1 / std::max(error, 1e-6f) - 1 / errorBound;
+            Vector3f rotation = crossProduct(rec.normal, n);
+            Vector3f change(dotProduct(rotation, rec.rotGrad[0]) + dotProduct(d, rec.transGrad[0]),
+                            dotProduct(rotation, rec.rotGrad[1]) + dotProduct(d, rec.transGrad[1]),
+                            dotProduct(rotation, rec.rotGrad[2]) + dotProduct(d, rec.transGrad[2]));
+            sum += (rec.E + change) * w;
+            weightSum += w;
+        }
+        // a child's records reach at most half its size past its bounds
+        float half = item.half * 0.5f;
+        for (int c = 0; c < 8; ++c) {
+            const Node* child = item.node->child[c].get();
+            if (!child)
+                continue;
+            Vector3f cc = item.centre + Vector3f(c & 1 ? half : -half, c & 2 ? half : -half, c & 4 ? half : -half);
+            Vector3f o = p - cc;
+            if (std::max(std::fabs(o.x), std::max(std::fabs(o.y), std::fabs(o.z))) <= 2 * half)
+                stack.push_back({child, cc, half});
+        }
+    }
+    if (weightSum <= 0)
+        return false;
+    E = Vector3f::Max(sum / weightSum, Vector3f(0));
+    return true;
+}
+
+void IrradianceCache::insert(const Record& record)
+{
+    std::unique_lock<std::shared_mutex> guard(lock);
+    // the deepest node whose extended cube contains the record's sphere
+    float radius = errorBound * record.R;
+    Node* node = &root;
+    Vector3f c = centre;
+    float half = halfSize;
+    for (int depth = 0; depth < kMaxDepth && radius <= half * 0.5f; ++depth) {
+        half *= 0.5f;
+        int octant = (record.position.x > c.x) | (record.position.y > c.y) << 1 | (record.position.z > c.z) << 2;
+        c = c + Vector3f(octant & 1 ? half : -half, octant & 2 ? half : -half, octant & 4 ? half : -half);
+        if (!node->child[octant])
+            node->child[octant] = std::make_unique<Node>();
+        node = node->child[octant].get();
+    }
+    node->records.push_back(record);
+    ++count;
+}
+
+Vector3f IrradianceCache::irradiance(const Intersection& hit)
+{
+    Vector3f E;
+    if (interpolate(hit.coords, hit.normal, E))
+        return E;
+    Record rec = compute(hit.coords, hit.normal);
+    insert(rec);
+    return rec.E;
+}
+
+void IrradianceCache::populate(const std::vector<Intersection>& gbuffer, int width, int height)
+{
+    for (int stride = 16; stride >= 1; stride /= 2) {
+        std::vector<int> pixels;
+        for (int y = 0; y < height; y += stride)
+            for (int x = 0; x < width; x += stride)
+                if (cacheable(scene, gbuffer[y * width + x]))
+                    pixels.push_back(y * width + x);
+
+        std::vector<Record> candidates(pixels.size());
+        std::vector<char> computed(pixels.size(), 0);
+        parallelFor(0, pixels.size(), [&](int i) {
+            const Intersection& hit = gbuffer[pixels[i]];
+            Vector3f E;
+            if (!interpolate(hit.coords, hit.normal, E)) {
+                candidates[i] = compute(hit.coords, hit.normal);
+                computed[i] = 1;
+            }
+        }, 1);
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            Vector3f E;
+            if (computed[i] && !interpolate(candidates[i].position, candidates[i].normal, E))
+                insert(candidates[i]);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+//
+// Irradiance caching (Ward et al. 1988) with irradiance gradients (Ward and
+// Heckbert 1992) for the indirect light on diffuse surfaces.
+//
+
+#ifndef RAYTRACING_IRRADIANCECACHE_H
+#define RAYTRACING_IRRADIANCECACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+#include "Vector.hpp"
+#include "Bounds3.hpp"
+#include "Intersection.hpp"
+
+class Scene;
+
+// Sparse records of indirect irradiance, each valid over a neighbourhood
+// sized by the distance to the surrounding geometry, interpolated in
+// between. Direct light is not cached; it is still sampled per path.
+//
+// A record i is used at (p, n) only while its error estimate
+//     e_i = |p - p_i| / R_i + sqrt(1 - n . n_i)
+// stays below errorBound, where R_i is the harmonic mean distance of the
+// record's rays. Under Ward's split-sphere model this bounds the relative
+// error of every interpolated value by errorBound; where no record
+// qualifies, a new one is computed, so lookups never extrapolate.
+//
+// Records live in an octree behind a readers-writer lock, so lookups may
+// run concurrently with each other and with insertions.
+class IrradianceCache
+{
+public:
+    IrradianceCache(const Scene& scene, const Bounds3& sceneBounds);
+
+    // Make sure every diffuse hit of a frame of primary hits is covered.
+    // Pixels are visited coarse to fine; records for one level are computed
+    // in parallel and then inserted in pixel order, skipping those already
+    // covered by an earlier one, so the result does not depend on timing.
+    void populate(const std::vector<Intersection>& gbuffer, int width, int height);
+
+    // Indirect irradiance arriving at hit
+    Vector3f irradiance(const Intersection& hit);
+
+    size_t size() const;
+
+    float errorBound = 0.25f;
+    // Hemisphere rays per record, stratified in cos^2 theta and phi
+    int thetaSamples = 12;
+    int phiSamples = 36;
+    // Clamp on the record radius R_i, as fractions of the scene size
+    float minSpacing = 0.02f;
+    float maxSpacing = 0.5f;
+
+private:
+    struct Record
+    {
+        Vector3f position, normal;
+        Vector3f E;
+        float R = 0;
+        // rotational and translational gradient of each colour channel
+        Vector3f rotGrad[3], transGrad[3];
+    };
+    struct Node
+    {
+        std::vector<Record> records;
+        std::unique_ptr<Node> child[8];
+    };
+
+    // Weighted sum of the records usable at (p, n); false if there are none
+    bool interpolate(const Vector3f& p, const Vector3f& n, Vector3f& E) const;
+    Record compute(const Vector3f& p, const Vector3f& n) const;
+    void insert(const Record& record);
+
+    const Scene& scene;
+    Vector3f centre;
+    float halfSize;
+    float sceneSize;
+    Node root;
+    size_t count = 0;
+    mutable std::shared_mutex lock;
+};
+
+#endif //RAYTRACING_IRRADIANCECACHE_H
@@ -7,7 +7,13 @@
 
 #include "Vector.hpp"
 
-enum MaterialType { DIFFUSE};
+// DIFFUSE is Lambertian with albedo Kd. CONDUCTOR and DIELECTRIC are rough
+// GGX surfaces (see Microfacet.hpp): a metal reflecting Ks at normal
+// incidence, and glass of refractive index ior, which is seen from both
+// sides of its triangles.
+enum MaterialType { DIFFUSE, CONDUCTOR, DIELECTRIC };
+
+class MaterialTable;
 
 class Material{
 private:
@@ -89,10 +95,16 @@ public:
     MaterialType m_type;
     //Vector3f m_color;
     Vector3f m_emission;
-    float ior;
+    float ior = 1.5f;
     Vector3f Kd, Ks;
+    // GGX alpha of CONDUCTOR and DIELECTRIC
+    float roughness = 0.2f;
     float specularExponent;
     //Texture tex;
+    // entry in the scene's MaterialTable, -1 until the scene is built, and
+    // the table it belongs to
+    int id = -1;
+    const MaterialTable* table = nullptr;
 
     inline Material(MaterialType t=DIFFUSE, Vector3f e=Vector3f(0,0,0));
     inline MaterialType getType();
@@ -101,8 +113,10 @@ public:
     inline Vector3f getEmission();
     inline bool hasEmission();
 
-    // sample a ray by Material properties
-    inline Vector3f sample(const Vector3f &wi, const Vector3f &N);
+    // These three cover DIFFUSE only; the renderer shades every type
+    // through the scene's MaterialTable.
+    // sample a ray by Material properties from the uniform 2D sample u
+    inline Vector3f sample(const Vector3f &wi, const Vector3f &N, const Vector2f &u);
     // given a ray, calculate the PdF of this ray
     inline float pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N);
     // given a ray, calculate the contribution of this ray
@@ -129,12 +143,12 @@ Vector3f Material::getColorAt(double u, double v) {
 }
 
 
-Vector3f Material::sample(const Vector3f &wi, const Vector3f &N){
+Vector3f Material::sample(const Vector3f &wi, const Vector3f &N, const Vector2f &u){
     switch(m_type){
         case DIFFUSE:
         {
             // uniform sample on the hemisphere
-            float x_1 = get_random_float(), x_2 = get_random_float();
+            float x_1 = u.x, x_2 = u.y;
             float z = std::fabs(1.0f - 2.0f * x_1);
             float r = std::sqrt(1.0f - z * z), phi = 2 * M_PI * x_2;
             Vector3f localRay(r*std::cos(phi), r*std::sin(phi), z);
@@ -142,7 +156,10 @@ Vector3f Material::sample(const Vector3f &wi, const Vector3f &N){
             
             break;
         }
+        default:
+            break;
     }
+    return N;
 }
 
 float Material::pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
@@ -156,7 +173,10 @@ float Material::pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
                 return 0.0f;
             break;
         }
+        default:
+            break;
     }
+    return 0.0f;
 }
 
 Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
@@ -173,7 +193,10 @@ Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &
                 return Vector3f(0.0f);
             break;
         }
+        default:
+            break;
     }
+    return Vector3f(0.0f);
 }
 
 #endif //RAYTRACING_MATERIAL_H
@@ -0,0 +1,178 @@
+//
+// Flat, precomputed copy of the scene's materials for the shading loop.
+//
+
+#ifndef RAYTRACING_MATERIALTABLE_H
+#define RAYTRACING_MATERIALTABLE_H
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include "Vector.hpp"
+#include "Material.hpp"
+#include "Intersection.hpp"
+#include "Microfacet.hpp"
+
+// Orthonormal frame around a shading normal, built once per hit and shared
+// by every BSDF query there. Same tangents as Material::toWorld.
+struct ShadingFrame
+{
+    Vector3f s, t, n;
+
+    explicit ShadingFrame(const Vector3f& N) : n(N)
+    {
+        if (std::fabs(N.x) > std::fabs(N.y)) {
+            float invLen = 1.0f / std::sqrt(N.x * N.x + N.z * N.z);
+            t = Vector3f(N.z * invLen, 0.0f, -N.x * invLen);
+        }
+        else {
+            float invLen = 1.0f / std::sqrt(N.y * N.y + N.z * N.z);
+            t = Vector3f(0.0f, N.z * invLen, -N.y * invLen);
+        }
+        s = crossProduct(t, N);
+    }
+
+    Vector3f toWorld(const Vector3f& a) const { return a.x * s + a.y * t + a.z * n; }
+    Vector3f toLocal(const Vector3f& v) const
+    {
+        return Vector3f(dotProduct(v, s), dotProduct(v, t), dotProduct(v, n));
+    }
+};
+
+// What shading needs of a Material, with everything that depends only on
+// the material worked out in advance
+struct PackedMaterial
+{
+    MaterialType type = DIFFUSE;
+    bool emissive = false;
+    Vector3f emission;
+    Vector3f diffuse; // Kd / pi
+    // GGX types: roughness (kept off zero, where the lobes become deltas),
+    // the conductor's reflectance at normal incidence and the dielectric's
+    // IOR
+    float alpha = 1;
+    Vector3f specular;
+    float eta = 1;
+};
+
+// Materials by id. Scene::buildBVH() fills it from the scene's objects and
+// writes each material's id back into it, so a hit finds its entry with a
+// single index; materials edited after that are not seen by the renderer.
+// Since the id lives in the Material, a Material belongs to one table at a
+// time: add() asserts it is in no other, and clear() releases them all.
+//
+// The BSDF functions dispatch on the packed type; wo points towards the
+// viewer and wi towards the light. eval is the BSDF alone, without the
+// cosine, and for dielectrics is non-zero on both sides of the surface.
+// The batched eval dispatches once for a whole set of directions at one
+// hit.
+class MaterialTable
+{
+public:
+    // id of m, adding it on first sight
+    int add(Material* m)
+    {
+        assert((!m->table || m->table == this) && "a Material can only be in one scene's MaterialTable");
+        if (m->table == this && m->id < (int)materials.size() && sources[m->id] == m)
+            return m->id;
+        PackedMaterial p;
+        p.type = m->getType();
+        p.emission = m->getEmission();
+        p.emissive = m->hasEmission();
+        p.diffuse = m->Kd / M_PI;
+        p.alpha = std::max(m->roughness, 1e-3f);
+        p.specular = m->Ks;
+        p.eta = m->ior;
+        m->id = materials.size();
+        m->table = this;
+        materials.push_back(p);
+        sources.push_back(m);
+        return m->id;
+    }
+    void clear()
+    {
+        for (Material* m : sources)
+            m->id = -1, m->table = nullptr;
+        materials.clear();
+        sources.clear();
+    }
+
+    const PackedMaterial& operator[](int id) const { return materials[id]; }
+    const PackedMaterial& of(const Intersection& hit) const { return materials[hit.m->id]; }
+    size_t size() const { return materials.size(); }
+
+    static Vector3f eval(const PackedMaterial& m, const ShadingFrame& frame, const Vector3f& wo,
+                         const Vector3f& wi)
+    {
+        switch (m.type) {
+            case DIFFUSE:
+                return dotProduct(frame.n, wi) > 0.0f ? m.diffuse : Vector3f(0.0f);
+            case CONDUCTOR:
+                return conductorEval(GGX(m.alpha), m.specular, frame.toLocal(wo), frame.toLocal(wi));
+            case DIELECTRIC:
+                return Vector3f(dielectricEval(GGX(m.alpha), m.eta, frame.toLocal(wo), frame.toLocal(wi)));
+        }
+        return Vector3f(0.0f);
+    }
+
+    static void eval(const PackedMaterial& m, const ShadingFrame& frame, const Vector3f& wo,
+                     const Vector3f* wi, int count, Vector3f* f)
+    {
+        switch (m.type) {
+            case DIFFUSE:
+                for (int i = 0; i < count; ++i)
+                    f[i] = dotProduct(frame.n, wi[i]) > 0.0f ? m.diffuse : Vector3f(0.0f);
+                return;
+            case CONDUCTOR:
+            case DIELECTRIC:
+            {
+                Vector3f woLocal = frame.toLocal(wo);
+                GGX ggx(m.alpha);
+                for (int i = 0; i < count; ++i)
+                    f[i] = m.type == CONDUCTOR ? conductorEval(ggx, m.specular, woLocal, frame.toLocal(wi[i]))
+                                               : Vector3f(dielectricEval(ggx, m.eta, woLocal, frame.toLocal(wi[i])));
+                return;
+            }
+        }
+    }
+
+    static float pdf(const PackedMaterial& m, const ShadingFrame& frame, const Vector3f& wo, const Vector3f& wi)
+    {
+        switch (m.type) {
+            case DIFFUSE:
+                // uniform over the hemisphere
+                return dotProduct(wi, frame.n) > 0.0f ? 0.5f / M_PI : 0.0f;
+            case CONDUCTOR:
+                return conductorPdf(GGX(m.alpha), frame.toLocal(wo), frame.toLocal(wi));
+            case DIELECTRIC:
+                return dielectricPdf(GGX(m.alpha), m.eta, frame.toLocal(wo), frame.toLocal(wi));
+        }
+        return 0.0f;
+    }
+
+    // Direction for the uniform sample u; the dielectric picks reflection
+    // or refraction with the further uniform sample uLobe
+    static Vector3f sample(const PackedMaterial& m, const ShadingFrame& frame, const Vector3f& wo,
+                           const Vector2f& u, float uLobe)
+    {
+        switch (m.type) {
+            case DIFFUSE:
+            {
+                float z = std::fabs(1.0f - 2.0f * u.x);
+                float r = std::sqrt(1.0f - z * z), phi = 2 * M_PI * u.y;
+                return frame.toWorld(Vector3f(r * std::cos(phi), r * std::sin(phi), z));
+            }
+            case CONDUCTOR:
+                return frame.toWorld(conductorSample(GGX(m.alpha), frame.toLocal(wo), u));
+            case DIELECTRIC:
+                return frame.toWorld(dielectricSample(GGX(m.alpha), m.eta, frame.toLocal(wo), u, uLobe));
+        }
+        return frame.n;
+    }
+
+private:
+    std::vector<PackedMaterial> materials;
+    std::vector<Material*> sources;
+};
+
+#endif //RAYTRACING_MATERIALTABLE_H
@@ -0,0 +1,206 @@
+//
+// GGX microfacet distribution and the rough conductor and dielectric BSDFs
+// built on it. Everything here works in a local shading frame with the
+// macro normal along +z; wo points towards the viewer and wi towards the
+// light.
+//
+
+#ifndef RAYTRACING_MICROFACET_H
+#define RAYTRACING_MICROFACET_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Vector.hpp"
+#include "global.hpp"
+
+// Fresnel reflectance of a dielectric for light meeting it at cosine cosI
+// (> 0), with eta the IOR across the interface over the IOR on this side
+inline float fresnelDielectric(float cosI, float eta)
+{
+    float sin2T = (1 - cosI * cosI) / (eta * eta);
+    if (sin2T >= 1)
+        return 1; // total internal reflection
+    float cosT = std::sqrt(1 - sin2T);
+    float rs = (cosI - eta * cosT) / (cosI + eta * cosT);
+    float rp = (eta * cosI - cosT) / (eta * cosI + cosT);
+    return (rs * rs + rp * rp) / 2;
+}
+
+// Schlick's approximation from the reflectance F0 at normal incidence
+inline Vector3f fresnelSchlick(const Vector3f& F0, float cosI)
+{
+    float c = 1 - std::max(0.f, cosI), c2 = c * c;
+    return F0 + (Vector3f(1.0f) - F0) * (c2 * c2 * c);
+}
+
+// Isotropic GGX (Trowbridge-Reitz) distribution of microfacet normals with
+// roughness alpha, and Smith's height-correlated masking-shadowing
+struct GGX
+{
+    float alpha;
+
+    explicit GGX(float alpha) : alpha(alpha) {}
+
+    // Density of microfacet normal m per unit macro-surface area
+    float D(const Vector3f& m) const
+    {
+        if (m.z <= 0)
+            return 0;
+        float a2 = alpha * alpha, d = m.z * m.z * (a2 - 1) + 1;
+        return a2 / (M_PI * d * d);
+    }
+
+    float Lambda(const Vector3f& w) const
+    {
+        float cos2 = w.z * w.z;
+        if (cos2 == 0)
+            return std::numeric_limits<float>::infinity();
+        float tan2 = std::max(0.f, 1 - cos2) / cos2;
+        return (std::sqrt(1 + alpha * alpha * tan2) - 1) / 2;
+    }
+    float G1(const Vector3f& w) const { return 1 / (1 + Lambda(w)); }
+    float G2(const Vector3f& wo, const Vector3f& wi) const { return 1 / (1 + Lambda(wo) + Lambda(wi)); }
+
+    // Normal visible from wo (wo.z > 0) for the uniform sample u, drawn in
+    // proportion to its area projected towards wo (Heitz 2018)
+    Vector3f sampleVisible(const Vector3f& wo, const Vector2f& u) const
+    {
+        // stretch to the hemisphere configuration, sample the projected
+        // disk there, and unstretch
+        Vector3f vh = normalize(Vector3f(alpha * wo.x, alpha * wo.y, wo.z));
+        float lensq = vh.x * vh.x + vh.y * vh.y;
+        Vector3f t1 = lensq > 0 ? Vector3f(-vh.y, vh.x, 0) / std::sqrt(lensq) : Vector3f(1, 0, 0);
+        Vector3f t2 = crossProduct(vh, t1);
+        float r = std::sqrt(u.x), phi = 2 * M_PI * u.y;
+        float p1 = r * std::cos(phi), p2 = r * std::sin(phi);
+        float s = 0.5f * (1 + vh.z);
+        p2 = (1 - s) * std::sqrt(std::max(0.f, 1 - p1 * p1)) + s * p2;
+        Vector3f nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.f, 1 - p1 * p1 - p2 * p2)) * vh;
+        return normalize(Vector3f(alpha * nh.x, alpha * nh.y, std::max(1e-6f, nh.z)));
+    }
+
+    // Density of sampleVisible drawing m
+    float pdfVisible(const Vector3f& wo, const Vector3f& m) const
+    {
+        float cosO = dotProduct(wo, m);
+        return cosO > 0 && wo.z > 0 ? G1(wo) * cosO * D(m) / wo.z : 0;
+    }
+};
+
+// Rough conductor with reflectance F0 at normal incidence, reflecting on
+// the side the normal points to only
+
+inline Vector3f conductorEval(const GGX& ggx, const Vector3f& F0, const Vector3f& wo, const Vector3f& wi)
+{
+    if (wo.z <= 0 || wi.z <= 0)
+        return Vector3f(0.0f);
+    Vector3f m = normalize(wo + wi);
+    return fresnelSchlick(F0, dotProduct(wo, m)) * (ggx.D(m) * ggx.G2(wo, wi) / (4 * wo.z * wi.z));
+}
+
+inline float conductorPdf(const GGX& ggx, const Vector3f& wo, const Vector3f& wi)
+{
+    if (wo.z <= 0 || wi.z <= 0)
+        return 0;
+    Vector3f m = normalize(wo + wi);
+    return ggx.pdfVisible(wo, m) / (4 * dotProduct(wo, m));
+}
+
+// Mirror wo in a visible normal; may point below the surface, where the
+// pdf is 0
+inline Vector3f conductorSample(const GGX& ggx, const Vector3f& wo, const Vector2f& u)
+{
+    if (wo.z <= 0)
+        return Vector3f(0, 0, 1);
+    Vector3f m = ggx.sampleVisible(wo, u);
+    return 2 * dotProduct(wo, m) * m - wo;
+}
+
+// Rough dielectric (Walter et al. 2007) between the outside, where the
+// normal points, and an inside with eta times the outside's IOR. It is
+// seen from either side. A visible normal is drawn from wo's side, then
+// reflection or refraction through it with the Fresnel term's odds.
+//
+// Transmission is in pbrt's radiance mode: over the squared denominator
+// (cosO + etaO * cosI)^2 it lacks Walter's etaO^2 factor, so transmitted
+// radiance is scaled by 1 / etaO^2 across the interface, as paths traced
+// from the camera need.
+
+namespace microfacet_detail
+{
+// Half vector of a reflected or refracted pair, facing +z, with the IOR
+// ratio across the interface seen from wo's side; false if no microfacet
+// normal connects them
+inline bool dielectricHalfVector(float eta, const Vector3f& wo, const Vector3f& wi, Vector3f& m, float& etaO)
+{
+    if (wo.z == 0 || wi.z == 0)
+        return false;
+    etaO = wo.z > 0 ? eta : 1 / eta;
+    bool reflect = wo.z * wi.z > 0;
+    m = reflect ? wo + wi : wo + wi * etaO;
+    if (dotProduct(m, m) == 0)
+        return false;
+    m = normalize(m);
+    if (m.z < 0)
+        m = -m;
+    // the microfacet has to face each direction from the side the macro
+    // surface does
+    return dotProduct(wo, m) * wo.z > 0 && dotProduct(wi, m) * wi.z > 0;
+}
+}
+
+inline float dielectricEval(const GGX& ggx, float eta, const Vector3f& wo, const Vector3f& wi)
+{
+    Vector3f m;
+    float etaO;
+    if (!microfacet_detail::dielectricHalfVector(eta, wo, wi, m, etaO))
+        return 0;
+    float cosO = dotProduct(wo, m), cosI = dotProduct(wi, m);
+    float F = fresnelDielectric(std::abs(cosO), etaO);
+    float DG = ggx.D(m) * ggx.G2(wo, wi);
+    if (wo.z * wi.z > 0)
+        return F * DG / (4 * std::abs(wo.z * wi.z));
+    float denom = cosO + etaO * cosI;
+    return (1 - F) * std::abs(DG * cosO * cosI / (wo.z * wi.z * denom * denom));
+}
+
+inline float dielectricPdf(const GGX& ggx, float eta, const Vector3f& wo, const Vector3f& wi)
+{
+    Vector3f m;
+    float etaO;
+    if (!microfacet_detail::dielectricHalfVector(eta, wo, wi, m, etaO))
+        return 0;
+    float cosO = dotProduct(wo, m), cosI = dotProduct(wi, m);
+    float F = fresnelDielectric(std::abs(cosO), etaO);
+    float pm = ggx.pdfVisible(wo.z > 0 ? wo : -wo, m);
+    if (wo.z * wi.z > 0)
+        return F * pm / (4 * std::abs(cosO));
+    float denom = cosO + etaO * cosI;
+    return (1 - F) * pm * std::abs(etaO * etaO * cosI) / (denom * denom);
+}
+
+// u draws the visible normal and uLobe picks reflection or refraction. A
+// direction that ends up on the wrong side of the macro surface for its
+// lobe is returned in the tangent plane, where the pdf is 0.
+inline Vector3f dielectricSample(const GGX& ggx, float eta, const Vector3f& wo, const Vector2f& u, float uLobe)
+{
+    float side = wo.z > 0 ? 1.f : -1.f;
+    float etaO = wo.z > 0 ? eta : 1 / eta;
+    Vector3f woUp = wo * side;
+    Vector3f m = ggx.sampleVisible(woUp, u);
+    float cosO = dotProduct(woUp, m);
+    bool reflect = uLobe < fresnelDielectric(cosO, etaO);
+    Vector3f wi;
+    if (reflect)
+        wi = 2 * cosO * m - woUp;
+    else {
+        float cosT = std::sqrt(std::max(0.f, 1 - (1 - cosO * cosO) / (etaO * etaO)));
+        wi = -woUp / etaO + (cosO / etaO - cosT) * m;
+    }
+    if (reflect != (wi.z > 0))
+        return Vector3f(1, 0, 0);
+    return wi * side;
+}
+
+#endif //RAYTRACING_MICROFACET_H
@@ -10,6 +10,17 @@
 #include "Bounds3.hpp"
 #include "Ray.hpp"
 #include "Intersection.hpp"
+#include <vector>
+
+class Object;
+
+// One triangle of an object, as the rasterizer draws it
+struct ObjectTriangle
+{
+    Vector3f v0, v1, v2, normal;
+    Object* obj; // the triangle as an object of its own, for hits on it
+    Material* m;
+};
 
 class Object
 {
@@ -22,9 +33,25 @@ public:
     virtual void getSurfaceProperties(const Vector3f &, const Vector3f &, const uint32_t &, const Vector2f &, Vector3f &, Vector2f &) const = 0;
     virtual Vector3f evalDiffuseColor(const Vector2f &) const =0;
     virtual Bounds3 getBounds()=0;
+    // Bounds of the part of the object inside box, used by the spatial-split
+    // BVH builder. The default clips the bounding box, which is conservative.
+    virtual Bounds3 getClippedBounds(const Bounds3& box)
+    {
+        Bounds3 b = getBounds(), ret;
+        ret.pMin = Vector3f::Max(b.pMin, box.pMin);
+        ret.pMax = Vector3f::Min(b.pMax, box.pMax);
+        return ret;
+    }
     virtual float getArea()=0;
-    virtual void Sample(Intersection &pos, float &pdf)=0;
+    // Sample a point on the surface with pdf measured in area. uSelect picks
+    // the primitive of aggregate objects, u places the point on it.
+    virtual void Sample(Intersection &pos, float &pdf, float uSelect, const Vector2f &u)=0;
     virtual bool hasEmit()=0;
+    // Material of the whole object, or nullptr for objects without one
+    virtual Material* getMaterial() { return nullptr; }
+    // Append the triangles the object is made of to the vector; false for
+    // objects that are not made of triangles
+    virtual bool getTriangles(std::vector<ObjectTriangle>&) { return false; }
 };
 
 
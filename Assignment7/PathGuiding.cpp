@@ -0,0 +1,253 @@
+//
+// Path guiding with a learned spatial-directional radiance distribution.
+//
+
+#include <algorithm>
+#include <cmath>
+#include "global.hpp"
+#include "PathGuiding.hpp"
+
+namespace
+{
+// Equal-area cylindrical mapping between directions and [0, 1]^2
+Vector2f directionToSquare(const Vector3f& dir)
+{
+    float cosTheta = std::min(std::max(dir.z, -1.f), 1.f);
+    float phi = std::atan2(dir.y, dir.x);
+    if (phi < 0)
+        phi += 2 * M_PI;
+    return Vector2f(std::min((cosTheta + 1) * 0.5f, 0x1.fffffep-1f),
+                    std::min(phi / (2 * M_PI), 0x1.fffffep-1f));
+}
+
+Vector3f squareToDirection(const Vector2f& p)
+{
+    float cosTheta = 2 * p.x - 1;
+    float sinTheta = std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta));
+    float phi = 2 * M_PI * p.y;
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+}
+
+// Quadrant of p (x selects bit 0, y bit 1) and p rescaled to it
+int DTree::quadrant(Vector2f& p)
+{
+    int q = 0;
+    if (p.x >= 0.5f) {
+        q |= 1;
+        p.x -= 0.5f;
+    }
+    if (p.y >= 0.5f) {
+        q |= 2;
+        p.y -= 0.5f;
+    }
+    p = p * 2;
+    return q;
+}
+
+float DTree::energy(uint32_t node) const
+{
+    const Node& n = nodes[node];
+    return n.sum[0] + n.sum[1] + n.sum[2] + n.sum[3];
+}
+
+float DTree::total() const
+{
+    return energy(0);
+}
+
+void DTree::record(const Vector3f& dir, float value)
+{
+    if (!(value > 0) || !std::isfinite(value))
+        return;
+    Vector2f p = directionToSquare(dir);
+    uint32_t node = 0;
+    while (true) {
+        int q = quadrant(p);
+        nodes[node].sum[q] += value;
+        if (!nodes[node].child[q])
+            return;
+        node = nodes[node].child[q];
+    }
+}
+
+Vector3f DTree::sample(Vector2f u) const
+{
+    Vector2f origin(0, 0);
+    float size = 1;
+    uint32_t node = 0;
+    while (true) {
+        const Node& n = nodes[node];
+        float left = n.sum[0] + n.sum[2], right = n.sum[1] + n.sum[3];
+        if (left + right <= 0)
+            break;
+        // pick the column by u.x, then the quadrant inside it by u.y, and
+        // stretch each coordinate back to [0, 1)
+        int q = 0;
+        float pLeft = left / (left + right);
+        if (u.x < pLeft) {
+            u.x /= pLeft;
+        }
+        else {
+            q |= 1;
+            u.x = (u.x - pLeft) / (1 - pLeft);
+        }
+        float bottom = n.sum[q], top = n.sum[q | 2];
+        float pBottom = bottom / (bottom + top);
+        if (u.y < pBottom) {
+            u.y /= pBottom;
+        }
+        else {
+            q |= 2;
+            u.y = (u.y - pBottom) / (1 - pBottom);
+        }
+        u = Vector2f(std::min(u.x, 0x1.fffffep-1f), std::min(u.y, 0x1.fffffep-1f));
+        size *= 0.5f;
+        origin = origin + Vector2f(q & 1 ? size : 0, q & 2 ? size : 0);
+        if (!n.child[q])
+            break;
+        node = n.child[q];
+    }
+    return squareToDirection(origin + u * size);
+}
+
+float DTree::pdf(const Vector3f& dir) const
+{
+    // density over the square, then over the sphere whose area is 4 pi
+    Vector2f p = directionToSquare(dir);
+    float density = 1;
+    uint32_t node = 0;
+    while (true) {
+        float e = energy(node);
+        if (e <= 0)
+            break;
+        int q = quadrant(p);
+        density *= 4 * nodes[node].sum[q] / e;
+        if (!nodes[node].child[q])
+            break;
+        node = nodes[node].child[q];
+    }
+    return density / (4 * M_PI);
+}
+
+void DTree::refine(float threshold, int maxDepth)
+{
+    std::vector<Node> old;
+    old.swap(nodes);
+    nodes.assign(1, Node());
+    float totalEnergy = old[0].sum[0] + old[0].sum[1] + old[0].sum[2] + old[0].sum[3];
+    if (totalEnergy <= 0)
+        return;
+
+    // Quadrants past the old leaves have no energy of their own and are
+    // given an even share of their parent's.
+    struct Item
+    {
+        uint32_t node;
+        int oldNode; // -1 past the old leaves
+        float energy;
+        int depth;
+    };
+    std::vector<Item> stack{{0, 0, totalEnergy, 1}};
+    while (!stack.empty()) {
+        Item item = stack.back();
+        stack.pop_back();
+        if (item.depth >= maxDepth)
+            continue;
+        for (int q = 0; q < 4; ++q) {
+            float e = item.oldNode >= 0 ? old[item.oldNode].sum[q] : item.energy / 4;
+            if (e / totalEnergy <= threshold)
+                continue;
+            uint32_t child = nodes.size();
+            nodes.emplace_back();
+            nodes[item.node].child[q] = child;
+            int oldChild = item.oldNode >= 0 && old[item.oldNode].child[q] ? old[item.oldNode].child[q] : -1;
+            stack.push_back({child, oldChild, e, item.depth + 1});
+        }
+    }
+}
+
+PathGuide::PathGuide(const Bounds3& sceneBounds) : nodes(1), leaves(1)
+{
+    // a cube slightly larger than the scene
+    Vector3f centre = sceneBounds.Centroid();
+    Vector3f d = sceneBounds.Diagonal();
+    float half = 0.5f * std::max(d.x, std::max(d.y, d.z)) * 1.01f + 1e-3f;
+    bounds = Bounds3(centre - Vector3f(half), centre + Vector3f(half));
+    nodes[0].leaf = 0;
+}
+
+const PathGuide::Leaf& PathGuide::lookup(const Vector3f& p, Vector3f* size) const
+{
+    Vector3f lo = bounds.pMin, hi = bounds.pMax;
+    uint32_t node = 0;
+    int axis = 0;
+    while (nodes[node].leaf < 0) {
+        float mid = 0.5f * (lo[axis] + hi[axis]);
+        if (p[axis] < mid) {
+            hi[axis] = mid;
+            node = nodes[node].child[0];
+        }
+        else {
+            lo[axis] = mid;
+            node = nodes[node].child[1];
+        }
+        axis = (axis + 1) % 3;
+    }
+    if (size)
+        *size = hi - lo;
+    return leaves[nodes[node].leaf];
+}
+
+void PathGuide::record(const Vector3f& p, const Vector3f& dir, float value)
+{
+    std::lock_guard<std::mutex> guard(recordLock);
+    Vector3f size;
+    lookup(p, &size);
+    Vector3f jitter(rng.uniform() - 0.5f, rng.uniform() - 0.5f, rng.uniform() - 0.5f);
+    Leaf& leaf = lookup(Vector3f::Min(Vector3f::Max(p + jitter * size, bounds.pMin), bounds.pMax));
+    ++leaf.records;
+    leaf.building.record(dir, value);
+}
+
+// Halve node's cell, each half starting from a copy of its distributions
+// with half its records, until no part has more than threshold records
+void PathGuide::split(uint32_t node, float threshold)
+{
+    int leaf = nodes[node].leaf;
+    if (leaves[leaf].records <= threshold)
+        return;
+    leaves[leaf].records /= 2;
+    int sibling = leaves.size();
+    leaves.push_back(leaves[leaf]);
+
+    uint32_t first = nodes.size();
+    nodes.resize(first + 2);
+    nodes[first].leaf = leaf;
+    nodes[first + 1].leaf = sibling;
+    nodes[node].child[0] = first;
+    nodes[node].child[1] = first + 1;
+    nodes[node].leaf = -1;
+
+    split(first, threshold);
+    split(first + 1, threshold);
+}
+
+void PathGuide::update()
+{
+    float threshold = spatialThreshold * std::sqrt(std::pow(2.f, (float)iteration));
+    for (uint32_t n = 0, count = nodes.size(); n < count; ++n) {
+        if (nodes[n].leaf >= 0)
+            split(n, threshold);
+    }
+
+    directionalNodeCount = 0;
+    for (Leaf& leaf : leaves) {
+        leaf.sampling = leaf.building;
+        leaf.trained = leaf.records;
+        leaf.building.refine(directionalThreshold, maxDirectionalDepth);
+        leaf.records = 0;
+        directionalNodeCount += leaf.building.nodeCount();
+    }
+    ++iteration;
+}
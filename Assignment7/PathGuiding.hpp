@@ -0,0 +1,129 @@
+//
+// Path guiding with a learned spatial-directional radiance distribution
+// (SD-tree): a binary tree over the scene whose leaves each hold a
+// quadtree over directions.
+//
+
+#ifndef RAYTRACING_PATHGUIDING_H
+#define RAYTRACING_PATHGUIDING_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "Vector.hpp"
+#include "Bounds3.hpp"
+#include "Sampler.hpp"
+
+// Distribution over the sphere of directions, stored as a quadtree over the
+// square [0, 1]^2 that directions map to with the equal-area cylindrical
+// mapping (cos theta, phi). Each node keeps the energy recorded in its four
+// quadrants; sampling walks down choosing quadrants by energy.
+class DTree
+{
+public:
+    DTree() : nodes(1) {}
+
+    void record(const Vector3f& dir, float value);
+    // Direction for the uniform sample u and its solid angle density
+    Vector3f sample(Vector2f u) const;
+    float pdf(const Vector3f& dir) const;
+
+    // Rebuild the structure around the recorded energy: quadrants holding
+    // more than threshold of the total are subdivided, the rest collapse
+    // into leaves. Energies are cleared.
+    void refine(float threshold, int maxDepth);
+
+    float total() const;
+    int nodeCount() const { return nodes.size(); }
+
+private:
+    // child index 0 marks a leaf quadrant; the root is never a child
+    struct Node
+    {
+        float sum[4] = {0, 0, 0, 0};
+        uint32_t child[4] = {0, 0, 0, 0};
+    };
+
+    static int quadrant(Vector2f& p);
+    float energy(uint32_t node) const;
+
+    std::vector<Node> nodes;
+};
+
+// Spatial binary tree. Cells are split at the middle along x, y and z in
+// turn; the root is a cube around the scene, so cells stay close to cubes.
+// Every leaf holds the distribution learned in the previous iteration
+// (sampling) and the one being recorded in this iteration (building).
+class PathGuide
+{
+public:
+    PathGuide(const Bounds3& sceneBounds);
+
+    // Learned distribution of directions towards incident light at p, or
+    // nullptr where too few paths passed in training to trust it
+    const DTree* distribution(const Vector3f& p) const
+    {
+        const Leaf& leaf = lookup(p);
+        return leaf.trained >= minRecords ? &leaf.sampling : nullptr;
+    }
+
+    // Radiance estimate arriving at p from dir, already divided by the
+    // density the direction was sampled with. The record lands at a point
+    // jittered by up to half a cell around p, so that neighbouring cells
+    // share what they learn. Safe to call from several threads.
+    void record(const Vector3f& p, const Vector3f& dir, float value);
+
+    // End a training iteration: split spatial cells that received many
+    // records, make what was recorded the sampling distribution and refine
+    // the directional trees for the next iteration.
+    void update();
+
+    // Training iterations completed, and the spatial cells and directional
+    // tree nodes the last one left
+    int iterations() const { return iteration; }
+    size_t cells() const { return leaves.size(); }
+    int directionalNodes() const { return directionalNodeCount; }
+
+    // Chance of sampling the guide instead of the BSDF at each bounce
+    float guideFraction = 0.5f;
+    // A cell is split once it gets more than spatialThreshold * sqrt(2^k)
+    // records in iteration k, whose sample count is proportional to 2^k
+    float spatialThreshold = 12000;
+    float directionalThreshold = 0.01f;
+    int maxDirectionalDepth = 20;
+    int minRecords = 256;
+
+    // Records are only taken while training
+    bool training = true;
+
+private:
+    struct Node
+    {
+        uint32_t child[2] = {0, 0}; // 0 for a leaf
+        int leaf = -1;
+    };
+    struct Leaf
+    {
+        DTree sampling, building;
+        int records = 0;
+        int trained = 0; // records that went into sampling
+    };
+
+    // Leaf whose cell holds p; size receives the cell's extent
+    const Leaf& lookup(const Vector3f& p, Vector3f* size = nullptr) const;
+    Leaf& lookup(const Vector3f& p, Vector3f* size = nullptr)
+    {
+        return const_cast<Leaf&>(static_cast<const PathGuide*>(this)->lookup(p, size));
+    }
+    void split(uint32_t node, float threshold);
+
+    Bounds3 bounds;
+    std::vector<Node> nodes;
+    std::vector<Leaf> leaves;
+    int iteration = 0;
+    int directionalNodeCount = 0;
+    RNG rng;
+    std::mutex recordLock;
+};
+
+#endif //RAYTRACING_PATHGUIDING_H
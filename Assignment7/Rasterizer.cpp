@@ -0,0 +1,134 @@
+//
+// Primary visibility by rasterization, for the hybrid render mode.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Rasterizer.hpp"
+#include "Scene.hpp"
+
+namespace
+{
+// Screen-space setup of one triangle
+struct Projected
+{
+    float x[3], y[3];
+    float area;         // twice the signed projected area
+    int x0, x1, y0, y1; // pixels whose sample positions may fall inside
+    bool visible;
+    bool clipped;       // reaches behind the camera: covered by ray tests
+};
+
+// vertices nearer than this in front of the eye are not projected
+const float kNear = 1e-3f;
+
+bool covers(const Projected& t, const Vector2f& s)
+{
+    for (int i = 0; i < 3; ++i) {
+        int j = (i + 1) % 3;
+        float e = (t.x[j] - t.x[i]) * (s.y - t.y[i]) - (t.y[j] - t.y[i]) * (s.x - t.x[i]);
+        if (e * t.area < 0)
+            return false;
+    }
+    return true;
+}
+}
+
+Rasterizer::Rasterizer(const Scene& scene)
+{
+    for (Object* object : scene.get_objects())
+        complete = object->getTriangles(triangles) && complete;
+}
+
+void Rasterizer::render(const Camera& camera, const std::vector<Vector2f>& samples,
+                        std::vector<Intersection>& gbuffer) const
+{
+    int w = camera.width, h = camera.height;
+    std::vector<Vector3f> dirs(w * h);
+    parallelFor(0, w * h, [&](int p) {
+        dirs[p] = camera.direction(samples[p].x, samples[p].y);
+    });
+    // how far the sample positions stray from their pixels' centres
+    float reach = 0;
+    for (int p = 0; p < w * h; ++p)
+        reach = std::max({reach, std::abs(samples[p].x - (p % w + 0.5f)), std::abs(samples[p].y - (p / w + 0.5f))});
+
+    std::vector<Projected> projected(triangles.size());
+    parallelFor(0, (int)triangles.size(), [&](int k) {
+        const ObjectTriangle& t = triangles[k];
+        Projected& pr = projected[k];
+        // Rays only hit front faces, dielectrics aside, and rays from one
+        // eye see a triangle's front everywhere or nowhere
+        pr.visible = dotProduct(t.v0 - camera.eye, t.normal) < 0 || (t.m && t.m->m_type == DIELECTRIC);
+        if (!pr.visible)
+            return;
+        const Vector3f* v[3] = {&t.v0, &t.v1, &t.v2};
+        int behind = 0;
+        for (int i = 0; i < 3; ++i) {
+            if (dotProduct(*v[i] - camera.eye, camera.forward) < kNear || !camera.project(*v[i], pr.x[i], pr.y[i]))
+                ++behind;
+        }
+        pr.clipped = behind > 0;
+        if (behind == 3) {
+            pr.visible = false;
+            return;
+        }
+        if (pr.clipped) {
+            pr.x0 = 0, pr.x1 = w - 1, pr.y0 = 0, pr.y1 = h - 1;
+            return;
+        }
+        pr.area = (pr.x[1] - pr.x[0]) * (pr.y[2] - pr.y[0]) - (pr.y[1] - pr.y[0]) * (pr.x[2] - pr.x[0]);
+        pr.visible = pr.area != 0;
+        // pixel i's sample lies within reach of i + 0.5
+        pr.x0 = std::max(0, (int)std::ceil(std::min({pr.x[0], pr.x[1], pr.x[2]}) - 0.5f - reach));
+        pr.x1 = std::min(w - 1, (int)std::floor(std::max({pr.x[0], pr.x[1], pr.x[2]}) - 0.5f + reach));
+        pr.y0 = std::max(0, (int)std::ceil(std::min({pr.y[0], pr.y[1], pr.y[2]}) - 0.5f - reach));
+        pr.y1 = std::min(h - 1, (int)std::floor(std::max({pr.y[0], pr.y[1], pr.y[2]}) - 0.5f + reach));
+    }, 256);
+
+    std::vector<float> depth(w * h, std::numeric_limits<float>::infinity());
+    std::fill(gbuffer.begin(), gbuffer.end(), Intersection());
+    int bands = (h + kBandHeight - 1) / kBandHeight;
+    parallelFor(0, bands, [&](int band) {
+        int rowBegin = band * kBandHeight, rowEnd = std::min(h, rowBegin + kBandHeight) - 1;
+        for (size_t k = 0; k < triangles.size(); ++k) {
+            const Projected& pr = projected[k];
+            if (!pr.visible || pr.y1 < rowBegin || pr.y0 > rowEnd)
+                continue;
+            const ObjectTriangle& t = triangles[k];
+            float plane = dotProduct(t.v0 - camera.eye, t.normal);
+            for (int j = std::max(pr.y0, rowBegin); j <= std::min(pr.y1, rowEnd); ++j) {
+                for (int i = pr.x0; i <= pr.x1; ++i) {
+                    int p = j * w + i;
+                    float distance;
+                    if (pr.clipped) {
+                        Intersection hit = t.obj->getIntersection(Ray(camera.eye, dirs[p]));
+                        if (!hit.happened)
+                            continue;
+                        distance = hit.distance;
+                    }
+                    else {
+                        float cosine = dotProduct(dirs[p], t.normal);
+                        if (!covers(pr, samples[p]) || cosine == 0)
+                            continue;
+                        // plane and cosine share their sign on the side seen
+                        distance = plane / cosine;
+                        if (distance <= 0)
+                            continue;
+                    }
+                    if (distance >= depth[p])
+                        continue;
+                    depth[p] = distance;
+                    Intersection& hit = gbuffer[p];
+                    hit.happened = true;
+                    hit.coords = camera.eye + dirs[p] * distance;
+                    hit.distance = distance;
+                    hit.normal = t.normal;
+                    hit.obj = t.obj;
+                    hit.m = t.m;
+                }
+            }
+        }
+    }, 1);
+}
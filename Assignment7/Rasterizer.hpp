@@ -0,0 +1,48 @@
+//
+// Primary visibility by rasterization, for the hybrid render mode.
+//
+
+#ifndef RAYTRACING_RASTERIZER_H
+#define RAYTRACING_RASTERIZER_H
+
+#include <vector>
+#include "Vector.hpp"
+#include "global.hpp"
+#include "Intersection.hpp"
+#include "Object.hpp"
+#include "Camera.hpp"
+
+class Scene;
+
+// Finds the first hit of every camera ray by drawing the scene's triangles
+// into a depth buffer, the way Assignment 3's rst::rasterizer does, instead
+// of tracing the rays through the BVH. Each pixel has one sample position,
+// anywhere in its filter footprint. A triangle covers the pixel when that
+// position falls inside its projected edges. The hit is then placed on the
+// triangle's plane along the sample's camera ray, so the G-buffer holds the
+// same position, normal, material and depth as a traced hit would.
+//
+// The image is drawn in bands of rows, one per task, and each band walks the
+// triangles whose bounds reach it. A band owns its pixels and needs no locks.
+class Rasterizer
+{
+public:
+    explicit Rasterizer(const Scene& scene);
+
+    // False if the scene has objects other than triangles and triangle
+    // meshes; their first hits have to be traced
+    bool supported() const { return complete; }
+
+    // Fill gbuffer with the first hit seen through samples[p], the image
+    // position (in pixels) of pixel p's camera ray
+    void render(const Camera& camera, const std::vector<Vector2f>& samples, std::vector<Intersection>& gbuffer) const;
+
+    // Rows drawn by one task
+    static constexpr int kBandHeight = 16;
+
+private:
+    std::vector<ObjectTriangle> triangles;
+    bool complete = true;
+};
+
+#endif //RAYTRACING_RASTERIZER_H
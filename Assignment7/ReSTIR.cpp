@@ -0,0 +1,135 @@
+//
+// Reservoir-based importance resampling with spatial reuse (ReSTIR) of
+// direct light at primary hits.
+//
+
+#include <algorithm>
+#include <cmath>
+#include "ReSTIR.hpp"
+
+namespace {
+
+const int kMaxNeighbours = 32;
+
+bool shadeable(const Scene& scene, const Intersection& hit)
+{
+    return hit.happened && !scene.materials.of(hit).emissive;
+}
+
+} // namespace
+
+ReSTIR::ReSTIR(const Scene& scene, int width, int height, uint32_t seed)
+    : scene(scene), width(width), height(height), seed(seed),
+      reservoirs(width * height), directLight(width * height)
+{
+}
+
+bool ReSTIR::similar(const Intersection& a, const Intersection& b) const
+{
+    return dotProduct(a.normal, b.normal) > normalThreshold &&
+           std::abs(a.distance - b.distance) < depthThreshold * a.distance;
+}
+
+void ReSTIR::run(const std::vector<Intersection>& gbuffer, const std::vector<Vector3f>& wo, uint32_t frame)
+{
+    int n = width * height;
+    uint64_t frameSeed = (uint64_t(seed) << 32) | frame;
+
+    // 1. initial candidates, then visibility of the kept one
+    parallelFor(0, n, [&](int p) {
+        Reservoir r;
+        const Intersection& hit = gbuffer[p];
+        if (shadeable(scene, hit)) {
+            RNG rng(frameSeed, 2 * p);
+            for (int c0 = 0; c0 < initialCandidates; c0 += Scene::kLightBatch) {
+                int count = std::min(Scene::kLightBatch, initialCandidates - c0);
+                LightSample x[Scene::kLightBatch];
+                float uPick[Scene::kLightBatch], target[Scene::kLightBatch];
+                for (int i = 0; i < count; ++i) {
+                    x[i] = scene.sampleLight(rng.uniform(), Vector2f(rng.uniform(), rng.uniform()));
+                    uPick[i] = rng.uniform();
+                }
+                scene.unshadowedTargets(hit, wo[p], x, count, target);
+                for (int i = 0; i < count; ++i)
+                    r.update(x[i], x[i].pdf > 0 ? target[i] / x[i].pdf : 0, uPick[i]);
+            }
+            r.finalize(luminance(scene.unshadowedLight(hit, wo[p], r.y)));
+            if (r.W > 0 && !scene.visible(hit, r.y.position))
+                r.W = 0;
+        }
+        reservoirs[p] = r;
+    });
+
+    // 2. spatial reuse
+    parallelFor(0, n, [&](int p) {
+        directLight[p] = Vector3f();
+        const Intersection& hit = gbuffer[p];
+        if (!shadeable(scene, hit))
+            return;
+
+        RNG rng(frameSeed, 2 * p + 1);
+        int x = p % width, y = p / width;
+        int sources[kMaxNeighbours + 1];
+        int count = 0;
+        sources[count++] = p;
+        for (int k = 0; k < std::min(spatialNeighbours, kMaxNeighbours); ++k) {
+            float radius = spatialRadius * std::sqrt(rng.uniform());
+            float phi = 2 * M_PI * rng.uniform();
+            int qx = x + (int)std::lround(radius * std::cos(phi));
+            int qy = y + (int)std::lround(radius * std::sin(phi));
+            if (qx < 0 || qx >= width || qy < 0 || qy >= height)
+                continue;
+            int q = qy * width + qx;
+            if (q == p || !shadeable(scene, gbuffer[q]) || !similar(hit, gbuffer[q]))
+                continue;
+            sources[count++] = q;
+        }
+
+        // resample the neighbours' kept samples by their target here
+        Reservoir s;
+        int M = 0;
+        for (int i = 0; i < count; ++i) {
+            const Reservoir& r = reservoirs[sources[i]];
+            float target = luminance(scene.unshadowedLight(hit, wo[p], r.y));
+            s.update(r.y, target * r.W * r.M, rng.uniform());
+            M += r.M;
+        }
+        s.M = M;
+        if (s.wSum <= 0)
+            return;
+
+        // Z: candidates of the reservoirs that could have produced s.y
+        int Z = 0;
+        bool visibleHere = false;
+        for (int i = 0; i < count; ++i) {
+            int q = sources[i];
+            if (luminance(scene.unshadowedLight(gbuffer[q], wo[q], s.y)) <= 0)
+                continue;
+            bool vis = scene.visible(gbuffer[q], s.y.position);
+            if (q == p)
+                visibleHere = vis;
+            if (vis)
+                Z += reservoirs[q].M;
+        }
+        if (!visibleHere)
+            return;
+
+        Vector3f L = scene.unshadowedLight(hit, wo[p], s.y);
+        float target = luminance(L);
+        s.W = Z > 0 && target > 0 ? s.wSum / (Z * target) : 0;
+        directLight[p] = L * s.W;
+    });
+}
+
+bool ParseDirectLightingMode(const std::string& name, DirectLightingMode& mode)
+{
+    if (name == "area")
+        mode = DirectLightingMode::Area;
+    else if (name == "ris")
+        mode = DirectLightingMode::RIS;
+    else if (name == "restir")
+        mode = DirectLightingMode::ReSTIR;
+    else
+        return false;
+    return true;
+}
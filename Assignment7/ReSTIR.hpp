@@ -0,0 +1,53 @@
+//
+// Reservoir-based importance resampling with spatial reuse (ReSTIR) of
+// direct light at primary hits.
+//
+
+#ifndef RAYTRACING_RESTIR_H
+#define RAYTRACING_RESTIR_H
+
+#include <string>
+#include <vector>
+#include "Scene.hpp"
+#include "Reservoir.hpp"
+
+// Direct light for a full frame of primary hits, in two passes:
+//  1. every pixel resamples initialCandidates area light samples by their
+//     unshadowed contribution into a reservoir, then shadow-tests the kept
+//     sample and zeroes the reservoir if it is occluded;
+//  2. every pixel merges its reservoir with those of spatialNeighbours
+//     nearby pixels whose surface is similar. The result is normalised
+//     only by the candidates that could have produced the chosen sample
+//     (target > 0 and unoccluded at their own hit point), which removes
+//     the bias that plain reuse across different surfaces introduces.
+class ReSTIR
+{
+public:
+    ReSTIR(const Scene& scene, int width, int height, uint32_t seed = 0);
+
+    // Build the reservoirs for one frame of primary hits; wo holds the
+    // direction back to the camera for each pixel
+    void run(const std::vector<Intersection>& gbuffer, const std::vector<Vector3f>& wo, uint32_t frame);
+
+    // Direct light at each pixel's primary hit after the last run
+    const Vector3f& direct(int pixel) const { return directLight[pixel]; }
+
+    int initialCandidates = 32;
+    int spatialNeighbours = 5;
+    float spatialRadius = 30;   // pixels
+    float normalThreshold = 0.9f;
+    float depthThreshold = 0.1f; // relative
+
+private:
+    bool similar(const Intersection& a, const Intersection& b) const;
+
+    const Scene& scene;
+    int width, height;
+    uint32_t seed;
+    std::vector<Reservoir> reservoirs;
+    std::vector<Vector3f> directLight;
+};
+
+bool ParseDirectLightingMode(const std::string& name, DirectLightingMode& mode);
+
+#endif //RAYTRACING_RESTIR_H
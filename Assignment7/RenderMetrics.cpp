@@ -0,0 +1,135 @@
+//
+// Live progress and throughput of a render, for people and for schedulers.
+//
+
+#ifdef _WIN32
+#include <io.h>
+#define dup _dup
+#define fdopen _fdopen
+#else
+#include <unistd.h>
+#endif
+#include "global.hpp"
+#include "RenderMetrics.hpp"
+
+namespace
+{
+double seconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+// 1234567 -> "1.23M"
+std::string shortNumber(double x)
+{
+    const char* suffix[] = {"", "k", "M", "G", "T"};
+    int k = 0;
+    for (; x >= 1000 && k < 4; ++k)
+        x /= 1000;
+    char text[32];
+    snprintf(text, sizeof(text), "%.3g%s", x, suffix[k]);
+    return text;
+}
+
+std::string jsonString(const std::string& s)
+{
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\', out += c;
+        else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        }
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+}
+
+RenderMetrics::RenderMetrics(std::string name, uint64_t total, const std::string& sinkName, bool console,
+                             double interval)
+    : name(std::move(name)), total(total), console(console), interval(interval)
+{
+    if (!sinkName.empty()) {
+        // the caller keeps its descriptor; closing the sink closes a copy
+        int fd = -1;
+        if (sinkName.compare(0, 3, "fd:") == 0 && sscanf(sinkName.c_str() + 3, "%d", &fd) == 1)
+            sink = (fd = dup(fd)) >= 0 ? fdopen(fd, "a") : nullptr;
+        else
+            sink = fopen(sinkName.c_str(), "a");
+        sinkOk = sink != nullptr;
+    }
+    if (sink || console)
+        reporter = std::thread([this]() { report(); });
+}
+
+void RenderMetrics::finish()
+{
+    if (!reporter.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finishing = true;
+    }
+    wake.notify_one();
+    reporter.join();
+    if (sink)
+        fclose(sink);
+    sink = nullptr;
+}
+
+void RenderMetrics::report()
+{
+    uint64_t lastSamples = 0, lastRays = 0;
+    auto last = start;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        bool done = wake.wait_for(guard, std::chrono::duration<double>(interval), [this]() { return finishing; });
+        uint64_t samples = 0, rays = 0;
+        for (const Slot& s : slots) {
+            samples += s.samples.load(std::memory_order_relaxed);
+            rays += s.rays.load(std::memory_order_relaxed);
+        }
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = seconds(now - start);
+        if (done) {
+            // the whole render's rates
+            write(samples, rays, elapsed, samples / elapsed, rays / elapsed, true);
+            return;
+        }
+        double dt = seconds(now - last);
+        write(samples, rays, elapsed, (samples - lastSamples) / dt, (rays - lastRays) / dt, false);
+        lastSamples = samples, lastRays = rays, last = now;
+    }
+}
+
+void RenderMetrics::write(uint64_t samples, uint64_t rays, double elapsed, double samplesPerSec, double raysPerSec,
+                          bool done)
+{
+    float progress = total ? std::min(1.0, samples / (double)total) : 1.0;
+    // unknown until some samples are done
+    double eta = done ? 0 : samples ? elapsed * (total - std::min(samples, total)) / samples : -1;
+
+    if (sink) {
+        char etaText[32] = "null";
+        if (eta >= 0)
+            snprintf(etaText, sizeof(etaText), "%.2f", eta);
+        fprintf(sink,
+                "{\"output\":%s,\"elapsed\":%.3f,\"samples\":%llu,\"total\":%llu,\"rays\":%llu,"
+                "\"progress\":%.4f,\"samples_per_sec\":%.4g,\"rays_per_sec\":%.4g,\"eta\":%s,\"done\":%s}\n",
+                jsonString(name).c_str(), elapsed, (unsigned long long)samples, (unsigned long long)total,
+                (unsigned long long)rays, progress, samplesPerSec, raysPerSec, etaText, done ? "true" : "false");
+        fflush(sink);
+    }
+    if (console) {
+        std::string status = shortNumber(samplesPerSec) + " samples/s " + shortNumber(raysPerSec) + " rays/s";
+        if (eta >= 0)
+            status += " ETA " + std::to_string((int)std::ceil(eta)) + " s";
+        UpdateProgress(progress, status);
+        if (done)
+            std::cout << "\n";
+    }
+}
@@ -0,0 +1,107 @@
+//
+// Live progress and throughput of a render, for people and for schedulers.
+//
+
+#ifndef RAYTRACING_RENDERMETRICS_H
+#define RAYTRACING_RENDERMETRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Counts the samples (paths) and rays of one render, and reports them from
+// a thread of its own every interval seconds: as a progress bar with
+// samples/s, rays/s and the time left on stdout, and as one JSON object
+// per line to a sink, a file appended to or fd:<n>, that a job scheduler
+// can follow:
+//
+//   {"output":"binary.ppm","elapsed":2.004,"samples":3932160,"total":9834496,
+//    "rays":19672410,"progress":0.3998,"samples_per_sec":1.95e+06,
+//    "rays_per_sec":9.81e+06,"eta":3.01,"done":false}
+//
+// Rates are over the last interval and the time left is from the rate so
+// far. The last line, "done":true, has the rates of the whole render.
+//
+// Every thread counts into a slot of its own, a cache line each, with
+// relaxed atomic adds: counting takes no lock and shares no line. The
+// reporter only reads the slots. Rays are counted by Scene::intersect for
+// the render current() on the tracing thread; parallelFor passes it on to
+// the helpers that run its chunks, so concurrent renders count apart.
+class RenderMetrics
+{
+public:
+    // Report a render of total samples named name (its output) to sink,
+    // "" for none, and to stdout if console
+    RenderMetrics(std::string name, uint64_t total, const std::string& sink, bool console, double interval = 1);
+    ~RenderMetrics() { finish(); }
+    RenderMetrics(const RenderMetrics&) = delete;
+    RenderMetrics& operator=(const RenderMetrics&) = delete;
+
+    // False if the sink could not be opened
+    bool ok() const { return sinkOk; }
+
+    void addSamples(uint64_t n) { slot().samples.fetch_add(n, std::memory_order_relaxed); }
+    void addRays(uint64_t n) { slot().rays.fetch_add(n, std::memory_order_relaxed); }
+
+    // Stop the reporter after a last report of the whole render
+    void finish();
+
+    // The render that rays traced on this thread count towards, if any
+    static RenderMetrics*& current()
+    {
+        thread_local RenderMetrics* metrics = nullptr;
+        return metrics;
+    }
+
+    // Makes a render current() on this thread for the scope's lifetime
+    class Scope
+    {
+    public:
+        explicit Scope(RenderMetrics* metrics) : saved(current()) { current() = metrics; }
+        ~Scope() { current() = saved; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        RenderMetrics* saved;
+    };
+
+private:
+    // threads beyond this many share slots, which stays correct
+    static constexpr int kSlots = 64;
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> samples{0};
+        std::atomic<uint64_t> rays{0};
+    };
+    Slot& slot()
+    {
+        static std::atomic<int> threads{0};
+        thread_local int index = threads++ % kSlots;
+        return slots[index];
+    }
+
+    void report();
+    void write(uint64_t samples, uint64_t rays, double elapsed, double samplesPerSec, double raysPerSec, bool done);
+
+    Slot slots[kSlots];
+    std::string name;
+    uint64_t total;
+    bool console;
+    double interval;
+    FILE* sink = nullptr;
+    bool sinkOk = true;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::thread reporter;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool finishing = false;
+};
+
+#endif //RAYTRACING_RENDERMETRICS_H
@@ -0,0 +1,532 @@
+//
+// Long-running render server. Scenes are loaded and their BVHs and
+// material tables built once, then any number of render jobs run against
+// them, so turntables and batches pay for scene setup a single time.
+//
+// One command per line, read from stdin or, with --socket <path>, from
+// every connection to that Unix socket (not on Windows). Replies go back the same way, one
+// line each:
+//
+//   load <scene> [dir=<models dir>] [lighting=area|ris|restir] [guided]
+//        [cache] [env=<.pfm|.hdr>] [bvh=naive|lbvh|sbvh]
+//                                             -> ok loaded <scene> <ms> ms
+//   render <scene> [key=value ...]            -> queued <job>
+//                                                ... done <job> <out> <ms> ms
+//   turntable <scene> frames=<n> [key=value ...]
+//        n jobs with the eye orbiting the look-at point about +y, written
+//        to out with the frame number before the extension
+//   sequence <scene> frames=<n> [orbit=<degrees>] [reuse=0|1] [key=value ...]
+//        one job rendering the frames of an orbit of the given total angle
+//        (default 360) in order, each reusing the radiance of the ones
+//        before it unless reuse=0; frame f uses seed + f
+//                                             -> frame <job> <out> <ms> ms, per frame
+//   unload <scene>                            -> ok unloaded <scene>
+//   wait                                      -> ok idle, once no job is left
+//   quit                                      -> ok bye, after the last job
+//
+// Render keys: out, width, height, spp, primary, sampler, filter, seed,
+// fov, eye=x,y,z, at=x,y,z, raster=0|1 (rasterized first hits),
+// metrics=<file> (JSON progress lines appended, see RenderMetrics.hpp) and
+// priority. Jobs run on the shared thread
+// pool, higher priorities first. Jobs on one scene run concurrently unless
+// the scene is guided: the guide learns from every render, so those take
+// turns.
+//
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "Renderer.hpp"
+#include "Scene.hpp"
+#include "CornellBox.hpp"
+#include "TemporalReuse.hpp"
+#include "global.hpp"
+
+namespace
+{
+
+struct LoadedScene
+{
+    LoadedScene(const std::string& modelDir, BVHAccel::SplitMethod splitMethod)
+        : box(modelDir, splitMethod), scene(784, 784)
+    {
+        box.addTo(scene);
+        scene.splitMethod = splitMethod;
+        scene.buildBVH();
+    }
+
+    CornellBox box;
+    Scene scene;
+    std::mutex guideLock;
+};
+
+// Where replies to a command go: stdout, or a socket connection. The
+// client owns the connection's descriptor, so it stays open for the replies
+// of queued jobs after the peer stops sending, and closes with the last one.
+class Client
+{
+public:
+    explicit Client(int fd = -1) : fd(fd) {}
+    ~Client()
+    {
+#ifndef _WIN32
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    void reply(const std::string& line)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (fd < 0) {
+            std::cout << line << std::endl;
+            return;
+        }
+#ifndef _WIN32
+        std::string data = line + "\n";
+        for (size_t sent = 0; sent < data.size();) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return;
+            sent += n;
+        }
+#endif
+    }
+
+#ifndef _WIN32
+    int descriptor() const { return fd; }
+    // Wakes a recv() blocked on the connection
+    void hangUp() { shutdown(fd, SHUT_RDWR); }
+#endif
+
+private:
+    int fd;
+    std::mutex lock;
+};
+
+bool parseVector(const std::string& text, Vector3f& v)
+{
+    char tail;
+    return sscanf(text.c_str(), "%f,%f,%f%c", &v.x, &v.y, &v.z, &tail) == 3;
+}
+
+bool parseInt(const std::string& text, int& value)
+{
+    char tail;
+    return sscanf(text.c_str(), "%d%c", &value, &tail) == 1;
+}
+
+class RenderServer
+{
+public:
+    // Run one command line; false once it asks the server to quit
+    bool execute(const std::string& line, const std::shared_ptr<Client>& client);
+    void waitIdle()
+    {
+        std::unique_lock<std::mutex> guard(jobsLock);
+        idle.wait(guard, [this]() { return pending == 0; });
+    }
+
+private:
+    struct Job
+    {
+        int id;
+        int priority = 0;
+        std::shared_ptr<LoadedScene> scene;
+        Renderer renderer;
+        // a sequence job renders frames frames along an orbit
+        int frames = 0;
+        float orbit = 360;
+        bool reuse = true;
+    };
+
+    void load(const std::string& name, const std::vector<std::string>& args, Client& client);
+    // Renderer settings from key=value arguments
+    bool configure(const std::vector<std::string>& args, Job& job, std::string& error) const;
+    void submit(std::unique_ptr<Job> job, const std::shared_ptr<Client>& client);
+    // Render a job on the calling thread; the sequence's frames in order
+    void run(Job& job, Client& client);
+    std::shared_ptr<LoadedScene> find(const std::string& name)
+    {
+        std::lock_guard<std::mutex> guard(scenesLock);
+        auto it = scenes.find(name);
+        return it == scenes.end() ? nullptr : it->second;
+    }
+
+    std::map<std::string, std::shared_ptr<LoadedScene>> scenes;
+    std::mutex scenesLock;
+    std::atomic<int> nextJob{1};
+    int pending = 0;
+    std::mutex jobsLock;
+    std::condition_variable idle;
+};
+
+void RenderServer::load(const std::string& name, const std::vector<std::string>& args, Client& client)
+{
+    std::string dir = "../../models/cornellbox/", env;
+    DirectLightingMode lighting = DirectLightingMode::Area;
+    BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::NAIVE;
+    bool guided = false, cached = false;
+    for (const std::string& arg : args) {
+        size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq), value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (key == "dir")
+            dir = value;
+        else if (key == "env")
+            env = value;
+        else if (key == "lighting" && ParseDirectLightingMode(value, lighting))
+            continue;
+        else if (key == "bvh" && ParseSplitMethod(value, splitMethod))
+            continue;
+        else if (arg == "guided")
+            guided = true;
+        else if (arg == "cache")
+            cached = true;
+        else
+            return client.reply("error bad load argument " + arg);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<LoadedScene> loaded;
+    try {
+        loaded = std::make_shared<LoadedScene>(dir, splitMethod);
+        Scene& scene = loaded->scene;
+        scene.directLighting = lighting;
+        if (guided)
+            scene.guide = std::make_unique<PathGuide>(scene.bvh->WorldBound());
+        if (cached)
+            scene.irradianceCache = std::make_unique<IrradianceCache>(scene, scene.bvh->WorldBound());
+        if (!env.empty())
+            scene.environment = std::make_unique<EnvironmentLight>(env);
+    }
+    catch (const std::runtime_error& e) {
+        return client.reply(std::string("error ") + e.what());
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    {
+        std::lock_guard<std::mutex> guard(scenesLock);
+        scenes[name] = loaded;
+    }
+    client.reply("ok loaded " + name + " " + std::to_string(ms.count()) + " ms");
+}
+
+bool RenderServer::configure(const std::vector<std::string>& args, Job& job, std::string& error) const
+{
+    Renderer& r = job.renderer;
+    r.verbose = false;
+    for (const std::string& arg : args) {
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos) {
+            error = "bad render argument " + arg;
+            return false;
+        }
+        std::string key = arg.substr(0, eq), value = arg.substr(eq + 1);
+        int seed = 0, reuse = 1, raster = 0;
+        bool ok = key == "out"      ? (r.output = value, !value.empty())
+                : key == "width"    ? parseInt(value, r.width) && r.width > 0
+                : key == "height"   ? parseInt(value, r.height) && r.height > 0
+                : key == "spp"      ? parseInt(value, r.spp) && r.spp > 0
+                : key == "primary"  ? parseInt(value, r.primarySamples) && r.primarySamples > 0
+                : key == "seed"     ? parseInt(value, seed) && (r.seed = seed, true)
+                : key == "fov"      ? sscanf(value.c_str(), "%lf", &r.fov) == 1 && r.fov > 0 && r.fov < 180
+                : key == "sampler"  ? ParseSamplerType(value, r.samplerType)
+                : key == "filter"   ? ParseFilterType(value, r.filterType)
+                : key == "eye"      ? parseVector(value, r.eye)
+                : key == "at"       ? parseVector(value, r.lookAt)
+                : key == "priority" ? parseInt(value, job.priority)
+                : key == "frames"   ? parseInt(value, job.frames) && job.frames > 0
+                : key == "orbit"    ? sscanf(value.c_str(), "%f", &job.orbit) == 1
+                : key == "reuse"    ? parseInt(value, reuse) && (job.reuse = reuse != 0, true)
+                : key == "raster"   ? parseInt(value, raster) && (r.rasterizePrimary = raster != 0, true)
+                : key == "metrics"  ? (r.metrics = value, !value.empty())
+                : false;
+        if (!ok) {
+            error = "bad render argument " + arg;
+            return false;
+        }
+    }
+    return true;
+}
+
+void RenderServer::submit(std::unique_ptr<Job> job, const std::shared_ptr<Client>& client)
+{
+    {
+        std::lock_guard<std::mutex> guard(jobsLock);
+        ++pending;
+    }
+    client->reply("queued " + std::to_string(job->id) + " " + job->renderer.output);
+    int priority = job->priority;
+    std::shared_ptr<Job> shared(std::move(job));
+    ThreadPool::shared().submit([this, shared, client]() {
+        run(*shared, *client);
+        std::lock_guard<std::mutex> guard(jobsLock);
+        if (--pending == 0)
+            idle.notify_all();
+    }, priority);
+}
+
+namespace
+{
+// eye turned by angle (radians) about +y around the look-at point
+Vector3f orbitEye(const Renderer& r, float angle)
+{
+    Vector3f offset = r.eye - r.lookAt;
+    float c = std::cos(angle), s = std::sin(angle);
+    return r.lookAt + Vector3f(c * offset.x + s * offset.z, offset.y, -s * offset.x + c * offset.z);
+}
+
+// out with the frame number before its extension
+std::string frameName(const std::string& out, int frame)
+{
+    size_t dot = out.find_last_of('.');
+    if (dot == std::string::npos || out.find('/', dot) != std::string::npos)
+        dot = out.size();
+    char number[16];
+    snprintf(number, sizeof(number), "%04d", frame);
+    return out.substr(0, dot) + number + out.substr(dot);
+}
+}
+
+void RenderServer::run(Job& job, Client& client)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [](std::chrono::steady_clock::time_point since) {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since);
+        return std::to_string(ms.count()) + " ms";
+    };
+    std::string id = std::to_string(job.id);
+    std::unique_lock<std::mutex> guard(job.scene->guideLock, std::defer_lock);
+    if (job.scene->scene.guide)
+        guard.lock();
+
+    if (job.frames == 0) {
+        if (job.renderer.Render(job.scene->scene))
+            client.reply("done " + id + " " + job.renderer.output + " " + elapsed(start));
+        else
+            client.reply("error job " + id + " cannot write " + job.renderer.output);
+        return;
+    }
+
+    TemporalHistory history;
+    Renderer frame = job.renderer;
+    for (int f = 0; f < job.frames; ++f) {
+        auto frameStart = std::chrono::steady_clock::now();
+        frame.eye = orbitEye(job.renderer, job.orbit * M_PI / 180 * f / job.frames);
+        frame.output = frameName(job.renderer.output, f);
+        // fresh samples each frame, or reuse would only average the same noise
+        frame.seed = job.renderer.seed + f;
+        if (!frame.Render(job.scene->scene, job.reuse ? &history : nullptr)) {
+            client.reply("error job " + id + " cannot write " + frame.output);
+            return;
+        }
+        client.reply("frame " + id + " " + frame.output + " " + elapsed(frameStart));
+    }
+    client.reply("done " + id + " " + frameName(job.renderer.output, job.frames - 1) + " " + elapsed(start));
+}
+
+bool RenderServer::execute(const std::string& line, const std::shared_ptr<Client>& client)
+{
+    std::istringstream in(line);
+    std::string command, name, arg;
+    std::vector<std::string> args;
+    in >> command >> name;
+    while (in >> arg)
+        args.push_back(arg);
+
+    if (command.empty() || command[0] == '#')
+        return true;
+    if (command == "quit") {
+        waitIdle();
+        client->reply("ok bye");
+        return false;
+    }
+    if (command == "wait") {
+        waitIdle();
+        client->reply("ok idle");
+        return true;
+    }
+    if (name.empty()) {
+        client->reply("error " + command + " needs a scene name");
+        return true;
+    }
+    if (command == "load") {
+        load(name, args, *client);
+        return true;
+    }
+    if (command == "unload") {
+        // jobs already queued keep the scene alive until they finish
+        std::lock_guard<std::mutex> guard(scenesLock);
+        client->reply(scenes.erase(name) ? "ok unloaded " + name : "error no scene " + name);
+        return true;
+    }
+    if (command != "render" && command != "turntable" && command != "sequence") {
+        client->reply("error unknown command " + command);
+        return true;
+    }
+
+    auto scene = find(name);
+    if (!scene) {
+        client->reply("error no scene " + name);
+        return true;
+    }
+    auto job = std::make_unique<Job>();
+    std::string error;
+    if (!configure(args, *job, error)) {
+        client->reply("error " + error);
+        return true;
+    }
+    job->scene = scene;
+    if (command != "render" && job->frames <= 0) {
+        client->reply("error " + command + " needs frames=<n>");
+        return true;
+    }
+    if (command != "turntable") {
+        if (command == "render")
+            job->frames = 0;
+        job->id = nextJob++;
+        submit(std::move(job), client);
+        return true;
+    }
+
+    int frames = job->frames;
+    job->frames = 0;
+    for (int f = 0; f < frames; ++f) {
+        auto frame = std::make_unique<Job>(*job);
+        frame->id = nextJob++;
+        frame->renderer.eye = orbitEye(job->renderer, 2 * M_PI * f / frames);
+        frame->renderer.output = frameName(job->renderer.output, f);
+        submit(std::move(frame), client);
+    }
+    return true;
+}
+
+#ifndef _WIN32
+int serveSocket(RenderServer& server, const std::string& path)
+{
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "cannot create socket " << path << "\n";
+        return 1;
+    }
+    std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+    unlink(path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, 8) < 0) {
+        std::cerr << "cannot listen on " << path << "\n";
+        return 1;
+    }
+    std::cout << "listening on " << path << std::endl;
+
+    // Connection threads; each reads its commands until EOF and is joined
+    // once it has finished. The client lives on with the jobs it queued.
+    struct Connection
+    {
+        std::thread thread;
+        std::weak_ptr<Client> client;
+        std::atomic<bool> finished{false};
+    };
+    std::list<Connection> connections;
+    std::atomic<bool> running{true};
+    while (running) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0)
+            break;
+        for (auto it = connections.begin(); it != connections.end();) {
+            if (it->finished) {
+                it->thread.join();
+                it = connections.erase(it);
+            }
+            else
+                ++it;
+        }
+        auto client = std::make_shared<Client>(fd);
+        connections.emplace_back();
+        Connection& connection = connections.back();
+        connection.client = client;
+        connection.thread = std::thread([&server, &running, &connection, listener, client]() {
+            std::string buffer;
+            char chunk[4096];
+            bool open = true;
+            while (open) {
+                ssize_t n = recv(client->descriptor(), chunk, sizeof(chunk), 0);
+                if (n <= 0)
+                    break;
+                buffer.append(chunk, n);
+                for (size_t end; open && (end = buffer.find('\n')) != std::string::npos;) {
+                    std::string line = buffer.substr(0, end);
+                    buffer.erase(0, end + 1);
+                    if (!server.execute(line, client)) {
+                        // wakes the accept() above
+                        running = false;
+                        shutdown(listener, SHUT_RDWR);
+                        open = false;
+                    }
+                }
+            }
+            connection.finished = true;
+        });
+    }
+    // wakes the recv() of connections still reading; finished ones keep
+    // their clients for the replies of jobs still running
+    for (auto& connection : connections) {
+        auto client = connection.client.lock();
+        if (client && !connection.finished)
+            client->hangUp();
+    }
+    for (auto& connection : connections)
+        connection.thread.join();
+    server.waitIdle();
+    close(listener);
+    unlink(path.c_str());
+    return 0;
+}
+#endif
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 1 && !(argc == 3 && std::string(argv[1]) == "--socket")) {
+        std::cerr << "usage: " << argv[0] << " [--socket <path>]\n";
+        return 1;
+    }
+
+    RenderServer server;
+    if (argc == 3) {
+#ifndef _WIN32
+        std::signal(SIGPIPE, SIG_IGN);
+        return serveSocket(server, argv[2]);
+#else
+        std::cerr << "--socket is not supported on this platform\n";
+        return 1;
+#endif
+    }
+
+    auto client = std::make_shared<Client>();
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (!server.execute(line, client))
+            return 0;
+    }
+    server.waitIdle();
+    return 0;
+}
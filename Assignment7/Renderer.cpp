@@ -6,52 +6,152 @@
 #include "Scene.hpp"
 #include "Renderer.hpp"
 
-
-inline float deg2rad(const float& deg) { return deg * M_PI / 180.0; }
-
-const float EPSILON = 0.00001;
-
 // The main render function. This where we iterate over all pixels in the image,
 // generate primary rays and cast these rays into the scene. The content of the
 // framebuffer is saved to a file.
-void Renderer::Render(const Scene& scene)
+bool Renderer::Render(const Scene& scene, TemporalHistory* history)
 {
-    std::vector<Vector3f> framebuffer(scene.width * scene.height);
+    frameWidth = width > 0 ? width : scene.width;
+    frameHeight = height > 0 ? height : scene.height;
+    frameFov = fov > 0 ? fov : scene.fov;
+    std::vector<Vector3f> framebuffer(frameWidth * frameHeight);
 
-    float scale = tan(deg2rad(scene.fov * 0.5));
-    float imageAspectRatio = scene.width / (float)scene.height;
-    Vector3f eye_pos(278, 273, -800);
-    int m = 0;
+    if (verbose) {
+        std::cout << "SPP: " << spp << "\n";
+        std::cout << "Sampler: " << SamplerName(samplerType) << "\n";
+        if (scene.environment)
+            std::cout << "Environment: " << scene.environment->width() << "x" << scene.environment->height() << "\n";
+    }
 
-    // change the spp value to change sample ammount
-    int spp = 16;
-    std::cout << "SPP: " << spp << "\n";
-    for (uint32_t j = 0; j < scene.height; ++j) {
-        for (uint32_t i = 0; i < scene.width; ++i) {
-            // generate primary ray direction
-            float x = (2 * (i + 0.5) / (float)scene.width - 1) *
-                      imageAspectRatio * scale;
-            float y = (1 - 2 * (j + 0.5) / (float)scene.height) * scale;
-
-            Vector3f dir = normalize(Vector3f(-x, y, 1));
-            for (int k = 0; k < spp; k++){
-                framebuffer[m] += scene.castRay(Ray(eye_pos, dir), 0) / spp;  
-            }
-            m++;
+    // counts every path and ray of the render, on whichever thread
+    RenderMetrics progress(output, (uint64_t)spp * frameWidth * frameHeight, metrics, verbose, metricsInterval);
+    if (!progress.ok())
+        std::cerr << "cannot write metrics to " << metrics << "\n";
+    RenderMetrics::Scope counting(&progress);
+
+    std::unique_ptr<Rasterizer> rasterizer;
+    if (rasterizePrimary) {
+        rasterizer = std::make_unique<Rasterizer>(scene);
+        if (!rasterizer->supported())
+            rasterizer.reset();
+        if (verbose)
+            std::cout << "Primary visibility: " << (rasterizer ? "rasterized" : "traced (scene is not all triangles)")
+                      << "\n";
+    }
+
+    if (!scene.guide) {
+        renderPass(scene, spp, seed, framebuffer, rasterizer.get(), progress);
+    }
+    else {
+        // Training passes of 1, 2, 4, ... spp, each sampling with what the
+        // ones before it learned. Once less than three times the next pass
+        // is left, all of it goes to a last pass that no longer records.
+        // Every pass is unbiased, so all of them add to the image.
+        int remaining = spp;
+        for (int n = 1, pass = 0; remaining > 0; n *= 2, ++pass) {
+            bool last = remaining < 3 * n;
+            int passSpp = last ? remaining : n;
+            scene.guide->training = !last;
+            if (verbose)
+                std::cout << (last ? "Final pass: " : "Training pass: ") << passSpp << " spp\n";
+            renderPass(scene, passSpp, seed + 2 * pass, framebuffer, rasterizer.get(), progress);
+            remaining -= passSpp;
+            if (last)
+                break;
+            scene.guide->update();
+            if (verbose)
+                std::cout << "Path guiding iteration " << scene.guide->iterations() << ": "
+                          << scene.guide->cells() << " spatial cells, "
+                          << scene.guide->directionalNodes() << " directional nodes\n";
         }
-        UpdateProgress(j / (float)scene.height);
     }
-    UpdateProgress(1.f);
+
+    progress.finish();
+
+    if (scene.irradianceCache && verbose)
+        std::cout << "Irradiance cache: " << scene.irradianceCache->size() << " records\n";
+
+    if (history) {
+        // reprojection follows the surface seen through each pixel's centre
+        Camera camera(eye, lookAt, frameFov, frameWidth, frameHeight);
+        std::vector<Intersection> hits(frameWidth * frameHeight);
+        parallelFor(0, frameWidth * frameHeight, [&](int p) {
+            hits[p] = scene.intersect(Ray(camera.eye, camera.direction(p % frameWidth + 0.5f, p / frameWidth + 0.5f)));
+        });
+        history->blend(camera, hits, framebuffer, spp);
+        if (verbose)
+            std::cout << "Temporal reuse: " << int(history->reused() * 100) << "% of pixels\n";
+    }
 
     // save framebuffer to file
-    FILE* fp = fopen("binary.ppm", "wb");
-    (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
-    for (auto i = 0; i < scene.height * scene.width; ++i) {
-        static unsigned char color[3];
+    FILE* fp = fopen(output.c_str(), "wb");
+    if (!fp)
+        return false;
+    (void)fprintf(fp, "P6\n%d %d\n255\n", frameWidth, frameHeight);
+    for (auto i = 0; i < frameHeight * frameWidth; ++i) {
+        unsigned char color[3];
         color[0] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].x), 0.6f));
         color[1] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].y), 0.6f));
         color[2] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].z), 0.6f));
         fwrite(color, 1, 3, fp);
     }
-    fclose(fp);    
+    return fclose(fp) == 0;
+}
+
+void Renderer::renderPass(const Scene& scene, int passSpp, uint32_t passSeed, std::vector<Vector3f>& framebuffer,
+                          const Rasterizer* rasterizer, RenderMetrics& progress)
+{
+    Camera camera(eye, lookAt, frameFov, frameWidth, frameHeight);
+    int m = 0;
+
+    // Paths draw their dimensions from sampler. Camera rays come from a
+    // second sampler sized to the number of primary samples, so those few
+    // positions are themselves well stratified inside the pixel.
+    int strata = std::max(1, std::min(primarySamples, passSpp));
+    auto sampler = CreateSampler(samplerType, passSpp, passSeed);
+    auto pixelSampler = CreateSampler(samplerType, strata, passSeed + 1);
+    PixelFilter filter(filterType);
+
+    std::unique_ptr<ReSTIR> restir;
+    if (scene.directLighting == DirectLightingMode::ReSTIR)
+        restir = std::make_unique<ReSTIR>(scene, frameWidth, frameHeight, passSeed);
+
+    // One pass per primary sample. The primary visibility pass (G-buffer)
+    // finds the first hit of each pixel's camera ray once, by tracing it or
+    // by rasterizing, and every path that uses the ray starts from it.
+    std::vector<Intersection> gbuffer(frameWidth * frameHeight);
+    std::vector<Vector3f> gbufferWo(frameWidth * frameHeight);
+    std::vector<Vector2f> samplePositions(rasterizer ? frameWidth * frameHeight : 0);
+    for (int s = 0; s < strata; ++s) {
+        parallelFor(0, frameWidth * frameHeight, [&](int p) {
+            int i = p % frameWidth, j = p / frameWidth;
+            Vector2f offset = filter.sample(pixelSampler->getPixel2D(i, j, s));
+            Vector3f dir = camera.direction(i + 0.5f + offset.x, j + 0.5f + offset.y);
+            if (rasterizer)
+                samplePositions[p] = Vector2f(i + 0.5f + offset.x, j + 0.5f + offset.y);
+            else
+                gbuffer[p] = scene.intersect(Ray(camera.eye, dir));
+            gbufferWo[p] = -dir;
+        });
+        if (rasterizer)
+            rasterizer->render(camera, samplePositions, gbuffer);
+        if (restir)
+            restir->run(gbuffer, gbufferWo, s);
+        if (scene.irradianceCache)
+            scene.irradianceCache->populate(gbuffer, frameWidth, frameHeight);
+
+        m = 0;
+        int pixelPaths = (passSpp - s + strata - 1) / strata;
+        for (uint32_t j = 0; j < frameHeight; ++j) {
+            for (uint32_t i = 0; i < frameWidth; ++i) {
+                for (int k = s; k < passSpp; k += strata){
+                    sampler->startPixelSample(i, j, k);
+                    framebuffer[m] += scene.shade(gbuffer[m], gbufferWo[m], 0, *sampler,
+                                                  restir ? &restir->direct(m) : nullptr) / spp;
+                }
+                m++;
+            }
+            progress.addSamples((uint64_t)pixelPaths * frameWidth);
+        }
+    }
 }
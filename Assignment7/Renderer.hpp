@@ -1,7 +1,15 @@
 //
 // Created by goksu on 2/25/20.
 //
+#include <string>
 #include "Scene.hpp"
+#include "Sampler.hpp"
+#include "Filter.hpp"
+#include "ReSTIR.hpp"
+#include "Camera.hpp"
+#include "TemporalReuse.hpp"
+#include "Rasterizer.hpp"
+#include "RenderMetrics.hpp"
 
 #pragma once
 struct hit_payload
@@ -15,7 +23,48 @@ struct hit_payload
 class Renderer
 {
 public:
-    void Render(const Scene& scene);
+    // Render scene and write the image to output; false if it could not
+    // be written. With a history, the frame is one of a camera sequence:
+    // the radiance of earlier frames is reprojected into it and blended
+    // with the new samples, and the result is kept for the next frame.
+    bool Render(const Scene& scene, TemporalHistory* history = nullptr);
+
+    // change the spp value to change sample ammount
+    int spp = 16;
+    // Distinct camera rays per pixel, placed by the sampler and the pixel
+    // filter. Each one is traced once and shared by spp / primarySamples
+    // paths, so setting it to spp gives every path its own camera ray.
+    int primarySamples = 4;
+    SamplerType samplerType = SamplerType::Sobol;
+    FilterType filterType = FilterType::Gaussian;
+    uint32_t seed = 0;
+    // Hybrid mode: find the camera rays' first hits by rasterizing the
+    // scene (see Rasterizer.hpp) instead of tracing them. Scenes with
+    // objects other than triangles are traced regardless.
+    bool rasterizePrimary = false;
+
+    // Camera at eye looking at lookAt with +y up. Image size and field of
+    // view left at 0 are taken from the scene.
+    Vector3f eye = Vector3f(278, 273, -800);
+    Vector3f lookAt = Vector3f(278, 273, 0);
+    int width = 0, height = 0;
+    double fov = 0;
+    std::string output = "binary.ppm";
+    // Print settings and progress to stdout
+    bool verbose = true;
+    // When set, a file to append to, or fd:<n>, that gets a JSON line of
+    // progress and throughput every metricsInterval seconds (see
+    // RenderMetrics.hpp)
+    std::string metrics;
+    double metricsInterval = 1;
 
 private:
+    // Add passSpp samples per pixel to framebuffer, each weighted 1 / spp.
+    // With a rasterizer, first hits come from it rather than from rays.
+    void renderPass(const Scene& scene, int passSpp, uint32_t passSeed, std::vector<Vector3f>& framebuffer,
+                    const Rasterizer* rasterizer, RenderMetrics& progress);
+
+    // width, height and fov of the render in progress
+    int frameWidth = 0, frameHeight = 0;
+    double frameFov = 0;
 };
@@ -0,0 +1,54 @@
+//
+// Weighted reservoir sampling of light samples.
+//
+
+#ifndef RAYTRACING_RESERVOIR_H
+#define RAYTRACING_RESERVOIR_H
+
+#include "Vector.hpp"
+
+// A point on an emitter. pdf is the area density with which it was drawn
+// among all emitters of the scene.
+struct LightSample
+{
+    Vector3f position;
+    Vector3f normal;
+    Vector3f emit;
+    float pdf = 0;
+};
+
+inline float luminance(const Vector3f& c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+// Keeps one of a stream of weighted candidates, each with probability
+// proportional to its weight. M counts the candidates seen and W is the
+// unbiased contribution weight of the kept sample once finalized.
+struct Reservoir
+{
+    LightSample y;
+    float wSum = 0;
+    float W = 0;
+    int M = 0;
+
+    bool update(const LightSample& x, float w, float u)
+    {
+        wSum += w;
+        ++M;
+        if (w > 0 && u * wSum < w) {
+            y = x;
+            return true;
+        }
+        return false;
+    }
+
+    // W = wSum / (M * target(y)) for the target density the candidates
+    // were weighted against
+    void finalize(float target)
+    {
+        W = target > 0 && M > 0 ? wSum / (M * target) : 0;
+    }
+};
+
+#endif //RAYTRACING_RESERVOIR_H
@@ -0,0 +1,249 @@
+//
+// Sample generators for the path tracer.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Sampler.hpp"
+
+namespace {
+
+const float kOneMinusEpsilon = 0x1.fffffep-1f;
+
+uint64_t mixBits(uint64_t v)
+{
+    v ^= v >> 31;
+    v *= 0x7fb5d329728ea185ull;
+    v ^= v >> 27;
+    v *= 0x81dadef4bc2dd44dull;
+    v ^= v >> 33;
+    return v;
+}
+
+uint64_t hashValues(uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t e = 0)
+{
+    uint64_t h = mixBits(a + 0x9e3779b97f4a7c15ull);
+    h = mixBits(h ^ (b + 0xbf58476d1ce4e5b9ull));
+    h = mixBits(h ^ (c + 0x94d049bb133111ebull));
+    h = mixBits(h ^ (d + 0x2545f4914f6cdd1dull));
+    return mixBits(h ^ e);
+}
+
+float toFloat(uint32_t v)
+{
+    return std::min(v * 0x1p-32f, kOneMinusEpsilon);
+}
+
+uint32_t reverseBits32(uint32_t v)
+{
+    v = (v << 16) | (v >> 16);
+    v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+    v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+    v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+    v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+    return v;
+}
+
+// Element i of a pseudo-random permutation of [0, n) chosen by p (Kensler,
+// "Correlated Multi-Jittered Sampling")
+uint32_t permutationElement(uint32_t i, uint32_t n, uint32_t p)
+{
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return (i + p) % n;
+}
+
+// Owen scrambling of a base-2 fraction: each bit is flipped depending on a
+// hash of the bits above it (Laine and Karras' hash, as used by PBRT)
+uint32_t owenScramble(uint32_t v, uint32_t seed)
+{
+    v = reverseBits32(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return reverseBits32(v);
+}
+
+// Second dimension of the Sobol sequence. Its generator matrix has columns
+// v_0 = 1/2, v_k = v_{k-1} ^ (v_{k-1} >> 1).
+uint32_t sobolSecondDimension(uint32_t i)
+{
+    uint32_t r = 0;
+    for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+        if (i & 1)
+            r ^= v;
+    return r;
+}
+
+const std::vector<int>& primes()
+{
+    static const std::vector<int> table = [] {
+        const int kCount = 256;
+        std::vector<int> p;
+        for (int n = 2; (int)p.size() < kCount; ++n) {
+            bool prime = true;
+            for (int q : p) {
+                if (q * q > n)
+                    break;
+                if (n % q == 0) {
+                    prime = false;
+                    break;
+                }
+            }
+            if (prime)
+                p.push_back(n);
+        }
+        return p;
+    }();
+    return table;
+}
+
+// Radical inverse of a in the given base with every digit permuted by a
+// hash of the digits before it, i.e. Owen scrambling for any base
+float owenScrambledRadicalInverse(int base, uint64_t a, uint64_t hash)
+{
+    float invBase = 1.f / base, invBaseM = 1;
+    uint64_t reversedDigits = 0;
+    while (1 - (base - 1) * invBaseM < 1) {
+        uint64_t next = a / base;
+        uint32_t digit = a - next * base;
+        uint32_t digitHash = mixBits(hash ^ reversedDigits);
+        digit = permutationElement(digit, base, digitHash);
+        reversedDigits = reversedDigits * base + digit;
+        invBaseM *= invBase;
+        a = next;
+    }
+    return std::min(invBaseM * reversedDigits, kOneMinusEpsilon);
+}
+
+float randomValue(uint32_t seed, int x, int y, int index, int dim)
+{
+    return toFloat(hashValues(seed, x, y, index, dim) >> 32);
+}
+
+} // namespace
+
+float IndependentSampler::sample1D(int x, int y, int index, int dim) const
+{
+    return randomValue(seed, x, y, index, dim);
+}
+
+Vector2f IndependentSampler::sample2D(int x, int y, int index, int dim) const
+{
+    return Vector2f(randomValue(seed, x, y, index, dim), randomValue(seed, x, y, index, dim + 1));
+}
+
+float StratifiedSampler::sample1D(int x, int y, int index, int dim) const
+{
+    uint32_t order = hashValues(seed, x, y, dim, 1);
+    uint32_t stratum = permutationElement(index % spp, spp, order);
+    return (stratum + randomValue(seed, x, y, index, dim)) / spp;
+}
+
+Vector2f StratifiedSampler::sample2D(int x, int y, int index, int dim) const
+{
+    int nx = std::max(1, (int)std::sqrt((float)spp)), ny = std::max(1, spp / nx);
+    uint32_t order = hashValues(seed, x, y, dim, 2);
+    uint32_t stratum = permutationElement(index % (nx * ny), nx * ny, order);
+    return Vector2f((stratum % nx + randomValue(seed, x, y, index, dim)) / nx,
+                    (stratum / nx + randomValue(seed, x, y, index, dim + 1)) / ny);
+}
+
+float HaltonSampler::sample1D(int x, int y, int index, int dim) const
+{
+    if (dim >= (int)primes().size())
+        return randomValue(seed, x, y, index, dim);
+    return owenScrambledRadicalInverse(primes()[dim], index, hashValues(seed, x, y, dim, 3));
+}
+
+Vector2f HaltonSampler::sample2D(int x, int y, int index, int dim) const
+{
+    return Vector2f(sample1D(x, y, index, dim), sample1D(x, y, index, dim + 1));
+}
+
+float SobolSampler::sample1D(int x, int y, int index, int dim) const
+{
+    uint64_t h = hashValues(seed, x, y, dim, 4);
+    uint32_t i = index / spp * spp + permutationElement(index % spp, spp, h);
+    return toFloat(owenScramble(reverseBits32(i), h >> 32));
+}
+
+Vector2f SobolSampler::sample2D(int x, int y, int index, int dim) const
+{
+    uint64_t h = hashValues(seed, x, y, dim, 5);
+    uint32_t i = index / spp * spp + permutationElement(index % spp, spp, h);
+    return Vector2f(toFloat(owenScramble(reverseBits32(i), h >> 32)),
+                    toFloat(owenScramble(sobolSecondDimension(i), (uint32_t)h)));
+}
+
+std::unique_ptr<Sampler> CreateSampler(SamplerType type, int samplesPerPixel, uint32_t seed)
+{
+    switch (type) {
+    case SamplerType::Independent:
+        return std::make_unique<IndependentSampler>(samplesPerPixel, seed);
+    case SamplerType::Stratified:
+        return std::make_unique<StratifiedSampler>(samplesPerPixel, seed);
+    case SamplerType::Halton:
+        return std::make_unique<HaltonSampler>(samplesPerPixel, seed);
+    case SamplerType::Sobol:
+    default:
+        return std::make_unique<SobolSampler>(samplesPerPixel, seed);
+    }
+}
+
+bool ParseSamplerType(const std::string& name, SamplerType& type)
+{
+    if (name == "independent")
+        type = SamplerType::Independent;
+    else if (name == "stratified")
+        type = SamplerType::Stratified;
+    else if (name == "halton")
+        type = SamplerType::Halton;
+    else if (name == "sobol")
+        type = SamplerType::Sobol;
+    else
+        return false;
+    return true;
+}
+
+const char* SamplerName(SamplerType type)
+{
+    switch (type) {
+    case SamplerType::Independent:
+        return "independent";
+    case SamplerType::Stratified:
+        return "stratified";
+    case SamplerType::Halton:
+        return "halton";
+    case SamplerType::Sobol:
+    default:
+        return "sobol";
+    }
+}
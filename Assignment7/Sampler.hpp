@@ -0,0 +1,141 @@
+//
+// Sample generators for the path tracer.
+//
+
+#ifndef RAYTRACING_SAMPLER_H
+#define RAYTRACING_SAMPLER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "Vector.hpp"
+
+enum class SamplerType { Independent, Stratified, Halton, Sobol };
+
+// A sampler hands out the sample values of one path at a time. Each pixel
+// sample has its own point set; within it, dimensions are consumed in a
+// fixed order, so the k-th value drawn along every path comes from the same
+// dimension of the sequence. Dimensions 0 and 1 are reserved for the
+// position inside the pixel.
+//
+// All values are a pure function of (pixel, sample index, dimension, seed),
+// so results do not depend on the order in which pixels are rendered.
+class Sampler
+{
+public:
+    Sampler(int samplesPerPixel, uint32_t seed) : spp(samplesPerPixel), seed(seed) {}
+    virtual ~Sampler() {}
+
+    // Begin drawing the dimensions of sample index of pixel (x, y)
+    void startPixelSample(int x, int y, int index)
+    {
+        px = x, py = y, sampleIndex = index;
+        dimension = kPixelDimensions;
+    }
+    float get1D() { return sample1D(px, py, sampleIndex, dimension++); }
+    Vector2f get2D()
+    {
+        Vector2f u = sample2D(px, py, sampleIndex, dimension);
+        dimension += 2;
+        return u;
+    }
+    // Position inside pixel (x, y) of sample index. Does not touch the
+    // current path, so it may be called from several threads.
+    Vector2f getPixel2D(int x, int y, int index) const { return sample2D(x, y, index, 0); }
+
+    int samplesPerPixel() const { return spp; }
+
+protected:
+    static const int kPixelDimensions = 2;
+
+    virtual float sample1D(int x, int y, int index, int dim) const = 0;
+    virtual Vector2f sample2D(int x, int y, int index, int dim) const = 0;
+
+    int spp;
+    uint32_t seed;
+
+private:
+    int px = 0, py = 0, sampleIndex = 0, dimension = kPixelDimensions;
+};
+
+// Uniform random values with no correlation between samples
+class IndependentSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+protected:
+    float sample1D(int x, int y, int index, int dim) const override;
+    Vector2f sample2D(int x, int y, int index, int dim) const override;
+};
+
+// Jittered strata: spp strata per 1D dimension and a near-square grid of
+// strata per 2D dimension. Strata are visited in an order that is shuffled
+// independently for every dimension and pixel.
+class StratifiedSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+protected:
+    float sample1D(int x, int y, int index, int dim) const override;
+    Vector2f sample2D(int x, int y, int index, int dim) const override;
+};
+
+// Halton sequence, one prime base per dimension, with Owen-scrambled digits
+// seeded per pixel. Dimensions past the prime table fall back to random.
+class HaltonSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+protected:
+    float sample1D(int x, int y, int index, int dim) const override;
+    Vector2f sample2D(int x, int y, int index, int dim) const override;
+};
+
+// Padded Sobol: every 2D dimension uses the first two Sobol dimensions, a
+// (0,2)-sequence, with its own index shuffle and Owen scrambling. This keeps
+// the best-distributed pair of dimensions for every 2D sample however long
+// the path gets. Works best with power-of-two spp.
+class SobolSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+protected:
+    float sample1D(int x, int y, int index, int dim) const override;
+    Vector2f sample2D(int x, int y, int index, int dim) const override;
+};
+
+// PCG32 generator for decisions that need an open-ended number of values,
+// such as resampling candidates. Different streams are independent.
+class RNG
+{
+public:
+    RNG(uint64_t seed = 0, uint64_t stream = 0) : inc((stream << 1) | 1)
+    {
+        next();
+        state += seed;
+        next();
+    }
+    uint32_t next()
+    {
+        uint64_t old = state;
+        state = old * 0x5851f42d4c957f2dull + inc;
+        uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+        uint32_t rot = old >> 59;
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+    float uniform() { return std::min(next() * 0x1p-32f, 0x1.fffffep-1f); }
+
+private:
+    uint64_t state = 0, inc;
+};
+
+std::unique_ptr<Sampler> CreateSampler(SamplerType type, int samplesPerPixel, uint32_t seed = 0);
+bool ParseSamplerType(const std::string& name, SamplerType& type);
+const char* SamplerName(SamplerType type);
+
+#endif //RAYTRACING_SAMPLER_H
@@ -2,38 +2,149 @@
 // Created by Göksu Güvendiren on 2019-05-14.
 //
 
+#include <cstring>
 #include "Scene.hpp"
 
+// How far off a two-sided surface rays leaving it start, in scene units;
+// the same as the tolerance of visible()
+const float kRayOffset = 0.005f;
 
 void Scene::buildBVH() {
-    printf(" - Generating BVH...\n\n");
-    this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::NAIVE);
+    fprintf(stderr, " - Generating BVH...\n\n");
+    delete this->bvh;
+    this->bvh = new BVHAccel(objects, 1, splitMethod);
+
+    materials.clear();
+    emitters.clear();
+    emitAreaSum = 0;
+    for (Object* object : objects) {
+        if (Material* m = object->getMaterial())
+            materials.add(m);
+        if (object->hasEmit()) {
+            emitters.push_back(object);
+            emitAreaSum += object->getArea();
+        }
+    }
 }
 
 Intersection Scene::intersect(const Ray &ray) const
 {
+    if (RenderMetrics *metrics = RenderMetrics::current())
+        metrics->addRays(1);
     return this->bvh->Intersect(ray);
 }
 
-void Scene::sampleLight(Intersection &pos, float &pdf) const
+void Scene::sampleLight(Intersection &pos, float &pdf, float uSelect, const Vector2f &u) const
 {
+    float p_total = emitAreaSum;
+    float p = uSelect * emitAreaSum;
     float emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
+    for (Object* emitter : emitters) {
+        float area = emitter->getArea();
+        emit_area_sum += area;
+        if (p <= emit_area_sum){
+            // where p falls inside this light is a fresh uniform sample
+            float uObject = area > 0 ? std::min(1 - (emit_area_sum - p) / area, 1.f) : 0.f;
+            emitter->Sample(pos, pdf, std::max(uObject, 0.f), u);
+            // include the chance of picking this light among all of them
+            pdf *= area / p_total;
+            break;
         }
     }
-    float p = get_random_float() * emit_area_sum;
-    emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
-            if (p <= emit_area_sum){
-                objects[k]->Sample(pos, pdf);
-                break;
-            }
+}
+
+LightSample Scene::sampleLight(float uSelect, const Vector2f &u) const
+{
+    Intersection pos;
+    LightSample ls;
+    sampleLight(pos, ls.pdf, uSelect, u);
+    ls.position = pos.coords;
+    ls.normal = pos.normal;
+    ls.emit = pos.emit;
+    return ls;
+}
+
+Vector3f Scene::unshadowedLight(const Intersection &hit, const Vector3f &wo, const LightSample &ls) const
+{
+    auto ws_unnorm = ls.position - hit.coords;
+    auto r2 = dotProduct(ws_unnorm, ws_unnorm);
+    if (r2 <= 0)
+        return {};
+    auto ws = ws_unnorm / std::sqrt(r2);
+    auto f_r = MaterialTable::eval(materials.of(hit), ShadingFrame(hit.normal), wo, ws);
+    // the BSDF is zero wherever the surface lets no light through
+    auto cos_theta = std::abs(dotProduct(hit.normal, ws));
+    auto cos_theta_prime = std::max(0.0f, dotProduct(ls.normal, -ws));
+    return ls.emit * f_r * cos_theta * cos_theta_prime / r2;
+}
+
+void Scene::unshadowedTargets(const Intersection &hit, const Vector3f &wo, const LightSample *ls, int count,
+                              float *target) const
+{
+    Vector3f ws[kLightBatch], f_r[kLightBatch];
+    float r2[kLightBatch];
+    for (int i = 0; i < count; ++i) {
+        auto ws_unnorm = ls[i].position - hit.coords;
+        r2[i] = dotProduct(ws_unnorm, ws_unnorm);
+        ws[i] = r2[i] > 0 ? ws_unnorm / std::sqrt(r2[i]) : hit.normal;
+    }
+    MaterialTable::eval(materials.of(hit), ShadingFrame(hit.normal), wo, ws, count, f_r);
+    for (int i = 0; i < count; ++i) {
+        target[i] = 0;
+        if (r2[i] <= 0)
+            continue;
+        auto cos_theta = std::abs(dotProduct(hit.normal, ws[i]));
+        auto cos_theta_prime = std::max(0.0f, dotProduct(ls[i].normal, -ws[i]));
+        target[i] = luminance(ls[i].emit * f_r[i] * cos_theta * cos_theta_prime / r2[i]);
+    }
+}
+
+bool Scene::visible(const Vector3f &p, const Vector3f &q) const
+{
+    auto d = q - p;
+    Intersection block_intersect = intersect(Ray(p, d.normalized()));
+    return block_intersect.distance - d.norm() > -0.005;
+}
+
+bool Scene::visible(const Intersection &hit, const Vector3f &q) const
+{
+    return visible(rayOrigin(hit, q - hit.coords), q);
+}
+
+Vector3f Scene::rayOrigin(const Intersection &hit, const Vector3f &w) const
+{
+    if (materials.of(hit).type != DIELECTRIC)
+        return hit.coords;
+    return hit.coords + hit.normal * (dotProduct(w, hit.normal) > 0 ? kRayOffset : -kRayOffset);
+}
+
+Vector3f Scene::risDirectLight(const Intersection &hit, const Vector3f &wo, float uSelect, const Vector2f &u) const
+{
+    // The first candidate uses the sampler's values; the rest come from a
+    // generator seeded by them, so the sampler's dimension layout is kept.
+    uint32_t bits;
+    std::memcpy(&bits, &uSelect, sizeof(bits));
+    RNG rng(bits ^ uint32_t(u.x * 4294967296.0), uint32_t(u.y * 4294967296.0));
+    // candidates are drawn and weighed a batch at a time
+    Reservoir r;
+    for (int c0 = 0; c0 < lightCandidates; c0 += kLightBatch) {
+        int n = std::min(kLightBatch, lightCandidates - c0);
+        LightSample x[kLightBatch];
+        float uPick[kLightBatch], target[kLightBatch];
+        for (int i = 0; i < n; ++i) {
+            x[i] = c0 + i == 0 ? sampleLight(uSelect, u)
+                               : sampleLight(rng.uniform(), Vector2f(rng.uniform(), rng.uniform()));
+            uPick[i] = rng.uniform();
         }
+        unshadowedTargets(hit, wo, x, n, target);
+        for (int i = 0; i < n; ++i)
+            r.update(x[i], x[i].pdf > 0 ? target[i] / x[i].pdf : 0, uPick[i]);
     }
+    Vector3f L = unshadowedLight(hit, wo, r.y);
+    r.finalize(luminance(L));
+    if (r.W <= 0 || !visible(hit, r.y.position))
+        return {};
+    return L * r.W;
 }
 
 bool Scene::trace(
@@ -56,74 +167,199 @@ bool Scene::trace(
 }
 
 // Implementation of Path Tracing
-Vector3f Scene::castRay(const Ray &ray, int depth) const
+Vector3f Scene::castRay(const Ray &ray, int depth, Sampler &sampler) const
+{
+    return shade(intersect(ray), -ray.direction, depth, sampler);
+}
+
+Vector3f Scene::shade(const Intersection &intersection, const Vector3f &wo, int depth, Sampler &sampler,
+                      const Vector3f *direct) const
 {
     // 可参考 https://zhuanlan.zhihu.com/p/488882096
     // Implement Path Tracing Algorithm here
-    // init intersection and w0
-    auto intersection = intersect(ray);
     if (!intersection.happened) {
-        return {};
+        return environment ? environment->Le(-wo) : Vector3f();
     }
 
     // Emission
-    if (intersection.m->hasEmission()) {
-        return intersection.m->getEmission();
+    const PackedMaterial &mat = materials.of(intersection);
+    if (mat.emissive) {
+        return mat.emission;
     }
 
     // init
     // w0的方向好像不影响？
     // 原因应该是eval和pdf里面第一个参数没有被用到
-    auto w0 = -ray.direction;
+    auto w0 = wo;
     auto L_dir = Vector3f();
     auto L_indir = Vector3f();
 
+    // every bounce draws its sample dimensions in the same order: light
+    // selection, light position, Russian roulette, BSDF direction, and
+    // with an environment, the environment direction
+    float uLightSelect = sampler.get1D();
+    Vector2f uLight = sampler.get2D();
+    float uRoulette = sampler.get1D();
+    Vector2f uBsdf = sampler.get2D();
+    Vector2f uEnvironment = environment ? sampler.get2D() : Vector2f();
+
+    auto p = intersection.coords;
+    // every BSDF query at this hit shares one frame
+    ShadingFrame frame(intersection.normal);
+
+    // With a trained guide, BSDF sampling below draws from the mixture of
+    // the guide and the BSDF; this is the density of a direction under it
+    const DTree *guiding = guide ? guide->distribution(p) : nullptr;
+    float guideFraction = guiding ? guide->guideFraction : 0.f;
+    auto bsdfPdf = [&](const Vector3f &wi) {
+        float pdf = (1 - guideFraction) * MaterialTable::pdf(mat, frame, w0, wi);
+        return guiding ? pdf + guideFraction * guiding->pdf(wi) : pdf;
+    };
+    // Glossy lobes find the emitters by BSDF sampling far more reliably
+    // than light sampling finds the lobes. At glossy hits in area mode both
+    // count, weighted by the power heuristic; elsewhere emitters are left to
+    // direct lighting alone.
+    bool misEmitters = mat.type != DIFFUSE && !direct && directLighting == DirectLightingMode::Area;
+
     // 1. from light source
     // Uniformly sample the light at x` (pdf_light = 1 / A)
     // L_dir = L_i * f_r * cos θ * cos θ` / |x` - intersection|^2 / pdf_light
-    float pdf_light = 0;
-    Intersection hit_light;
-    sampleLight(hit_light, pdf_light);
-    auto p = intersection.coords;
-    auto x = hit_light.coords;
-    auto ws_unnorm = x - p;
-    auto ws = ws_unnorm.normalized();
-    auto nn = hit_light.normal;
-
-    // Shoot a ray from intersection to x
-    Ray block_ray(p, ws);
-    // Check if the ray is blocked
-    Intersection block_intersect = intersect(block_ray);
-//    if (!block_intersect.happened)
-    if (block_intersect.distance - ws_unnorm.norm() > -0.005)
-    {
-        auto L_i = hit_light.emit;
-        auto f_r = intersection.m->eval(w0, ws, intersection.normal);
-        auto cos_theta = std::max(0.0f, dotProduct(intersection.normal, ws));
-        auto cos_theta_prime = std::max(0.0f, dotProduct(nn, -ws));
-        auto r2 = dotProduct(ws_unnorm, ws_unnorm);
-        L_dir = L_i * f_r * cos_theta * cos_theta_prime / r2 / pdf_light;
+    if (direct) {
+        L_dir = *direct;
+    }
+    else if (directLighting != DirectLightingMode::Area) {
+        L_dir = risDirectLight(intersection, w0, uLightSelect, uLight);
+    }
+    else {
+        float pdf_light = 0;
+        Intersection hit_light;
+        sampleLight(hit_light, pdf_light, uLightSelect, uLight);
+        auto x = hit_light.coords;
+        auto ws_unnorm = x - p;
+        auto ws = ws_unnorm.normalized();
+        auto nn = hit_light.normal;
+
+        // Shoot a ray from intersection to x
+        auto origin = rayOrigin(intersection, ws);
+        Ray block_ray(origin, ws);
+        // Check if the ray is blocked
+        Intersection block_intersect = intersect(block_ray);
+    //    if (!block_intersect.happened)
+        if (block_intersect.distance - (x - origin).norm() > -0.005)
+        {
+            auto L_i = hit_light.emit;
+            auto f_r = MaterialTable::eval(mat, frame, w0, ws);
+            // the BSDF is zero wherever the surface lets no light through
+            auto cos_theta = std::abs(dotProduct(intersection.normal, ws));
+            auto cos_theta_prime = std::max(0.0f, dotProduct(nn, -ws));
+            auto r2 = dotProduct(ws_unnorm, ws_unnorm);
+            L_dir = L_i * f_r * cos_theta * cos_theta_prime / r2 / pdf_light;
+            // pdf_light per unit solid angle, against BSDF sampling
+            if (misEmitters && cos_theta_prime > 0) {
+                float pdf_l = pdf_light * r2 / cos_theta_prime;
+                float pdf_b = RussianRoulette * bsdfPdf(ws);
+                L_dir = L_dir * (pdf_l * pdf_l / (pdf_l * pdf_l + pdf_b * pdf_b));
+            }
+        }
+    }
+
+    bool cached = depth == 0 && irradianceCache && mat.type == DIFFUSE;
+
+    // 1b. from the environment
+    // L_env = L_e * f_r * cos θ / pdf_env, weighted against the chance of
+    // BSDF sampling finding the same direction (it continues with
+    // probability P_RR); a cached hit samples no BSDF direction
+    if (environment) {
+        float pdf_env = 0;
+        auto wl = environment->sample(uEnvironment, pdf_env);
+        auto cos_theta = dotProduct(intersection.normal, wl);
+        if (pdf_env > 0 && (cos_theta > 0 || mat.type == DIELECTRIC) &&
+            !intersect(Ray(rayOrigin(intersection, wl), wl)).happened) {
+            auto f_r = MaterialTable::eval(mat, frame, w0, wl);
+            float pdf_bsdf = cached ? 0.f : RussianRoulette * bsdfPdf(wl);
+            float weight = pdf_env * pdf_env / (pdf_env * pdf_env + pdf_bsdf * pdf_bsdf);
+            L_dir += environment->Le(wl) * f_r * std::abs(cos_theta) / pdf_env * weight;
+        }
     }
 
     // 2. from indirect light
+    //  at primary hits on diffuse surfaces: L_indir = f_r * E, with E the
+    //  cached indirect irradiance
+    if (cached) {
+        auto f_r = MaterialTable::eval(mat, frame, w0, intersection.normal);
+        return L_dir + f_r * irradianceCache->irradiance(intersection);
+    }
+    //  elsewhere:
     //  L_indir = shade(q, wi) * f_r * cos_theta / pdf_hemi / P_RR
     // RussianRoulette Test
-    float ksi = get_random_float();
+    float ksi = uRoulette;
     if (ksi > RussianRoulette)
     {
         return L_dir + L_indir;
     }
 
-    auto wi = (intersection.m->sample(w0, intersection.normal)).normalized();
-    auto secondary_ray = Ray(p, wi);
+    // With a trained guide, uBsdf.x first picks between the guide and the
+    // BSDF and is then stretched back to [0, 1). The direction's density
+    // is that of the mixture of the two. The roulette sample, likewise
+    // stretched once it has passed, picks the dielectric's lobe.
+    Vector3f wi;
+    if (uBsdf.x < guideFraction)
+        wi = guiding->sample(Vector2f(uBsdf.x / guideFraction, uBsdf.y));
+    else
+        wi = MaterialTable::sample(mat, frame, w0,
+                                   Vector2f((uBsdf.x - guideFraction) / (1 - guideFraction), uBsdf.y),
+                                   ksi / RussianRoulette).normalized();
+    auto pdf_hemi = bsdfPdf(wi);
+    // guided directions may point into the surface, where they carry nothing
+    // but through dielectrics and would teach the guide about the wrong side
+    if (dotProduct(wi, intersection.normal) <= 0 && mat.type != DIELECTRIC)
+        return L_dir + L_indir;
+
+    auto secondary_ray = Ray(rayOrigin(intersection, wi), wi);
     auto secondary_inter= intersect(secondary_ray);
-    if (secondary_inter.happened && !secondary_inter.m->hasEmission())
+    Vector3f L_i;
+    if (secondary_inter.happened && !materials.of(secondary_inter).emissive)
+    {
+        auto f_r = MaterialTable::eval(mat, frame, w0, wi);
+        auto cos_theta = std::abs(dotProduct(intersection.normal, wi));
+        // continue from the hit just found rather than tracing the ray again;
+        // directions in the tangent plane (pdf 0) carry nothing
+        if (pdf_hemi > 0) {
+            L_i = shade(secondary_inter, -wi, depth + 1, sampler);
+            L_indir = L_i * f_r * cos_theta / pdf_hemi / RussianRoulette;
+        }
+    }
+    else if (!secondary_inter.happened && environment && pdf_hemi > 0)
     {
-        auto f_r = intersection.m->eval(w0, wi, intersection.normal);
-        auto cos_theta = std::max(0.0f, dotProduct(intersection.normal, wi));
-        auto pdf_hemi = intersection.m->pdf(w0, wi, intersection.normal);
-        L_indir = castRay(secondary_ray, depth + 1) * f_r * cos_theta / pdf_hemi / RussianRoulette;
+        // the environment's share of what reaches p along wi, weighted as
+        // in 1b from the other side
+        auto f_r = MaterialTable::eval(mat, frame, w0, wi);
+        auto cos_theta = std::abs(dotProduct(intersection.normal, wi));
+        float pdf_bsdf = RussianRoulette * pdf_hemi;
+        float pdf_env = environment->pdf(wi);
+        L_i = environment->Le(wi) * (pdf_bsdf * pdf_bsdf / (pdf_bsdf * pdf_bsdf + pdf_env * pdf_env));
+        L_indir = L_i * f_r * cos_theta / pdf_hemi / RussianRoulette;
+    }
+    else if (secondary_inter.happened && misEmitters && pdf_hemi > 0)
+    {
+        // the emitter's share, weighted as in 1 from the other side; light
+        // sampling picks points uniformly over the total emitting area
+        float cos_theta_prime = dotProduct(secondary_inter.normal, -wi);
+        if (cos_theta_prime > 0) {
+            auto f_r = MaterialTable::eval(mat, frame, w0, wi);
+            auto cos_theta = std::abs(dotProduct(intersection.normal, wi));
+            float pdf_b = RussianRoulette * pdf_hemi;
+            float r = secondary_inter.distance;
+            float pdf_l = r * r / (emitAreaSum * cos_theta_prime);
+            auto L_e = materials.of(secondary_inter).emission * (pdf_b * pdf_b / (pdf_b * pdf_b + pdf_l * pdf_l));
+            L_indir = L_e * f_r * cos_theta / pdf_hemi / RussianRoulette;
+        }
     }
+    // emitters are left to direct lighting, so the guide learns only the
+    // light this bounce is responsible for; misses still count as records,
+    // with the environment's weighted share
+    if (guide && guide->training && pdf_hemi > 0)
+        guide->record(p, wi, luminance(L_i) / pdf_hemi);
 
 
     return L_dir + L_indir;
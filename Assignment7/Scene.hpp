@@ -11,6 +11,20 @@
 #include "AreaLight.hpp"
 #include "BVH.hpp"
 #include "Ray.hpp"
+#include "Sampler.hpp"
+#include "Reservoir.hpp"
+#include "PathGuiding.hpp"
+#include "IrradianceCache.hpp"
+#include "EnvironmentLight.hpp"
+#include "MaterialTable.hpp"
+
+// How shade() estimates direct light at each bounce:
+//  - Area: one light sample drawn proportionally to emitter area
+//  - RIS: lightCandidates area samples, one of them resampled by its
+//    unshadowed contribution and shadow-tested
+//  - ReSTIR: RIS, plus per-pixel reservoirs at primary hits shared with
+//    neighbouring pixels (see ReSTIR.hpp)
+enum class DirectLightingMode { Area, RIS, ReSTIR };
 
 
 class Scene
@@ -23,9 +37,25 @@ public:
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
     int maxDepth = 1;
     float RussianRoulette = 0.8;
+    DirectLightingMode directLighting = DirectLightingMode::Area;
+    int lightCandidates = 32;
+    // Builder of the scene BVH; meshes get theirs from CornellBox
+    BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::NAIVE;
+    // When set, indirect bounces sample directions from the learned
+    // incident light as well as from the BSDF, and record what they find
+    // while the guide is training
+    std::unique_ptr<PathGuide> guide;
+    // When set, indirect light at primary hits on diffuse surfaces is
+    // interpolated from cached irradiance instead of traced
+    std::unique_ptr<IrradianceCache> irradianceCache;
+    // When set, rays leaving the scene see this environment, and every
+    // bounce samples it next to the emitters, weighted against BSDF
+    // sampling with the power heuristic
+    std::unique_ptr<EnvironmentLight> environment;
 
     Scene(int w, int h) : width(w), height(h)
     {}
+    ~Scene() { delete bvh; }
 
     void Add(Object *object) { objects.push_back(object); }
     void Add(std::unique_ptr<Light> light) { lights.push_back(std::move(light)); }
@@ -33,10 +63,36 @@ public:
     const std::vector<Object*>& get_objects() const { return objects; }
     const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
     Intersection intersect(const Ray& ray) const;
-    BVHAccel *bvh;
+    BVHAccel *bvh = nullptr;
+    // Builds the BVH, and the material table and emitter list from the
+    // objects added so far
     void buildBVH();
-    Vector3f castRay(const Ray &ray, int depth) const;
-    void sampleLight(Intersection &pos, float &pdf) const;
+    MaterialTable materials;
+    Vector3f castRay(const Ray &ray, int depth, Sampler &sampler) const;
+    // Path tracing from an already known hit; wo points back along the ray
+    // that found it. Lets callers reuse a hit instead of tracing it again.
+    // If direct is given it replaces the emitters' direct-light estimate at
+    // this hit.
+    Vector3f shade(const Intersection &intersection, const Vector3f &wo, int depth, Sampler &sampler,
+                   const Vector3f *direct = nullptr) const;
+    void sampleLight(Intersection &pos, float &pdf, float uSelect, const Vector2f &u) const;
+    LightSample sampleLight(float uSelect, const Vector2f &u) const;
+    // Light arriving at hit from ls and reflected towards wo, ignoring
+    // occlusion; its luminance is the resampling target
+    Vector3f unshadowedLight(const Intersection &hit, const Vector3f &wo, const LightSample &ls) const;
+    // Luminance of unshadowedLight for up to kLightBatch samples at one hit,
+    // with one shading frame and one BSDF dispatch for all of them
+    static constexpr int kLightBatch = 16;
+    void unshadowedTargets(const Intersection &hit, const Vector3f &wo, const LightSample *ls, int count,
+                           float *target) const;
+    bool visible(const Vector3f &p, const Vector3f &q) const;
+    // Whether q can be seen from hit, along a ray leaving from rayOrigin
+    bool visible(const Intersection &hit, const Vector3f &q) const;
+    // Where rays leaving hit along w start. Dielectrics are two-sided and
+    // are left from just off the surface on w's side, so the ray does not
+    // find them again; other surfaces are left from the hit itself.
+    Vector3f rayOrigin(const Intersection &hit, const Vector3f &w) const;
+    Vector3f risDirectLight(const Intersection &hit, const Vector3f &wo, float uSelect, const Vector2f &u) const;
     bool trace(const Ray &ray, const std::vector<Object*> &objects, float &tNear, uint32_t &index, Object **hitObject);
     std::tuple<Vector3f, Vector3f> HandleAreaLight(const AreaLight &light, const Vector3f &hitPoint, const Vector3f &N,
                                                    const Vector3f &shadowPointOrig,
@@ -46,6 +102,9 @@ public:
     // creating the scene (adding objects and lights)
     std::vector<Object* > objects;
     std::vector<std::unique_ptr<Light> > lights;
+    // objects with emissive materials and their total area
+    std::vector<Object* > emitters;
+    float emitAreaSum = 0;
 
     // Compute reflection direction
     Vector3f reflect(const Vector3f &I, const Vector3f &N) const
@@ -77,8 +77,8 @@ public:
         return Bounds3(Vector3f(center.x-radius, center.y-radius, center.z-radius),
                        Vector3f(center.x+radius, center.y+radius, center.z+radius));
     }
-    void Sample(Intersection &pos, float &pdf){
-        float theta = 2.0 * M_PI * get_random_float(), phi = M_PI * get_random_float();
+    void Sample(Intersection &pos, float &pdf, float, const Vector2f &u){
+        float theta = 2.0 * M_PI * u.x, phi = M_PI * u.y;
         Vector3f dir(std::cos(phi), std::sin(phi)*std::cos(theta), std::sin(phi)*std::sin(theta));
         pos.coords = center + radius * dir;
         pos.normal = dir;
@@ -91,6 +91,7 @@ public:
     bool hasEmit(){
         return m->hasEmission();
     }
+    Material* getMaterial() override { return m; }
 };
 
 
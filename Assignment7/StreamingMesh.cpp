@@ -0,0 +1,561 @@
+//
+// Out-of-core triangle mesh for scenes that do not fit in memory.
+//
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+// 64-bit offsets, for chunk files past 2 GiB
+#define fseeko _fseeki64
+#endif
+#include "BVH.hpp"
+#include "StreamingMesh.hpp"
+
+// Chunk blobs start on this boundary so they can be mapped individually on
+// any page size up to 64 KiB
+static const uint64_t kChunkAlignment = 1 << 16;
+static const uint32_t kMaxTrisInLeaf = 4;
+
+static uint64_t alignChunk(uint64_t offset)
+{
+    return (offset + kChunkAlignment - 1) & ~(kChunkAlignment - 1);
+}
+
+static Vector3f vertexAt(const float* v, uint32_t tri, int k)
+{
+    const float* p = v + tri * 9 + k * 3;
+    return Vector3f(p[0], p[1], p[2]);
+}
+
+static float centroidAxis(Bounds3 b, int axis)
+{
+    const Vector3f c = b.Centroid();
+    return c[axis];
+}
+
+static Bounds3 triangleBounds(const float* v, uint32_t tri)
+{
+    return Union(Bounds3(vertexAt(v, tri, 0), vertexAt(v, tri, 1)), vertexAt(v, tri, 2));
+}
+
+static void storeBounds(const Bounds3& b, float out[6])
+{
+    const Vector3f &lo = b.pMin, &hi = b.pMax;
+    for (int a = 0; a < 3; ++a) {
+        out[a] = lo[a];
+        out[a + 3] = hi[a];
+    }
+}
+
+static Bounds3 loadBounds(const float b[6])
+{
+    return Bounds3(Vector3f(b[0], b[1], b[2]), Vector3f(b[3], b[4], b[5]));
+}
+
+// Median-split BVH over the triangles of one chunk in depth-first order
+static uint32_t buildChunkNode(const float* verts, std::vector<uint32_t>& order,
+                               int begin, int end, std::vector<StreamingNode>& nodes)
+{
+    uint32_t index = nodes.size();
+    nodes.emplace_back();
+    Bounds3 bounds, centroids;
+    for (int i = begin; i < end; ++i) {
+        Bounds3 b = triangleBounds(verts, order[i]);
+        bounds = Union(bounds, b);
+        centroids = Union(centroids, b.Centroid());
+    }
+    storeBounds(bounds, nodes[index].bounds);
+
+    if (end - begin <= (int)kMaxTrisInLeaf) {
+        nodes[index].offset = begin;
+        nodes[index].count = end - begin;
+        return index;
+    }
+    int axis = centroids.maxExtent();
+    int mid = (begin + end) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                     [&](uint32_t a, uint32_t b) {
+                         return centroidAxis(triangleBounds(verts, a), axis) <
+                                centroidAxis(triangleBounds(verts, b), axis);
+                     });
+    buildChunkNode(verts, order, begin, mid, nodes);
+    uint32_t right = buildChunkNode(verts, order, mid, end, nodes);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+void StreamingMesh::build(const std::string& objFile, const std::string& chunkFile,
+                          uint32_t trisPerChunk)
+{
+    std::ifstream in(objFile);
+    if (!in)
+        throw std::runtime_error("StreamingMesh: cannot open " + objFile);
+
+    // Only the indexed form is kept in memory; vertices are expanded per chunk
+    std::vector<Vector3f> positions;
+    std::vector<uint32_t> faces;
+    std::string line;
+    std::vector<uint32_t> polygon;
+    for (size_t lineNumber = 1; std::getline(in, line); ++lineNumber) {
+        if (line.size() < 2 || line[1] != ' ')
+            continue;
+        if (line[0] == 'v') {
+            float x, y, z;
+            if (sscanf(line.c_str() + 2, "%f %f %f", &x, &y, &z) == 3)
+                positions.emplace_back(x, y, z);
+        }
+        else if (line[0] == 'f') {
+            polygon.clear();
+            std::istringstream tokens(line.substr(2));
+            std::string token;
+            while (tokens >> token) {
+                // v, v/vt, v//vn or v/vt/vn, 1-based or relative if negative
+                long index = 0;
+                try {
+                    index = std::stol(token);
+                }
+                catch (const std::logic_error&) {
+                    // not a number, or out of range: reported below
+                }
+                long resolved = index < 0 ? (long)positions.size() + index : index - 1;
+                if (index == 0 || resolved < 0 || resolved >= (long)positions.size())
+                    throw std::runtime_error("StreamingMesh: bad vertex index " + token + " on line " +
+                                             std::to_string(lineNumber) + " of " + objFile);
+                polygon.push_back(resolved);
+            }
+            for (size_t k = 2; k < polygon.size(); ++k) {
+                faces.push_back(polygon[0]);
+                faces.push_back(polygon[k - 1]);
+                faces.push_back(polygon[k]);
+            }
+        }
+    }
+    uint64_t triCount = faces.size() / 3;
+    if (triCount == 0)
+        throw std::runtime_error("StreamingMesh: no triangles in " + objFile);
+
+    // Order triangles along a Morton curve so consecutive runs are compact
+    auto centroid = [&](uint64_t t) {
+        return (positions[faces[3 * t]] + positions[faces[3 * t + 1]] +
+                positions[faces[3 * t + 2]]) / 3;
+    };
+    Bounds3 bounds, centroidBounds;
+    for (const auto& p : positions)
+        bounds = Union(bounds, p);
+    for (uint64_t t = 0; t < triCount; ++t)
+        centroidBounds = Union(centroidBounds, centroid(t));
+    std::vector<std::pair<uint64_t, uint32_t>> morton(triCount);
+    parallelFor(0, triCount, [&](int t) {
+        morton[t] = {mortonCode(centroidBounds.Offset(centroid(t))), (uint32_t)t};
+    });
+    std::sort(morton.begin(), morton.end());
+
+    StreamingMeshHeader header{};
+    memcpy(header.magic, "GSTREAM1", 8);
+    header.chunkCount = (triCount + trisPerChunk - 1) / trisPerChunk;
+    header.trisPerChunk = trisPerChunk;
+    header.triCount = triCount;
+    storeBounds(bounds, header.bounds);
+    std::vector<StreamingChunkInfo> table(header.chunkCount);
+
+    FILE* fp = fopen(chunkFile.c_str(), "wb");
+    if (!fp)
+        throw std::runtime_error("StreamingMesh: cannot create " + chunkFile);
+    uint64_t offset = alignChunk(sizeof(header) + sizeof(StreamingChunkInfo) * table.size());
+    std::vector<float> verts, sorted, cdf;
+    std::vector<uint32_t> order;
+    std::vector<StreamingNode> nodes;
+    for (uint32_t c = 0; c < header.chunkCount; ++c) {
+        uint64_t first = (uint64_t)c * trisPerChunk;
+        uint32_t n = std::min<uint64_t>(trisPerChunk, triCount - first);
+        verts.resize(n * 9);
+        for (uint32_t i = 0; i < n; ++i)
+            for (int k = 0; k < 3; ++k) {
+                const Vector3f& p = positions[faces[3 * morton[first + i].second + k]];
+                verts[i * 9 + k * 3] = p.x;
+                verts[i * 9 + k * 3 + 1] = p.y;
+                verts[i * 9 + k * 3 + 2] = p.z;
+            }
+
+        order.resize(n);
+        for (uint32_t i = 0; i < n; ++i)
+            order[i] = i;
+        nodes.clear();
+        buildChunkNode(verts.data(), order, 0, n, nodes);
+
+        // store triangles in leaf order and accumulate their areas
+        sorted.resize(n * 9);
+        cdf.resize(n);
+        float sum = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            memcpy(&sorted[i * 9], &verts[order[i] * 9], 9 * sizeof(float));
+            Vector3f v0 = vertexAt(sorted.data(), i, 0);
+            sum += crossProduct(vertexAt(sorted.data(), i, 1) - v0,
+                                vertexAt(sorted.data(), i, 2) - v0).norm() * 0.5f;
+            cdf[i] = sum;
+        }
+
+        StreamingChunkInfo& info = table[c];
+        info.offset = offset;
+        info.triCount = n;
+        info.nodeCount = nodes.size();
+        info.size = sizeof(StreamingNode) * nodes.size() + sizeof(float) * (sorted.size() + cdf.size());
+        memcpy(info.bounds, nodes[0].bounds, sizeof(info.bounds));
+        info.area = sum;
+        header.area += sum;
+
+        fseeko(fp, offset, SEEK_SET);
+        fwrite(nodes.data(), sizeof(StreamingNode), nodes.size(), fp);
+        fwrite(sorted.data(), sizeof(float), sorted.size(), fp);
+        fwrite(cdf.data(), sizeof(float), cdf.size(), fp);
+        offset = alignChunk(offset + info.size);
+    }
+
+    fseeko(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(table.data(), sizeof(StreamingChunkInfo), table.size(), fp);
+    fclose(fp);
+    fprintf(stderr, "StreamingMesh: wrote %llu triangles in %u chunks to %s\n",
+           (unsigned long long)triCount, header.chunkCount, chunkFile.c_str());
+}
+
+MappedChunk::MappedChunk(void* base, size_t size, const StreamingChunkInfo& info)
+    : base(base), size(size), triCount(info.triCount)
+{
+    nodes = static_cast<const StreamingNode*>(base);
+    vertices = reinterpret_cast<const float*>(nodes + info.nodeCount);
+    areaCdf = vertices + info.triCount * 9;
+}
+
+#ifndef _WIN32
+MappedChunk::~MappedChunk() { munmap(base, size); }
+#else
+MappedChunk::~MappedChunk() { delete[] static_cast<char*>(base); }
+#endif
+
+bool StreamingMesh::readAt(void* out, size_t size, uint64_t offset)
+{
+#ifndef _WIN32
+    return pread(fd, out, size, offset) == (ssize_t)size;
+#else
+    file.clear();
+    return (bool)file.seekg(offset) && (bool)file.read(static_cast<char*>(out), size);
+#endif
+}
+
+StreamingMesh::StreamingMesh(const std::string& chunkFile, Material* mt, size_t cacheBytes)
+    : m(mt), cacheBytes(cacheBytes)
+{
+#ifndef _WIN32
+    fd = open(chunkFile.c_str(), O_RDONLY);
+    if (fd < 0)
+#else
+    file.open(chunkFile, std::ios::binary);
+    if (!file)
+#endif
+        throw std::runtime_error("StreamingMesh: cannot open " + chunkFile);
+    StreamingMeshHeader header;
+    if (!readAt(&header, sizeof(header), 0) || memcmp(header.magic, "GSTREAM1", 8) != 0)
+        throw std::runtime_error("StreamingMesh: " + chunkFile + " is not a chunk file");
+    chunkInfo.resize(header.chunkCount);
+    if (!readAt(chunkInfo.data(), sizeof(StreamingChunkInfo) * chunkInfo.size(), sizeof(header)))
+        throw std::runtime_error("StreamingMesh: " + chunkFile + " is truncated");
+    bounding_box = loadBounds(header.bounds);
+    area = header.area;
+
+    float sum = 0;
+    for (const auto& info : chunkInfo)
+        chunkAreaCdf.push_back(sum += info.area);
+
+    std::vector<int> chunks(chunkInfo.size());
+    for (size_t i = 0; i < chunks.size(); ++i)
+        chunks[i] = i;
+    buildTop(chunks, 0, chunks.size());
+}
+
+StreamingMesh::~StreamingMesh()
+{
+    lru.clear();
+#ifndef _WIN32
+    close(fd);
+#endif
+}
+
+// Median split over the chunk bounds, nodes in depth-first order
+int StreamingMesh::buildTop(std::vector<int>& chunks, int begin, int end)
+{
+    int index = top.size();
+    top.emplace_back();
+    Bounds3 bounds, centroids;
+    for (int i = begin; i < end; ++i) {
+        Bounds3 b = loadBounds(chunkInfo[chunks[i]].bounds);
+        bounds = Union(bounds, b);
+        centroids = Union(centroids, b.Centroid());
+    }
+    top[index].bounds = bounds;
+    if (end - begin == 1) {
+        top[index].chunk = chunks[begin];
+        return index;
+    }
+    int axis = centroids.maxExtent();
+    int mid = (begin + end) / 2;
+    std::nth_element(chunks.begin() + begin, chunks.begin() + mid, chunks.begin() + end,
+                     [&](int a, int b) {
+                         return centroidAxis(loadBounds(chunkInfo[a].bounds), axis) <
+                                centroidAxis(loadBounds(chunkInfo[b].bounds), axis);
+                     });
+    int left = buildTop(chunks, begin, mid);
+    int right = buildTop(chunks, mid, end);
+    top[index].left = left;
+    top[index].right = right;
+    return index;
+}
+
+// Slab test returning the entry distance, or a negative value on a miss
+static float enterBox(const float b[6], const Ray& ray, float tMax)
+{
+    float tEnter = 0, tExit = tMax;
+    for (int a = 0; a < 3; ++a) {
+        float t0 = (b[a] - ray.origin[a]) * ray.direction_inv[a];
+        float t1 = (b[a + 3] - ray.origin[a]) * ray.direction_inv[a];
+        tEnter = std::max(tEnter, std::min(t0, t1));
+        tExit = std::min(tExit, std::max(t0, t1));
+    }
+    return tEnter <= tExit ? tEnter : -1;
+}
+
+void StreamingMesh::findChunks(const Ray& ray, std::vector<ChunkHit>& out) const
+{
+    out.clear();
+    if (top.empty())
+        return;
+    int stack[64], size = 0;
+    stack[size++] = 0;
+    while (size > 0) {
+        const TopNode& node = top[stack[--size]];
+        float b[6];
+        storeBounds(node.bounds, b);
+        float t = enterBox(b, ray, kInfinity);
+        if (t < 0)
+            continue;
+        if (node.chunk >= 0)
+            out.push_back({node.chunk, t});
+        else {
+            stack[size++] = node.right;
+            stack[size++] = node.left;
+        }
+    }
+}
+
+std::shared_ptr<MappedChunk> StreamingMesh::acquire(int chunk)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(chunk);
+    if (it != cache.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->second;
+    }
+
+    const StreamingChunkInfo& info = chunkInfo[chunk];
+#ifndef _WIN32
+    void* base = mmap(nullptr, info.size, PROT_READ, MAP_SHARED, fd, info.offset);
+    if (base == MAP_FAILED)
+        throw std::runtime_error("StreamingMesh: cannot map chunk");
+    madvise(base, info.size, MADV_WILLNEED);
+#else
+    // no mmap: the chunk is read into memory, and the cache bounds that
+    // memory instead of the mappings. The file is only read under the lock.
+    void* base = new char[info.size];
+    if (!readAt(base, info.size, info.offset)) {
+        delete[] static_cast<char*>(base);
+        throw std::runtime_error("StreamingMesh: cannot read chunk");
+    }
+#endif
+    auto mapped = std::make_shared<MappedChunk>(base, info.size, info);
+    lru.emplace_front(chunk, mapped);
+    cache[chunk] = lru.begin();
+    residentBytes += info.size;
+
+    // evicted chunks stay mapped until their last user lets go of them
+    while (residentBytes > cacheBytes && lru.size() > 1) {
+        residentBytes -= lru.back().second->size;
+        cache.erase(lru.back().first);
+        lru.pop_back();
+    }
+    return mapped;
+}
+
+bool StreamingMesh::resident(int chunk)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return cache.count(chunk) != 0;
+}
+
+void StreamingMesh::intersectChunk(const MappedChunk& chunk, const Ray& ray,
+                                   float& tNear, uint32_t& tri) const
+{
+    bool twoSided = m && m->m_type == DIELECTRIC;
+    uint32_t stack[64];
+    int size = 0;
+    stack[size++] = 0;
+    while (size > 0) {
+        const StreamingNode& node = chunk.nodes[stack[--size]];
+        if (enterBox(node.bounds, ray, tNear) < 0)
+            continue;
+        if (node.count == 0) {
+            stack[size++] = node.offset;
+            stack[size++] = &node - chunk.nodes + 1;
+            continue;
+        }
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+            // same test as Triangle::getIntersection, back faces are culled
+            // unless the mesh is a dielectric
+            Vector3f v0 = vertexAt(chunk.vertices, i, 0);
+            Vector3f e1 = vertexAt(chunk.vertices, i, 1) - v0;
+            Vector3f e2 = vertexAt(chunk.vertices, i, 2) - v0;
+            if (!twoSided && dotProduct(ray.direction, crossProduct(e1, e2)) > 0)
+                continue;
+            Vector3f pvec = crossProduct(ray.direction, e2);
+            float det = dotProduct(e1, pvec);
+            if (std::fabs(det) < EPSILON)
+                continue;
+            float invDet = 1 / det;
+            Vector3f tvec = ray.origin - v0;
+            float u = dotProduct(tvec, pvec) * invDet;
+            if (u < 0 || u > 1)
+                continue;
+            Vector3f qvec = crossProduct(tvec, e1);
+            float v = dotProduct(ray.direction, qvec) * invDet;
+            if (v < 0 || u + v > 1)
+                continue;
+            float t = dotProduct(e2, qvec) * invDet;
+            if (t >= 0 && t < tNear) {
+                tNear = t;
+                tri = i;
+            }
+        }
+    }
+}
+
+Intersection StreamingMesh::makeIntersection(const MappedChunk& chunk, const Ray& ray,
+                                             float t, uint32_t tri) const
+{
+    Intersection inter;
+    Vector3f v0 = vertexAt(chunk.vertices, tri, 0);
+    inter.happened = true;
+    inter.coords = ray.origin + ray.direction * t;
+    inter.distance = t;
+    inter.normal = normalize(crossProduct(vertexAt(chunk.vertices, tri, 1) - v0,
+                                          vertexAt(chunk.vertices, tri, 2) - v0));
+    inter.obj = const_cast<StreamingMesh*>(this);
+    inter.m = m;
+    return inter;
+}
+
+Intersection StreamingMesh::getIntersection(Ray ray)
+{
+    std::vector<ChunkHit> hits;
+    findChunks(ray, hits);
+    std::sort(hits.begin(), hits.end(),
+              [](const ChunkHit& a, const ChunkHit& b) { return a.tEnter < b.tEnter; });
+
+    float tNear = kInfinity;
+    uint32_t tri = 0;
+    std::shared_ptr<MappedChunk> best;
+    for (const auto& hit : hits) {
+        if (hit.tEnter >= tNear)
+            break;
+        auto chunk = acquire(hit.chunk);
+        float t = tNear;
+        intersectChunk(*chunk, ray, t, tri);
+        if (t < tNear) {
+            tNear = t;
+            best = chunk;
+        }
+    }
+    return best ? makeIntersection(*best, ray, tNear, tri) : Intersection();
+}
+
+void StreamingMesh::intersectBatch(const std::vector<Ray>& rays, std::vector<Intersection>& out)
+{
+    struct Pending {
+        uint32_t ray;
+        float tEnter;
+    };
+    std::unordered_map<int, std::vector<Pending>> queues;
+    std::vector<ChunkHit> hits;
+    for (uint32_t r = 0; r < rays.size(); ++r) {
+        findChunks(rays[r], hits);
+        for (const auto& hit : hits)
+            queues[hit.chunk].push_back({r, hit.tEnter});
+    }
+
+    // resident chunks first, then the ones with the most waiting rays
+    std::vector<std::pair<int, size_t>> schedule;
+    for (const auto& q : queues)
+        schedule.emplace_back(q.first, q.second.size());
+    std::vector<char> isResident(chunkInfo.size());
+    for (const auto& s : schedule)
+        isResident[s.first] = resident(s.first);
+    std::sort(schedule.begin(), schedule.end(), [&](const auto& a, const auto& b) {
+        if (isResident[a.first] != isResident[b.first])
+            return isResident[a.first] > isResident[b.first];
+        return a.second > b.second;
+    });
+
+    std::vector<float> tNear(rays.size(), kInfinity);
+    std::vector<uint32_t> tri(rays.size());
+    std::vector<std::shared_ptr<MappedChunk>> owner(rays.size());
+    for (const auto& s : schedule) {
+        auto chunk = acquire(s.first);
+        const auto& queue = queues[s.first];
+        // a ray is queued on a chunk at most once, so the per-ray slots are
+        // only touched by one thread here
+        parallelFor(0, queue.size(), [&](int i) {
+            uint32_t r = queue[i].ray;
+            if (queue[i].tEnter >= tNear[r])
+                return;
+            float t = tNear[r];
+            intersectChunk(*chunk, rays[r], t, tri[r]);
+            if (t < tNear[r]) {
+                tNear[r] = t;
+                owner[r] = chunk;
+            }
+        }, 256);
+    }
+
+    out.assign(rays.size(), Intersection());
+    for (uint32_t r = 0; r < rays.size(); ++r)
+        if (owner[r])
+            out[r] = makeIntersection(*owner[r], rays[r], tNear[r], tri[r]);
+}
+
+void StreamingMesh::Sample(Intersection& pos, float& pdf, float uSelect, const Vector2f& u)
+{
+    // pick a chunk, then a triangle inside it, both proportional to area;
+    // the position of p inside the chosen chunk is reused for the triangle
+    float p = uSelect * area;
+    int c = std::min<size_t>(std::lower_bound(chunkAreaCdf.begin(), chunkAreaCdf.end(), p) -
+                             chunkAreaCdf.begin(), chunkInfo.size() - 1);
+    auto chunk = acquire(c);
+    float chunkStart = c > 0 ? chunkAreaCdf[c - 1] : 0.f;
+    float q = std::min(std::max(p - chunkStart, 0.f), chunkInfo[c].area);
+    uint32_t t = std::min<size_t>(std::lower_bound(chunk->areaCdf, chunk->areaCdf + chunk->triCount, q) -
+                                  chunk->areaCdf, chunk->triCount - 1);
+
+    Vector3f v0 = vertexAt(chunk->vertices, t, 0);
+    Vector3f v1 = vertexAt(chunk->vertices, t, 1);
+    Vector3f v2 = vertexAt(chunk->vertices, t, 2);
+    float x = std::sqrt(u.x), y = u.y;
+    pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
+    pos.normal = normalize(crossProduct(v1 - v0, v2 - v0));
+    pos.emit = m->getEmission();
+    pdf = 1.0f / area;
+}
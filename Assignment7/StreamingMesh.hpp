@@ -0,0 +1,135 @@
+//
+// Out-of-core triangle mesh for scenes that do not fit in memory.
+//
+
+#ifndef RAYTRACING_STREAMINGMESH_H
+#define RAYTRACING_STREAMINGMESH_H
+
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "Object.hpp"
+#include "Material.hpp"
+
+// On-disk layout: a header, one StreamingChunkInfo per chunk, then the chunk
+// blobs, each starting on a kChunkAlignment boundary so it can be mapped on
+// its own. A blob holds the chunk's flattened BVH, its triangle vertices
+// (9 floats per triangle) and a running sum of triangle areas.
+struct StreamingMeshHeader {
+    char magic[8];
+    uint32_t chunkCount, trisPerChunk;
+    uint64_t triCount;
+    float bounds[6];
+    float area;
+};
+
+struct StreamingChunkInfo {
+    uint64_t offset, size;
+    uint32_t triCount, nodeCount;
+    float bounds[6];
+    float area;
+};
+
+// Node of a chunk's bottom-level BVH. Interior nodes keep their left child
+// right after themselves and store the right child in offset; leaves store
+// their first triangle in offset and count > 0.
+struct StreamingNode {
+    float bounds[6];
+    uint32_t offset;
+    uint32_t count;
+};
+
+// One chunk mapped into memory, or read into it where there is no mmap
+// (Windows). The memory is released when the last reference goes away, so
+// rays still working on an evicted chunk are safe.
+struct MappedChunk {
+    MappedChunk(void* base, size_t size, const StreamingChunkInfo& info);
+    ~MappedChunk();
+    void* base;
+    size_t size;
+    const StreamingNode* nodes;
+    const float* vertices;
+    const float* areaCdf;
+    uint32_t triCount;
+};
+
+class StreamingMesh : public Object
+{
+public:
+    // Convert an OBJ file into the chunked format. Only positions and faces
+    // are read; polygons are fan-triangulated. Triangles are ordered along a
+    // Morton curve so every chunk is spatially compact.
+    static void build(const std::string& objFile, const std::string& chunkFile,
+                      uint32_t trisPerChunk = 1 << 16);
+
+    // Open a chunk file, keeping at most cacheBytes of chunk data mapped
+    StreamingMesh(const std::string& chunkFile, Material* mt = new Material(),
+                  size_t cacheBytes = size_t(4) << 30);
+    ~StreamingMesh();
+
+    // Closest hit for a batch of rays. Rays are queued per chunk; chunks that
+    // are already resident are processed first, the rest are paged in one at
+    // a time, largest queue first, so each chunk is loaded at most once per
+    // batch. For callers that have their rays up front, such as BVHStats
+    // -s; the path tracer traces one ray at a time through getIntersection.
+    void intersectBatch(const std::vector<Ray>& rays, std::vector<Intersection>& hits);
+
+    size_t chunkCount() const { return chunkInfo.size(); }
+
+    bool intersect(const Ray&) override { return true; }
+    bool intersect(const Ray&, float&, uint32_t&) const override { return false; }
+    Intersection getIntersection(Ray ray) override;
+    void getSurfaceProperties(const Vector3f&, const Vector3f&, const uint32_t&, const Vector2f&,
+                              Vector3f&, Vector2f&) const override {}
+    Vector3f evalDiffuseColor(const Vector2f&) const override { return Vector3f(0.5, 0.5, 0.5); }
+    Bounds3 getBounds() override { return bounding_box; }
+    float getArea() override { return area; }
+    void Sample(Intersection& pos, float& pdf, float uSelect, const Vector2f& u) override;
+    bool hasEmit() override { return m->hasEmission(); }
+    Material* getMaterial() override { return m; }
+
+    Bounds3 bounding_box;
+    float area;
+    Material* m;
+
+private:
+    struct TopNode {
+        Bounds3 bounds;
+        int left = -1, right = -1, chunk = -1;
+    };
+    struct ChunkHit {
+        int chunk;
+        float tEnter;
+    };
+
+    int buildTop(std::vector<int>& chunks, int begin, int end);
+    void findChunks(const Ray& ray, std::vector<ChunkHit>& out) const;
+    std::shared_ptr<MappedChunk> acquire(int chunk);
+    bool resident(int chunk);
+    void intersectChunk(const MappedChunk& chunk, const Ray& ray, float& tNear,
+                        uint32_t& tri) const;
+    Intersection makeIntersection(const MappedChunk& chunk, const Ray& ray, float t,
+                                  uint32_t tri) const;
+
+    // Read size bytes at offset of the chunk file; false on a short read
+    bool readAt(void* out, size_t size, uint64_t offset);
+
+#ifndef _WIN32
+    int fd;
+#else
+    std::ifstream file;
+#endif
+    std::vector<StreamingChunkInfo> chunkInfo;
+    std::vector<float> chunkAreaCdf;
+    std::vector<TopNode> top;
+
+    // LRU cache of mapped chunks, most recently used at the front
+    std::mutex cacheMutex;
+    size_t cacheBytes, residentBytes = 0;
+    std::list<std::pair<int, std::shared_ptr<MappedChunk>>> lru;
+    std::unordered_map<int, decltype(lru)::iterator> cache;
+};
+
+#endif //RAYTRACING_STREAMINGMESH_H
@@ -0,0 +1,79 @@
+//
+// Temporal reuse of radiance across the frames of a camera sequence.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include "global.hpp"
+#include "TemporalReuse.hpp"
+
+namespace
+{
+// Lambertian radiance is the same from every direction, so only diffuse
+// surfaces look the same from the new view
+bool reusable(const Intersection& hit)
+{
+    return hit.happened && hit.m && hit.m->getType() == DIFFUSE;
+}
+}
+
+void TemporalHistory::blend(const Camera& current, const std::vector<Intersection>& hits,
+                            std::vector<Vector3f>& frame, int samples)
+{
+    int n = current.width * current.height;
+    std::vector<float> newCount(n, (float)samples);
+    std::atomic<int> reusedPixels{0};
+
+    if (!radiance.empty() && camera.width == current.width && camera.height == current.height) {
+        int w = camera.width, h = camera.height;
+        parallelFor(0, n, [&](int p) {
+            const Intersection& hit = hits[p];
+            float px, py;
+            if (!reusable(hit) || !camera.project(hit.coords, px, py))
+                return;
+            float tolerance = depthThreshold * (hit.coords - camera.eye).norm();
+
+            // bilinear taps around the projected position, each kept only
+            // if it saw the same surface
+            float fx = px - 0.5f, fy = py - 0.5f;
+            int x0 = (int)std::floor(fx), y0 = (int)std::floor(fy);
+            float tx = fx - x0, ty = fy - y0;
+            Vector3f L;
+            float N = 0, weightSum = 0;
+            for (int k = 0; k < 4; ++k) {
+                int x = x0 + (k & 1), y = y0 + (k >> 1);
+                if (x < 0 || y < 0 || x >= w || y >= h)
+                    continue;
+                int q = y * w + x;
+                if (!valid[q] || (position[q] - hit.coords).norm() > tolerance ||
+                    dotProduct(normal[q], hit.normal) < normalThreshold)
+                    continue;
+                float weight = (k & 1 ? tx : 1 - tx) * (k >> 1 ? ty : 1 - ty);
+                L += radiance[q] * weight;
+                N += count[q] * weight;
+                weightSum += weight;
+            }
+            if (weightSum < 1e-3f)
+                return;
+            L = L / weightSum;
+            N = std::min(N / weightSum, std::max(0.f, maxSamples - samples));
+            frame[p] = (L * N + frame[p] * samples) / (N + samples);
+            newCount[p] = N + samples;
+            ++reusedPixels;
+        });
+    }
+
+    reusedFraction = reusedPixels / (float)n;
+    camera = current;
+    radiance = frame;
+    count.swap(newCount);
+    position.resize(n);
+    normal.resize(n);
+    valid.resize(n);
+    for (int p = 0; p < n; ++p) {
+        valid[p] = reusable(hits[p]);
+        position[p] = hits[p].coords;
+        normal[p] = hits[p].normal;
+    }
+}
@@ -0,0 +1,50 @@
+//
+// Temporal reuse of radiance across the frames of a camera sequence.
+//
+
+#ifndef RAYTRACING_TEMPORALREUSE_H
+#define RAYTRACING_TEMPORALREUSE_H
+
+#include <vector>
+#include "Vector.hpp"
+#include "Intersection.hpp"
+#include "Camera.hpp"
+
+// Radiance accumulated over earlier frames of a sequence through a static
+// scene. A new frame finds each pixel's surface in the previous one by
+// projecting its primary hit into the previous camera, and reads the
+// history there with bilinear weights. Taps whose surface is not the same,
+// judged by position and normal, are dropped, so disoccluded pixels start
+// afresh. Pixels whose surface is not DIFFUSE neither reuse nor keep
+// history: the radiance leaving a glossy or glass surface changes with the
+// view, so the old one would be wrong.
+class TemporalHistory
+{
+public:
+    // Blend frame, the mean of samples new paths per pixel seen through
+    // camera, with the history of the same surfaces, weighting each by the
+    // samples behind it. hits are the primary hits of rays through the
+    // pixel centres. The result replaces the history.
+    void blend(const Camera& camera, const std::vector<Intersection>& hits, std::vector<Vector3f>& frame,
+               int samples);
+    void reset() { radiance.clear(); }
+
+    // Fraction of pixels that reused history in the last blend
+    float reused() const { return reusedFraction; }
+
+    // Samples the history may stand for at most. Each reprojection blurs it
+    // slightly, and the cap bounds how much of that accumulates.
+    float maxSamples = 64;
+    float depthThreshold = 0.01f; // relative to the distance from the camera
+    float normalThreshold = 0.9f;
+
+private:
+    Camera camera;
+    std::vector<Vector3f> radiance;
+    std::vector<float> count;
+    std::vector<Vector3f> position, normal;
+    std::vector<char> valid;
+    float reusedFraction = 0;
+};
+
+#endif //RAYTRACING_TEMPORALREUSE_H
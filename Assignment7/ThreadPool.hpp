@@ -0,0 +1,108 @@
+//
+// A fixed set of worker threads shared by all parallel work in the process.
+//
+
+#ifndef RAYTRACING_THREADPOOL_H
+#define RAYTRACING_THREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Workers take the waiting task of highest priority, oldest first among
+// equals. A task runs at the priority it was submitted with, and tasks it
+// submits in turn (say, the chunks of a parallelFor inside a render job)
+// inherit it, so the work of a high-priority job overtakes everything
+// queued for lower ones as soon as a worker frees up.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int threads)
+    {
+        for (int t = 0; t < threads; ++t)
+            workers.emplace_back([this]() { work(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers)
+            w.join();
+    }
+
+    // One worker per hardware thread, started on first use
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    int size() const { return workers.size(); }
+
+    void submit(std::function<void()> task, int priority = currentPriority())
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tasks.push({priority, next++, std::move(task)});
+        }
+        wake.notify_one();
+    }
+
+    // Priority of the task running on this thread; 0 outside the pool
+    static int& currentPriority()
+    {
+        thread_local int priority = 0;
+        return priority;
+    }
+
+private:
+    struct Task
+    {
+        int priority;
+        uint64_t order;
+        std::function<void()> run;
+    };
+    struct Later
+    {
+        bool operator()(const Task& a, const Task& b) const
+        {
+            return a.priority != b.priority ? a.priority < b.priority : a.order > b.order;
+        }
+    };
+
+    void work()
+    {
+        while (true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = tasks.top();
+                tasks.pop();
+            }
+            currentPriority() = task.priority;
+            task.run();
+            currentPriority() = 0;
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::priority_queue<Task, std::vector<Task>, Later> tasks;
+    uint64_t next = 0;
+    bool stopping = false;
+    std::mutex lock;
+    std::condition_variable wake;
+};
+
+#endif //RAYTRACING_THREADPOOL_H
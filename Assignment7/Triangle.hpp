@@ -6,6 +6,7 @@
 #include "OBJ_Loader.hpp"
 #include "Object.hpp"
 #include "Triangle.hpp"
+#include <algorithm>
 #include <cassert>
 #include <array>
 
@@ -72,8 +73,9 @@ public:
     }
     Vector3f evalDiffuseColor(const Vector2f&) const override;
     Bounds3 getBounds() override;
-    void Sample(Intersection &pos, float &pdf){
-        float x = std::sqrt(get_random_float()), y = get_random_float();
+    Bounds3 getClippedBounds(const Bounds3& box) override;
+    void Sample(Intersection &pos, float &pdf, float, const Vector2f &u){
+        float x = std::sqrt(u.x), y = u.y;
         pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
         pos.normal = this->normal;
         pdf = 1.0f / area;
@@ -84,12 +86,19 @@ public:
     bool hasEmit(){
         return m->hasEmission();
     }
+    Material* getMaterial() override { return m; }
+    bool getTriangles(std::vector<ObjectTriangle>& out) override
+    {
+        out.push_back({v0, v1, v2, normal, this, m});
+        return true;
+    }
 };
 
 class MeshTriangle : public Object
 {
 public:
-    MeshTriangle(const std::string& filename, Material *mt = new Material())
+    MeshTriangle(const std::string& filename, Material *mt = new Material(),
+                 BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::NAIVE)
     {
         objl::Loader loader;
         loader.LoadFile(filename);
@@ -132,7 +141,7 @@ public:
             ptrs.push_back(&tri);
             area += tri.area;
         }
-        bvh = new BVHAccel(ptrs);
+        bvh = new BVHAccel(ptrs, 1, splitMethod);
     }
 
     bool intersect(const Ray& ray) { return true; }
@@ -195,8 +204,8 @@ public:
         return intersec;
     }
     
-    void Sample(Intersection &pos, float &pdf){
-        bvh->Sample(pos, pdf);
+    void Sample(Intersection &pos, float &pdf, float uSelect, const Vector2f &u){
+        bvh->Sample(pos, pdf, uSelect, u);
         pos.emit = m->getEmission();
     }
     float getArea(){
@@ -205,6 +214,13 @@ public:
     bool hasEmit(){
         return m->hasEmission();
     }
+    Material* getMaterial() override { return m; }
+    bool getTriangles(std::vector<ObjectTriangle>& out) override
+    {
+        for (auto& t : triangles)
+            t.getTriangles(out);
+        return true;
+    }
 
     Bounds3 bounding_box;
     std::unique_ptr<Vector3f[]> vertices;
@@ -229,11 +245,51 @@ inline bool Triangle::intersect(const Ray& ray, float& tnear,
 
 inline Bounds3 Triangle::getBounds() { return Union(Bounds3(v0, v1), v2); }
 
+// Clip the triangle against the six planes of box (Sutherland-Hodgman) and
+// bound what is left. Every plane adds at most one vertex, so nine suffice.
+inline Bounds3 Triangle::getClippedBounds(const Bounds3& box)
+{
+    Vector3f poly[9] = {v0, v1, v2}, clipped[9];
+    int n = 3;
+    for (int axis = 0; axis < 3 && n > 0; ++axis) {
+        for (int side = 0; side < 2 && n > 0; ++side) {
+            float c = side == 0 ? box.pMin[axis] : box.pMax[axis];
+            auto inside = [&](const Vector3f& p) {
+                return side == 0 ? p[axis] >= c : p[axis] <= c;
+            };
+            // most planes leave the polygon whole
+            if (std::all_of(poly, poly + n, inside))
+                continue;
+            int m = 0;
+            for (int i = 0; i < n; ++i) {
+                const Vector3f& p = poly[i];
+                const Vector3f& q = poly[(i + 1) % n];
+                bool pIn = inside(p), qIn = inside(q);
+                if (pIn)
+                    clipped[m++] = p;
+                if (pIn != qIn)
+                    clipped[m++] = lerp(p, q, (c - p[axis]) / (q[axis] - p[axis]));
+            }
+            n = m;
+            std::copy(clipped, clipped + n, poly);
+        }
+    }
+
+    Bounds3 b, ret;
+    for (int i = 0; i < n; ++i)
+        b = Union(b, poly[i]);
+    // keep rounding in the intersection points from leaking out of the box
+    ret.pMin = Vector3f::Max(b.pMin, box.pMin);
+    ret.pMax = Vector3f::Min(b.pMax, box.pMax);
+    return ret;
+}
+
 inline Intersection Triangle::getIntersection(Ray ray)
 {
     Intersection inter;
 
-    if (dotProduct(ray.direction, normal) > 0)
+    // back faces are culled, except on dielectrics, which rays also leave
+    if (dotProduct(ray.direction, normal) > 0 && (!m || m->m_type != DIELECTRIC))
         return inter;
     double u, v, t_tmp = 0;
     Vector3f pvec = crossProduct(ray.direction, e2);
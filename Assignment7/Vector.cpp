@@ -3,3 +3,7 @@
 //
 
 #include "Vector.hpp"
+#include "global.hpp"
+
+// declared in global.hpp; the one definition for every executable
+const float EPSILON = 0.00001;
@@ -2,6 +2,14 @@
 #include <iostream>
 #include <cmath>
 #include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include "ThreadPool.hpp"
+#include "RenderMetrics.hpp"
 
 #undef M_PI
 #define M_PI 3.141592653589793f
@@ -37,7 +45,60 @@ inline float get_random_float()
     return dist(rng);
 }
 
-inline void UpdateProgress(float progress)
+// Split [begin, end) into contiguous chunks and run func(i) for every index on
+// the shared thread pool and the calling thread. Small ranges are run inline
+// on the calling thread.
+template <typename Func>
+inline void parallelFor(int begin, int end, Func func, int grain = 1024)
+{
+    int count = end - begin;
+    if (count <= 0)
+        return;
+    int nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, (count + grain - 1) / grain);
+    if (nThreads <= 1) {
+        for (int i = begin; i < end; ++i)
+            func(i);
+        return;
+    }
+
+    // Chunks run on the shared pool at the caller's priority. Each helper
+    // claims chunks until none are left, and so does the caller, which
+    // therefore never waits on a chunk nobody has started. Helpers that
+    // start late find nothing to claim and never touch func.
+    struct Group
+    {
+        std::atomic<int> next{0};
+        int done = 0;
+        std::mutex lock;
+        std::condition_variable finished;
+    };
+    auto group = std::make_shared<Group>();
+    int nChunks = std::min(4 * nThreads, (count + grain - 1) / grain);
+    int chunk = (count + nChunks - 1) / nChunks;
+    nChunks = (count + chunk - 1) / chunk;
+    // helpers count their rays towards the caller's render
+    auto claim = [group, begin, end, chunk, nChunks, f = &func, metrics = RenderMetrics::current()]() {
+        RenderMetrics::Scope scope(metrics);
+        for (int c; (c = group->next++) < nChunks;) {
+            int b = begin + c * chunk, e = std::min(end, b + chunk);
+            for (int i = b; i < e; ++i)
+                (*f)(i);
+            std::lock_guard<std::mutex> guard(group->lock);
+            if (++group->done == nChunks)
+                group->finished.notify_all();
+        }
+    };
+    ThreadPool& pool = ThreadPool::shared();
+    for (int t = 1; t < std::min(nChunks, pool.size() + 1); ++t)
+        pool.submit(claim);
+    claim();
+    std::unique_lock<std::mutex> guard(group->lock);
+    group->finished.wait(guard, [&]() { return group->done == nChunks; });
+}
+
+// status, if any, follows the percentage
+inline void UpdateProgress(float progress, const std::string& status = "")
 {
     int barWidth = 70;
 
@@ -48,6 +109,10 @@ inline void UpdateProgress(float progress)
         else if (i == pos) std::cout << ">";
         else std::cout << " ";
     }
-    std::cout << "] " << int(progress * 100.0) << " %\r";
+    std::cout << "] " << int(progress * 100.0) << " %";
+    // spaces cover what a longer status before left on the line
+    if (!status.empty())
+        std::cout << " " << status << "      ";
+    std::cout << "\r";
     std::cout.flush();
 };
@@ -1,9 +1,11 @@
 #include "Renderer.hpp"
 #include "Scene.hpp"
 #include "Triangle.hpp"
+#include "CornellBox.hpp"
 #include "Sphere.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
+#include <algorithm>
 #include <chrono>
 
 // In the main function of the program, we create the scene (create objects and
@@ -12,39 +14,74 @@
 // function().
 int main(int argc, char** argv)
 {
-
+    Renderer r;
     // Change the definition here to change resolution
     Scene scene(784, 784);
 
-    Material* red = new Material(DIFFUSE, Vector3f(0.0f));
-    red->Kd = Vector3f(0.63f, 0.065f, 0.05f);
-    Material* green = new Material(DIFFUSE, Vector3f(0.0f));
-    green->Kd = Vector3f(0.14f, 0.45f, 0.091f);
-    Material* white = new Material(DIFFUSE, Vector3f(0.0f));
-    white->Kd = Vector3f(0.725f, 0.71f, 0.68f);
-    Material* light = new Material(DIFFUSE, (8.0f * Vector3f(0.747f+0.058f, 0.747f+0.258f, 0.747f) + 15.6f * Vector3f(0.740f+0.287f,0.740f+0.160f,0.740f) + 18.4f *Vector3f(0.737f+0.642f,0.737f+0.159f,0.737f)));
-    light->Kd = Vector3f(0.65f);
-
-    MeshTriangle floor("../../models/cornellbox/floor.obj", white);
-    MeshTriangle shortbox("../../models/cornellbox/shortbox.obj", white);
-    MeshTriangle tallbox("../../models/cornellbox/tallbox.obj", white);
-    MeshTriangle left("../../models/cornellbox/left.obj", red);
-    MeshTriangle right("../../models/cornellbox/right.obj", green);
-    MeshTriangle light_("../../models/cornellbox/light.obj", light);
-
-    scene.Add(&floor);
-    scene.Add(&shortbox);
-    scene.Add(&tallbox);
-    scene.Add(&left);
-    scene.Add(&right);
-    scene.Add(&light_);
-
-    scene.buildBVH();
+    // --raster, anywhere, selects the hybrid mode; the rest are positional
+    std::vector<char*> args(argv, argv + argc);
+    auto raster = std::find(args.begin(), args.end(), std::string("--raster"));
+    r.rasterizePrimary = raster != args.end();
+    if (r.rasterizePrimary)
+        args.erase(raster);
+    // --metrics=<file|fd:n>, likewise, appends JSON progress lines there
+    auto metrics = std::find_if(args.begin(), args.end(), [](const char* arg) {
+        return std::string(arg).compare(0, 10, "--metrics=") == 0;
+    });
+    if (metrics != args.end()) {
+        r.metrics = *metrics + 10;
+        args.erase(metrics);
+    }
+    // --bvh=naive|lbvh|sbvh, likewise, picks the BVH builder
+    auto bvh = std::find_if(args.begin(), args.end(), [](const char* arg) {
+        return std::string(arg).compare(0, 6, "--bvh=") == 0;
+    });
+    bool bvhValid = true;
+    if (bvh != args.end()) {
+        bvhValid = ParseSplitMethod(*bvh + 6, scene.splitMethod);
+        args.erase(bvh);
+    }
+    argc = (int)args.size();
+    argv = args.data();
 
-    Renderer r;
+    bool guided = argc > 4 && std::string(argv[4]) == "guided";
+    bool cached = argc > 5 && std::string(argv[5]) == "cache";
+    if (!bvhValid ||
+        (argc > 1 && !ParseSamplerType(argv[1], r.samplerType)) ||
+        (argc > 2 && !ParseFilterType(argv[2], r.filterType)) ||
+        (argc > 3 && !ParseDirectLightingMode(argv[3], scene.directLighting)) ||
+        (argc > 4 && !guided && std::string(argv[4]) != "unguided") ||
+        (argc > 5 && !cached && std::string(argv[5]) != "nocache")) {
+        std::cerr << "usage: " << argv[0]
+                  << " [independent|stratified|halton|sobol] [box|tent|gaussian] [area|ris|restir]"
+                     " [unguided|guided] [nocache|cache] [environment.pfm|environment.hdr] [--raster]"
+                     " [--metrics=<file|fd:n>] [--bvh=naive|lbvh|sbvh]\n";
+        return 1;
+    }
+
+    std::unique_ptr<CornellBox> box;
+    try {
+        box = std::make_unique<CornellBox>("../../models/cornellbox/", scene.splitMethod);
+        box->addTo(scene);
+
+        scene.buildBVH();
+        if (guided)
+            scene.guide = std::make_unique<PathGuide>(scene.bvh->WorldBound());
+        if (cached)
+            scene.irradianceCache = std::make_unique<IrradianceCache>(scene, scene.bvh->WorldBound());
+        if (argc > 6)
+            scene.environment = std::make_unique<EnvironmentLight>(argv[6]);
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
 
     auto start = std::chrono::system_clock::now();
-    r.Render(scene);
+    if (!r.Render(scene)) {
+        std::cerr << "cannot write " << r.output << "\n";
+        return 1;
+    }
     auto stop = std::chrono::system_clock::now();
 
     std::cout << "Render complete: \n";
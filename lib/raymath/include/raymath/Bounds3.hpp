@@ -0,0 +1,127 @@
+//
+// Axis-aligned bounding box shared by the ray tracers.
+//
+
+#ifndef RAYMATH_BOUNDS3_H
+#define RAYMATH_BOUNDS3_H
+
+#include <array>
+#include <limits>
+#include "Vector.hpp"
+
+class Bounds3
+{
+  public:
+    Vector3f pMin, pMax; // two points to specify the bounding box
+    // empty box: union with anything gives the other operand
+    Bounds3()
+    {
+        float inf = std::numeric_limits<float>::infinity();
+        pMax = Vector3f(-inf, -inf, -inf);
+        pMin = Vector3f(inf, inf, inf);
+    }
+    Bounds3(const Vector3f p) : pMin(p), pMax(p) {}
+    Bounds3(const Vector3f p1, const Vector3f p2)
+    {
+        pMin = Vector3f::Min(p1, p2);
+        pMax = Vector3f::Max(p1, p2);
+    }
+
+    Vector3f Diagonal() const { return pMax - pMin; }
+    int maxExtent() const
+    {
+        Vector3f d = Diagonal();
+        if (d.x > d.y && d.x > d.z)
+            return 0;
+        else if (d.y > d.z)
+            return 1;
+        else
+            return 2;
+    }
+
+    double SurfaceArea() const
+    {
+        Vector3f d = Diagonal();
+        return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+    }
+
+    Vector3f Centroid() const { return 0.5 * pMin + 0.5 * pMax; }
+    Bounds3 Intersect(const Bounds3& b) const
+    {
+        return Bounds3(Vector3f::Max(pMin, b.pMin), Vector3f::Min(pMax, b.pMax));
+    }
+
+    Vector3f Offset(const Vector3f& p) const
+    {
+        Vector3f o = p - pMin;
+        if (pMax.x > pMin.x)
+            o.x /= pMax.x - pMin.x;
+        if (pMax.y > pMin.y)
+            o.y /= pMax.y - pMin.y;
+        if (pMax.z > pMin.z)
+            o.z /= pMax.z - pMin.z;
+        return o;
+    }
+
+    bool Overlaps(const Bounds3& b1, const Bounds3& b2) const
+    {
+        bool x = (b1.pMax.x >= b2.pMin.x) && (b1.pMin.x <= b2.pMax.x);
+        bool y = (b1.pMax.y >= b2.pMin.y) && (b1.pMin.y <= b2.pMax.y);
+        bool z = (b1.pMax.z >= b2.pMin.z) && (b1.pMin.z <= b2.pMax.z);
+        return (x && y && z);
+    }
+
+    bool Inside(const Vector3f& p, const Bounds3& b) const
+    {
+        return (p.x >= b.pMin.x && p.x <= b.pMax.x && p.y >= b.pMin.y &&
+                p.y <= b.pMax.y && p.z >= b.pMin.z && p.z <= b.pMax.z);
+    }
+    inline const Vector3f& operator[](int i) const
+    {
+        return (i == 0) ? pMin : pMax;
+    }
+
+    // Slab test of the ray origin + t * dir, given invDir = 1 / dir. On a
+    // hit, [tEnter, tExit] is the parametric range inside the box.
+    inline bool IntersectP(const Vector3f& origin, const Vector3f& invDir,
+                           float& tEnter, float& tExit) const;
+
+    // Ray tracer entry point. The per-axis direction signs are accepted for
+    // compatibility with the scalar test; the SIMD test orders each slab itself.
+    template <typename RayT>
+    inline bool IntersectP(const RayT& ray, const Vector3f& invDir,
+                           const std::array<int, 3>&) const
+    {
+        float tEnter, tExit;
+        return IntersectP(ray.origin, invDir, tEnter, tExit);
+    }
+};
+
+inline bool Bounds3::IntersectP(const Vector3f& origin, const Vector3f& invDir,
+                                float& tEnter, float& tExit) const
+{
+    Vector3f t0 = (pMin - origin) * invDir;
+    Vector3f t1 = (pMax - origin) * invDir;
+    Vector3f tNear = Vector3f::Min(t0, t1), tFar = Vector3f::Max(t0, t1);
+    tEnter = maxComponent(tNear);
+    tExit = minComponent(tFar);
+    return tEnter <= tExit && tExit >= 0;
+}
+
+inline Bounds3 Union(const Bounds3& b1, const Bounds3& b2)
+{
+    Bounds3 ret;
+    ret.pMin = Vector3f::Min(b1.pMin, b2.pMin);
+    ret.pMax = Vector3f::Max(b1.pMax, b2.pMax);
+    return ret;
+}
+
+inline Bounds3 Union(const Bounds3& b, const Vector3f& p)
+{
+    Bounds3 ret;
+    ret.pMin = Vector3f::Min(b.pMin, p);
+    ret.pMax = Vector3f::Max(b.pMax, p);
+    return ret;
+}
+
+#endif // RAYMATH_BOUNDS3_H
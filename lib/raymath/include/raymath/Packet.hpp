@@ -0,0 +1,366 @@
+//
+// 4- and 8-wide structure-of-arrays math for processing many rays, boxes or
+// primitives at once.
+//
+
+#ifndef RAYMATH_PACKET_H
+#define RAYMATH_PACKET_H
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "Bounds3.hpp"
+
+// Four floats in one SSE register. Comparisons return lane masks (all bits
+// set where true) that select() and movemask() consume.
+struct Float4 {
+    static constexpr int width = 4;
+#ifdef RAYMATH_SSE
+    __m128 v;
+    Float4() = default;
+    Float4(float s) : v(_mm_set1_ps(s)) {}
+    explicit Float4(__m128 m) : v(m) {}
+    static Float4 load(const float* p) { return Float4(_mm_loadu_ps(p)); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    float operator[](int i) const { alignas(16) float f[4]; _mm_store_ps(f, v); return f[i]; }
+#else
+    float v[4];
+    Float4() = default;
+    Float4(float s) : v{s, s, s, s} {}
+    static Float4 load(const float* p) { Float4 r; for (int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+    void store(float* p) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+    float operator[](int i) const { return v[i]; }
+#endif
+};
+
+#ifdef RAYMATH_SSE
+inline Float4 operator+(Float4 a, Float4 b) { return Float4(_mm_add_ps(a.v, b.v)); }
+inline Float4 operator-(Float4 a, Float4 b) { return Float4(_mm_sub_ps(a.v, b.v)); }
+inline Float4 operator*(Float4 a, Float4 b) { return Float4(_mm_mul_ps(a.v, b.v)); }
+inline Float4 operator/(Float4 a, Float4 b) { return Float4(_mm_div_ps(a.v, b.v)); }
+inline Float4 operator<(Float4 a, Float4 b) { return Float4(_mm_cmplt_ps(a.v, b.v)); }
+inline Float4 operator<=(Float4 a, Float4 b) { return Float4(_mm_cmple_ps(a.v, b.v)); }
+inline Float4 operator>(Float4 a, Float4 b) { return Float4(_mm_cmpgt_ps(a.v, b.v)); }
+inline Float4 operator>=(Float4 a, Float4 b) { return Float4(_mm_cmpge_ps(a.v, b.v)); }
+inline Float4 operator&(Float4 a, Float4 b) { return Float4(_mm_and_ps(a.v, b.v)); }
+inline Float4 operator|(Float4 a, Float4 b) { return Float4(_mm_or_ps(a.v, b.v)); }
+inline Float4 min(Float4 a, Float4 b) { return Float4(_mm_min_ps(a.v, b.v)); }
+inline Float4 max(Float4 a, Float4 b) { return Float4(_mm_max_ps(a.v, b.v)); }
+inline Float4 sqrt(Float4 a) { return Float4(_mm_sqrt_ps(a.v)); }
+inline Float4 rcp(Float4 a) { return Float4(_mm_div_ps(_mm_set1_ps(1.f), a.v)); }
+inline Float4 fmadd(Float4 a, Float4 b, Float4 c)
+{
+#ifdef RAYMATH_FMA
+    return Float4(_mm_fmadd_ps(a.v, b.v, c.v));
+#else
+    return a * b + c;
+#endif
+}
+// mask ? a : b
+inline Float4 select(Float4 mask, Float4 a, Float4 b)
+{
+    return Float4(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)));
+}
+// bit i set where lane i of mask is set
+inline int movemask(Float4 mask) { return _mm_movemask_ps(mask.v); }
+#else
+#define RAYMATH_LANEWISE(op, expr)                           \
+    inline Float4 op(Float4 a, Float4 b)                     \
+    {                                                        \
+        Float4 r;                                            \
+        for (int i = 0; i < 4; ++i) {                        \
+            float x = a.v[i], y = b.v[i];                    \
+            r.v[i] = expr;                                   \
+        }                                                    \
+        return r;                                            \
+    }
+#define RAYMATH_MASK(c) ((c) ? maskTrue() : 0.f)
+inline float maskTrue()
+{
+    unsigned bits = ~0u;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+inline unsigned maskBits(float f)
+{
+    unsigned bits;
+    std::memcpy(&bits, &f, sizeof(f));
+    return bits;
+}
+RAYMATH_LANEWISE(operator+, x + y)
+RAYMATH_LANEWISE(operator-, x - y)
+RAYMATH_LANEWISE(operator*, x * y)
+RAYMATH_LANEWISE(operator/, x / y)
+RAYMATH_LANEWISE(operator<, RAYMATH_MASK(x < y))
+RAYMATH_LANEWISE(operator<=, RAYMATH_MASK(x <= y))
+RAYMATH_LANEWISE(operator>, RAYMATH_MASK(x > y))
+RAYMATH_LANEWISE(operator>=, RAYMATH_MASK(x >= y))
+RAYMATH_LANEWISE(operator&, RAYMATH_MASK(maskBits(x) && maskBits(y)))
+RAYMATH_LANEWISE(operator|, RAYMATH_MASK(maskBits(x) || maskBits(y)))
+RAYMATH_LANEWISE(min, x < y ? x : y)
+RAYMATH_LANEWISE(max, x > y ? x : y)
+#undef RAYMATH_LANEWISE
+#undef RAYMATH_MASK
+inline Float4 sqrt(Float4 a) { Float4 r; for (int i = 0; i < 4; ++i) r.v[i] = std::sqrt(a.v[i]); return r; }
+inline Float4 rcp(Float4 a) { return Float4(1.f) / a; }
+inline Float4 fmadd(Float4 a, Float4 b, Float4 c) { return a * b + c; }
+inline Float4 select(Float4 mask, Float4 a, Float4 b)
+{
+    Float4 r;
+    for (int i = 0; i < 4; ++i)
+        r.v[i] = maskBits(mask.v[i]) ? a.v[i] : b.v[i];
+    return r;
+}
+inline int movemask(Float4 mask)
+{
+    int bits = 0;
+    for (int i = 0; i < 4; ++i)
+        bits |= (maskBits(mask.v[i]) ? 1 : 0) << i;
+    return bits;
+}
+#endif
+
+// Eight floats: one AVX register, or two Float4 halves without AVX
+struct Float8 {
+    static constexpr int width = 8;
+#ifdef RAYMATH_AVX
+    __m256 v;
+    Float8() = default;
+    Float8(float s) : v(_mm256_set1_ps(s)) {}
+    explicit Float8(__m256 m) : v(m) {}
+    static Float8 load(const float* p) { return Float8(_mm256_loadu_ps(p)); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+    float operator[](int i) const { alignas(32) float f[8]; _mm256_store_ps(f, v); return f[i]; }
+#else
+    Float4 lo, hi;
+    Float8() = default;
+    Float8(float s) : lo(s), hi(s) {}
+    Float8(Float4 l, Float4 h) : lo(l), hi(h) {}
+    static Float8 load(const float* p) { return Float8(Float4::load(p), Float4::load(p + 4)); }
+    void store(float* p) const { lo.store(p); hi.store(p + 4); }
+    float operator[](int i) const { return i < 4 ? lo[i] : hi[i - 4]; }
+#endif
+};
+
+#ifdef RAYMATH_AVX
+inline Float8 operator+(Float8 a, Float8 b) { return Float8(_mm256_add_ps(a.v, b.v)); }
+inline Float8 operator-(Float8 a, Float8 b) { return Float8(_mm256_sub_ps(a.v, b.v)); }
+inline Float8 operator*(Float8 a, Float8 b) { return Float8(_mm256_mul_ps(a.v, b.v)); }
+inline Float8 operator/(Float8 a, Float8 b) { return Float8(_mm256_div_ps(a.v, b.v)); }
+inline Float8 operator<(Float8 a, Float8 b) { return Float8(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+inline Float8 operator<=(Float8 a, Float8 b) { return Float8(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)); }
+inline Float8 operator>(Float8 a, Float8 b) { return Float8(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+inline Float8 operator>=(Float8 a, Float8 b) { return Float8(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)); }
+inline Float8 operator&(Float8 a, Float8 b) { return Float8(_mm256_and_ps(a.v, b.v)); }
+inline Float8 operator|(Float8 a, Float8 b) { return Float8(_mm256_or_ps(a.v, b.v)); }
+inline Float8 min(Float8 a, Float8 b) { return Float8(_mm256_min_ps(a.v, b.v)); }
+inline Float8 max(Float8 a, Float8 b) { return Float8(_mm256_max_ps(a.v, b.v)); }
+inline Float8 sqrt(Float8 a) { return Float8(_mm256_sqrt_ps(a.v)); }
+inline Float8 rcp(Float8 a) { return Float8(_mm256_div_ps(_mm256_set1_ps(1.f), a.v)); }
+inline Float8 fmadd(Float8 a, Float8 b, Float8 c)
+{
+#ifdef RAYMATH_FMA
+    return Float8(_mm256_fmadd_ps(a.v, b.v, c.v));
+#else
+    return a * b + c;
+#endif
+}
+inline Float8 select(Float8 mask, Float8 a, Float8 b) { return Float8(_mm256_blendv_ps(b.v, a.v, mask.v)); }
+inline int movemask(Float8 mask) { return _mm256_movemask_ps(mask.v); }
+#else
+#define RAYMATH_HALVES(op) \
+    inline Float8 op(Float8 a, Float8 b) { return Float8(op(a.lo, b.lo), op(a.hi, b.hi)); }
+RAYMATH_HALVES(operator+)
+RAYMATH_HALVES(operator-)
+RAYMATH_HALVES(operator*)
+RAYMATH_HALVES(operator/)
+RAYMATH_HALVES(operator<)
+RAYMATH_HALVES(operator<=)
+RAYMATH_HALVES(operator>)
+RAYMATH_HALVES(operator>=)
+RAYMATH_HALVES(operator&)
+RAYMATH_HALVES(operator|)
+RAYMATH_HALVES(min)
+RAYMATH_HALVES(max)
+#undef RAYMATH_HALVES
+inline Float8 sqrt(Float8 a) { return Float8(sqrt(a.lo), sqrt(a.hi)); }
+inline Float8 rcp(Float8 a) { return Float8(rcp(a.lo), rcp(a.hi)); }
+inline Float8 fmadd(Float8 a, Float8 b, Float8 c) { return Float8(fmadd(a.lo, b.lo, c.lo), fmadd(a.hi, b.hi, c.hi)); }
+inline Float8 select(Float8 m, Float8 a, Float8 b) { return Float8(select(m.lo, a.lo, b.lo), select(m.hi, a.hi, b.hi)); }
+inline int movemask(Float8 mask) { return movemask(mask.lo) | movemask(mask.hi) << 4; }
+#endif
+
+// N vectors with their x, y and z components in separate registers
+template <typename F>
+struct Vector3fN {
+    static constexpr int width = F::width;
+    F x, y, z;
+
+    Vector3fN() = default;
+    Vector3fN(F xx, F yy, F zz) : x(xx), y(yy), z(zz) {}
+    // the same vector in every lane
+    Vector3fN(const Vector3f& v) : x(v.x), y(v.y), z(v.z) {}
+
+    // transpose width consecutive vectors into lanes
+    static Vector3fN gather(const Vector3f* v)
+    {
+        alignas(32) float xs[width], ys[width], zs[width];
+        for (int i = 0; i < width; ++i) {
+            xs[i] = v[i].x;
+            ys[i] = v[i].y;
+            zs[i] = v[i].z;
+        }
+        return Vector3fN(F::load(xs), F::load(ys), F::load(zs));
+    }
+    void scatter(Vector3f* v) const
+    {
+        alignas(32) float xs[width], ys[width], zs[width];
+        x.store(xs);
+        y.store(ys);
+        z.store(zs);
+        for (int i = 0; i < width; ++i)
+            v[i] = Vector3f(xs[i], ys[i], zs[i]);
+    }
+    // lane i from xs[i], ys[i] and zs[i]
+    static Vector3fN load(const float* xs, const float* ys, const float* zs)
+    {
+        return Vector3fN(F::load(xs), F::load(ys), F::load(zs));
+    }
+    Vector3f operator[](int i) const { return Vector3f(x[i], y[i], z[i]); }
+
+    Vector3fN operator+(const Vector3fN& v) const { return {x + v.x, y + v.y, z + v.z}; }
+    Vector3fN operator-(const Vector3fN& v) const { return {x - v.x, y - v.y, z - v.z}; }
+    Vector3fN operator*(const Vector3fN& v) const { return {x * v.x, y * v.y, z * v.z}; }
+    Vector3fN operator*(F s) const { return {x * s, y * s, z * s}; }
+};
+
+using Vector3f4 = Vector3fN<Float4>;
+using Vector3f8 = Vector3fN<Float8>;
+
+// Without FMA this rounds like (x + y) + z, as dotProduct on Vector3f does
+template <typename F>
+inline F dotProduct(const Vector3fN<F>& a, const Vector3fN<F>& b)
+{
+    return fmadd(a.z, b.z, fmadd(a.y, b.y, a.x * b.x));
+}
+
+template <typename F>
+inline Vector3fN<F> crossProduct(const Vector3fN<F>& a, const Vector3fN<F>& b)
+{
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+template <typename F>
+inline Vector3fN<F> normalize(const Vector3fN<F>& v)
+{
+    return v * rcp(sqrt(dotProduct(v, v)));
+}
+
+template <typename F>
+inline Vector3fN<F> min(const Vector3fN<F>& a, const Vector3fN<F>& b)
+{
+    return {min(a.x, b.x), min(a.y, b.y), min(a.z, b.z)};
+}
+
+template <typename F>
+inline Vector3fN<F> max(const Vector3fN<F>& a, const Vector3fN<F>& b)
+{
+    return {max(a.x, b.x), max(a.y, b.y), max(a.z, b.z)};
+}
+
+template <typename F>
+inline Vector3fN<F> rcp(const Vector3fN<F>& v)
+{
+    return {rcp(v.x), rcp(v.y), rcp(v.z)};
+}
+
+// N boxes tested against one ray (or N rays against N boxes) at once.
+// Returns a lane mask of the boxes hit within [0, tMax] and their entry
+// distances in tEnter.
+template <typename F>
+struct Bounds3N {
+    Vector3fN<F> pMin, pMax;
+
+    static Bounds3N gather(const Bounds3* b)
+    {
+        Bounds3N r;
+        alignas(32) float f[6][F::width];
+        for (int i = 0; i < F::width; ++i) {
+            f[0][i] = b[i].pMin.x, f[1][i] = b[i].pMin.y, f[2][i] = b[i].pMin.z;
+            f[3][i] = b[i].pMax.x, f[4][i] = b[i].pMax.y, f[5][i] = b[i].pMax.z;
+        }
+        r.pMin = Vector3fN<F>(F::load(f[0]), F::load(f[1]), F::load(f[2]));
+        r.pMax = Vector3fN<F>(F::load(f[3]), F::load(f[4]), F::load(f[5]));
+        return r;
+    }
+
+    F IntersectP(const Vector3fN<F>& origin, const Vector3fN<F>& invDir, F tMax, F& tEnter) const
+    {
+        Vector3fN<F> t0 = (pMin - origin) * invDir;
+        Vector3fN<F> t1 = (pMax - origin) * invDir;
+        Vector3fN<F> tNear = min(t0, t1), tFar = max(t0, t1);
+        tEnter = max(max(tNear.x, tNear.y), max(tNear.z, F(0.f)));
+        F tExit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+        return tEnter <= tExit;
+    }
+};
+
+using Bounds3f4 = Bounds3N<Float4>;
+using Bounds3f8 = Bounds3N<Float8>;
+
+// Vectors stored as three float arrays padded to a multiple of eight, so
+// that any aligned group of 4 or 8 can be loaded without a transpose
+class Vector3fArray {
+public:
+    Vector3fArray(size_t n = 0) { resize(n); }
+
+    void resize(size_t n)
+    {
+        count = n;
+        size_t padded = (n + 7) & ~size_t(7);
+        xs.resize(padded);
+        ys.resize(padded);
+        zs.resize(padded);
+    }
+    size_t size() const { return count; }
+
+    void set(size_t i, const Vector3f& v) { xs[i] = v.x, ys[i] = v.y, zs[i] = v.z; }
+    Vector3f get(size_t i) const { return Vector3f(xs[i], ys[i], zs[i]); }
+
+    template <typename F>
+    Vector3fN<F> load(size_t i) const
+    {
+        return Vector3fN<F>(F::load(&xs[i]), F::load(&ys[i]), F::load(&zs[i]));
+    }
+    template <typename F>
+    void store(size_t i, const Vector3fN<F>& v)
+    {
+        v.x.store(&xs[i]);
+        v.y.store(&ys[i]);
+        v.z.store(&zs[i]);
+    }
+
+private:
+    size_t count = 0;
+    std::vector<float> xs, ys, zs;
+};
+
+// Bulk kernels over whole arrays, 8 lanes at a time
+inline void dotProducts(const Vector3fArray& a, const Vector3fArray& b, float* out)
+{
+    size_t n = a.size(), i = 0;
+    for (; i + 8 <= n; i += 8)
+        dotProduct(a.load<Float8>(i), b.load<Float8>(i)).store(out + i);
+    for (; i < n; ++i)
+        out[i] = dotProduct(a.get(i), b.get(i));
+}
+
+inline void normalizeAll(Vector3fArray& v)
+{
+    // the padding lanes hold zeros; normalising them is harmless
+    for (size_t i = 0; i < v.size(); i += 8)
+        v.store(i, normalize(v.load<Float8>(i)));
+}
+
+#endif // RAYMATH_PACKET_H
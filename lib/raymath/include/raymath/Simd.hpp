@@ -0,0 +1,25 @@
+//
+// Instruction set selection for raymath.
+//
+
+#ifndef RAYMATH_SIMD_H
+#define RAYMATH_SIMD_H
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYMATH_SSE 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define RAYMATH_AVX 1
+#endif
+
+#if defined(__FMA__) || defined(__AVX2__)
+#define RAYMATH_FMA 1
+#endif
+
+#if defined(RAYMATH_AVX) || defined(RAYMATH_FMA)
+#include <immintrin.h>
+#endif
+
+#endif // RAYMATH_SIMD_H
@@ -0,0 +1,162 @@
+//
+// Vector types shared by the ray tracers.
+//
+
+#ifndef RAYMATH_VECTOR_H
+#define RAYMATH_VECTOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "Simd.hpp"
+
+// A 3D vector padded to 16 bytes so that it loads into one SSE register.
+// The padding lane w carries no meaning and may hold any value; every
+// operation ignores it. Without SSE the same operations run on scalars.
+// With SSE but without FMA the results are bit-identical to the scalar code.
+class alignas(16) Vector3f {
+public:
+    Vector3f() : x(0), y(0), z(0), w(0) {}
+    Vector3f(float xx) : x(xx), y(xx), z(xx), w(0) {}
+    Vector3f(float xx, float yy, float zz) : x(xx), y(yy), z(zz), w(0) {}
+
+#ifdef RAYMATH_SSE
+    explicit Vector3f(__m128 v) { _mm_store_ps(&x, v); }
+    __m128 m128() const { return _mm_load_ps(&x); }
+
+    Vector3f operator * (const float &r) const { return Vector3f(_mm_mul_ps(m128(), _mm_set1_ps(r))); }
+    Vector3f operator / (const float &r) const { return Vector3f(_mm_div_ps(m128(), _mm_set1_ps(r))); }
+    Vector3f operator * (const Vector3f &v) const { return Vector3f(_mm_mul_ps(m128(), v.m128())); }
+    Vector3f operator / (const Vector3f &v) const { return Vector3f(_mm_div_ps(m128(), v.m128())); }
+    Vector3f operator - (const Vector3f &v) const { return Vector3f(_mm_sub_ps(m128(), v.m128())); }
+    Vector3f operator + (const Vector3f &v) const { return Vector3f(_mm_add_ps(m128(), v.m128())); }
+    // flip the sign bit so that -0 comes out like scalar negation
+    Vector3f operator - () const { return Vector3f(_mm_xor_ps(m128(), _mm_set1_ps(-0.f))); }
+    // operands ordered so NaNs propagate exactly like std::min / std::max
+    static Vector3f Min(const Vector3f &p1, const Vector3f &p2) { return Vector3f(_mm_min_ps(p2.m128(), p1.m128())); }
+    static Vector3f Max(const Vector3f &p1, const Vector3f &p2) { return Vector3f(_mm_max_ps(p2.m128(), p1.m128())); }
+#else
+    Vector3f operator * (const float &r) const { return Vector3f(x * r, y * r, z * r); }
+    Vector3f operator / (const float &r) const { return Vector3f(x / r, y / r, z / r); }
+    Vector3f operator * (const Vector3f &v) const { return Vector3f(x * v.x, y * v.y, z * v.z); }
+    Vector3f operator / (const Vector3f &v) const { return Vector3f(x / v.x, y / v.y, z / v.z); }
+    Vector3f operator - (const Vector3f &v) const { return Vector3f(x - v.x, y - v.y, z - v.z); }
+    Vector3f operator + (const Vector3f &v) const { return Vector3f(x + v.x, y + v.y, z + v.z); }
+    Vector3f operator - () const { return Vector3f(-x, -y, -z); }
+    static Vector3f Min(const Vector3f &p1, const Vector3f &p2) {
+        return Vector3f(std::min(p1.x, p2.x), std::min(p1.y, p2.y), std::min(p1.z, p2.z));
+    }
+    static Vector3f Max(const Vector3f &p1, const Vector3f &p2) {
+        return Vector3f(std::max(p1.x, p2.x), std::max(p1.y, p2.y), std::max(p1.z, p2.z));
+    }
+#endif
+
+    Vector3f& operator += (const Vector3f &v) { return *this = *this + v; }
+    Vector3f& operator -= (const Vector3f &v) { return *this = *this - v; }
+    Vector3f& operator *= (const float &r) { return *this = *this * r; }
+    Vector3f& operator /= (const float &r) { return *this = *this / r; }
+    friend Vector3f operator * (const float &r, const Vector3f &v) { return v * r; }
+    friend std::ostream & operator << (std::ostream &os, const Vector3f &v)
+    { return os << v.x << ", " << v.y << ", " << v.z; }
+
+    float operator[](int index) const { return (&x)[index]; }
+    float& operator[](int index) { return (&x)[index]; }
+
+    float norm() const;
+    Vector3f normalized() const;
+
+    float x, y, z;
+    float w;
+};
+
+class Vector2f
+{
+public:
+    Vector2f() : x(0), y(0) {}
+    Vector2f(float xx) : x(xx), y(xx) {}
+    Vector2f(float xx, float yy) : x(xx), y(yy) {}
+    Vector2f operator * (const float &r) const { return Vector2f(x * r, y * r); }
+    Vector2f operator + (const Vector2f &v) const { return Vector2f(x + v.x, y + v.y); }
+    float x, y;
+};
+
+inline float dotProduct(const Vector3f &a, const Vector3f &b)
+{
+#if defined(RAYMATH_SSE) && defined(RAYMATH_FMA)
+    __m128 va = a.m128(), vb = b.m128();
+    __m128 r = _mm_mul_ss(_mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 2, 2, 2)),
+                          _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 2, 2)));
+    r = _mm_fmadd_ss(_mm_shuffle_ps(va, va, _MM_SHUFFLE(1, 1, 1, 1)),
+                     _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(1, 1, 1, 1)), r);
+    return _mm_cvtss_f32(_mm_fmadd_ss(va, vb, r));
+#elif defined(RAYMATH_SSE)
+    // (x + y) + z, the same order as the scalar expression
+    __m128 m = _mm_mul_ps(a.m128(), b.m128());
+    __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2))));
+#else
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+#endif
+}
+
+inline Vector3f crossProduct(const Vector3f &a, const Vector3f &b)
+{
+#ifdef RAYMATH_SSE
+    // a * b.yzx - a.yzx * b gives the cross product in zxy order
+    __m128 va = a.m128(), vb = b.m128();
+    __m128 aYzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+#ifdef RAYMATH_FMA
+    __m128 c = _mm_fmsub_ps(va, bYzx, _mm_mul_ps(aYzx, vb));
+#else
+    __m128 c = _mm_sub_ps(_mm_mul_ps(va, bYzx), _mm_mul_ps(aYzx, vb));
+#endif
+    return Vector3f(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+#else
+    return Vector3f(
+            a.y * b.z - a.z * b.y,
+            a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x
+    );
+#endif
+}
+
+// a * b + c, fused when the target has FMA
+inline Vector3f fmadd(const Vector3f &a, const Vector3f &b, const Vector3f &c)
+{
+#if defined(RAYMATH_SSE) && defined(RAYMATH_FMA)
+    return Vector3f(_mm_fmadd_ps(a.m128(), b.m128(), c.m128()));
+#else
+    return a * b + c;
+#endif
+}
+
+// Component-wise 1 / v; zero components give infinities of the same sign,
+// as ray direction reciprocals in slab tests expect
+inline Vector3f rcp(const Vector3f &v)
+{
+    return Vector3f(1.f) / v;
+}
+
+inline float minComponent(const Vector3f &v) { return std::min(v.x, std::min(v.y, v.z)); }
+inline float maxComponent(const Vector3f &v) { return std::max(v.x, std::max(v.y, v.z)); }
+
+inline Vector3f lerp(const Vector3f &a, const Vector3f& b, const float &t)
+{ return a * (1 - t) + b * t; }
+
+inline Vector3f normalize(const Vector3f &v)
+{
+    float mag2 = dotProduct(v, v);
+    if (mag2 > 0) {
+        float invMag = 1 / sqrtf(mag2);
+        return v * invMag;
+    }
+
+    return v;
+}
+
+inline float Vector3f::norm() const { return std::sqrt(dotProduct(*this, *this)); }
+
+inline Vector3f Vector3f::normalized() const { return *this / norm(); }
+
+#endif // RAYMATH_VECTOR_H